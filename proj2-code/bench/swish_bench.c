@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * Benchmarks for swish. Each run starts ./swish in batch mode with its stdin
+ * and stdout connected to pipes and measures:
+ *   noop_rate     Foreground commands per second for an external no-op
+ *   exec_latency  Time from a command line reaching the shell to the
+ *                 command's main() running (median and 99th percentile)
+ *   jobs_*        Cost of starting N background jobs and of 'jobs', 'fg' and
+ *                 'wait-all' with N jobs in the table
+ *
+ * Synchronization uses this program itself: "swish_bench --stamp" prints the
+ * CLOCK_MONOTONIC time at which it started, and since the shell flushes its
+ * output before launching anything, the stamp also marks the point where all
+ * earlier output has been read.
+ *
+ * Results are written one JSON object per line, e.g.
+ *   {"backend": "spawn", "bench": "noop_rate", "jobs": 0, "value": 1234.5, "unit": "cmd/s"}
+ *
+ * Usage: swish_bench [-b spawn|fork]... [-n jobs]... [-o file]
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NOOP_COMMANDS 2000
+#define LATENCY_SAMPLES 200
+#define MAX_BACKENDS 4
+#define MAX_JOB_COUNTS 8
+
+typedef struct {
+    pid_t pid;
+    FILE *in;     // Commands for the shell
+    FILE *out;    // The shell's standard output
+} shell_t;
+
+static char stamp_cmd[4096];    // Command line that runs "swish_bench --stamp"
+static FILE *results;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *backend, const char *bench, long jobs, double value,
+                   const char *unit) {
+    fprintf(results, "{\"backend\": \"%s\", \"bench\": \"%s\", \"jobs\": %ld, \"value\": %.3f, "
+                     "\"unit\": \"%s\"}\n",
+            backend, bench, jobs, value, unit);
+    fflush(results);
+}
+
+/*
+ * Start ./swish with the given launch backend, reading commands from a pipe
+ */
+static int shell_start(shell_t *sh, const char *backend) {
+    int to_shell[2], from_shell[2];
+    if (pipe(to_shell) == -1 || pipe(from_shell) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    sh->pid = fork();
+    if (sh->pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (sh->pid == 0) {
+        dup2(to_shell[0], STDIN_FILENO);
+        dup2(from_shell[1], STDOUT_FILENO);
+        close(to_shell[0]);
+        close(to_shell[1]);
+        close(from_shell[0]);
+        close(from_shell[1]);
+        setenv("SWISH_LAUNCH", backend, 1);
+        execl("./swish", "swish", (char *) NULL);
+        perror("exec ./swish");
+        _exit(127);
+    }
+    close(to_shell[0]);
+    close(from_shell[1]);
+    sh->in = fdopen(to_shell[1], "w");
+    sh->out = fdopen(from_shell[0], "r");
+    if (sh->in == NULL || sh->out == NULL) {
+        perror("fdopen");
+        return -1;
+    }
+    return 0;
+}
+
+static void shell_stop(shell_t *sh) {
+    fprintf(sh->in, "exit\n");
+    fclose(sh->in);
+    fclose(sh->out);
+    waitpid(sh->pid, NULL, 0);
+}
+
+/*
+ * Ask the shell to run a stamp command and read its output up to the stamp,
+ * discarding everything before it
+ * Returns the stamp, or -1 if the shell's output ended first
+ */
+static long long shell_sync(shell_t *sh) {
+    fprintf(sh->in, "%s\n", stamp_cmd);
+    fflush(sh->in);
+    char line[256];
+    while (fgets(line, sizeof(line), sh->out) != NULL) {
+        long long stamp;
+        if (sscanf(line, "stamp %lld", &stamp) == 1) {
+            return stamp;
+        }
+    }
+    fprintf(stderr, "swish_bench: shell output ended unexpectedly\n");
+    return -1;
+}
+
+/*
+ * Run one command line and return the time until the following stamp, with
+ * the shell's cost of running the stamp itself subtracted
+ * Returns the time in nanoseconds, or -1 if the shell's output ended
+ */
+static double timed_command(shell_t *sh, const char *cmd, double stamp_ns) {
+    long long start = now_ns();
+    fprintf(sh->in, "%s\n", cmd);
+    long long end = shell_sync(sh);
+    if (end < 0) {
+        return -1;
+    }
+    // Noise may make a very cheap command look faster than the stamp alone
+    double elapsed = (end - start) - stamp_ns;
+    return elapsed > 0 ? elapsed : 0;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench_noop_rate(const char *backend) {
+    shell_t sh;
+    if (shell_start(&sh, backend) == -1 || shell_sync(&sh) < 0) {
+        return -1;
+    }
+    long long start = now_ns();
+    for (int i = 0; i < NOOP_COMMANDS; i++) {
+        fprintf(sh.in, "/bin/true\n");
+    }
+    long long end = shell_sync(&sh);
+    shell_stop(&sh);
+    if (end < 0) {
+        return -1;
+    }
+    report(backend, "noop_rate", 0, NOOP_COMMANDS / ((end - start) / 1e9), "cmd/s");
+    return 0;
+}
+
+/*
+ * Measures exec latency; also returns the median in 'median_ns', which is
+ * what running one stamp command costs
+ */
+static int bench_exec_latency(const char *backend, double *median_ns) {
+    shell_t sh;
+    if (shell_start(&sh, backend) == -1 || shell_sync(&sh) < 0) {
+        return -1;
+    }
+    long long samples[LATENCY_SAMPLES];
+    for (int i = 0; i < LATENCY_SAMPLES; i++) {
+        long long start = now_ns();
+        long long stamp = shell_sync(&sh);
+        if (stamp < 0) {
+            shell_stop(&sh);
+            return -1;
+        }
+        samples[i] = stamp - start;
+    }
+    shell_stop(&sh);
+    qsort(samples, LATENCY_SAMPLES, sizeof(long long), compare_ll);
+    *median_ns = samples[LATENCY_SAMPLES / 2];
+    report(backend, "exec_latency_p50", 0, samples[LATENCY_SAMPLES / 2] / 1e3, "us");
+    report(backend, "exec_latency_p99", 0, samples[LATENCY_SAMPLES * 99 / 100] / 1e3, "us");
+    return 0;
+}
+
+/*
+ * Kill every slow_write process that is a child of 'parent', so that the
+ * shell's background jobs finish without waiting for them
+ */
+static void kill_slow_writers(pid_t parent) {
+    DIR *proc = opendir("/proc");
+    if (proc == NULL) {
+        perror("/proc");
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(proc)) != NULL) {
+        if (!isdigit((unsigned char) entry->d_name[0])) {
+            continue;
+        }
+        char path[300], comm[64];
+        int pid, ppid;
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        FILE *stat = fopen(path, "r");
+        if (stat == NULL) {
+            continue;
+        }
+        if (fscanf(stat, "%d (%63[^)]) %*c %d", &pid, comm, &ppid) == 3 && ppid == parent &&
+            strcmp(comm, "slow_write") == 0) {
+            kill(pid, SIGKILL);
+        }
+        fclose(stat);
+    }
+    closedir(proc);
+}
+
+static int bench_jobs(const char *backend, long njobs, double stamp_ns) {
+    shell_t sh;
+    if (shell_start(&sh, backend) == -1 || shell_sync(&sh) < 0) {
+        return -1;
+    }
+    // njobs long-running jobs, then one that exits at once for 'fg' to reap
+    long long start = now_ns();
+    for (long i = 0; i < njobs; i++) {
+        fprintf(sh.in, "./slow_write 1 600 /dev/null &\n");
+    }
+    fprintf(sh.in, "./slow_write 0 0 /dev/null &\n");
+    long long end = shell_sync(&sh);
+    if (end < 0) {
+        kill_slow_writers(sh.pid);
+        shell_stop(&sh);
+        return -1;
+    }
+    report(backend, "jobs_start_rate", njobs, (njobs + 1) / ((end - start) / 1e9), "jobs/s");
+
+    double jobs_ns = timed_command(&sh, "jobs", stamp_ns);
+    char fg_cmd[32];
+    snprintf(fg_cmd, sizeof(fg_cmd), "fg %ld", njobs);
+    double fg_ns = timed_command(&sh, fg_cmd, stamp_ns);
+    kill_slow_writers(sh.pid);
+    double wait_ns = timed_command(&sh, "wait-all", stamp_ns);
+    shell_stop(&sh);
+    if (jobs_ns < 0 || fg_ns < 0 || wait_ns < 0) {
+        return -1;
+    }
+    report(backend, "jobs_list", njobs, jobs_ns / 1e3, "us");
+    report(backend, "jobs_fg", njobs, fg_ns / 1e3, "us");
+    report(backend, "jobs_wait_all", njobs, wait_ns / 1e3, "us");
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "--stamp") == 0) {
+        printf("stamp %lld\n", now_ns());
+        return 0;
+    }
+
+    const char *backends[MAX_BACKENDS];
+    int nbackends = 0;
+    long job_counts[MAX_JOB_COUNTS];
+    int ncounts = 0;
+    const char *out_file = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:n:o:")) != -1) {
+        if (opt == 'b' && nbackends < MAX_BACKENDS) {
+            backends[nbackends++] = optarg;
+        } else if (opt == 'n' && ncounts < MAX_JOB_COUNTS) {
+            job_counts[ncounts++] = atol(optarg);
+        } else if (opt == 'o') {
+            out_file = optarg;
+        } else {
+            fprintf(stderr, "Usage: %s [-b spawn|fork]... [-n jobs]... [-o file]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (nbackends == 0) {
+        backends[nbackends++] = "spawn";
+        backends[nbackends++] = "fork";
+    }
+    if (ncounts == 0) {
+        job_counts[ncounts++] = 10;
+        job_counts[ncounts++] = 1000;
+        job_counts[ncounts++] = 10000;
+    }
+    results = stdout;
+    if (out_file != NULL && (results = fopen(out_file, "w")) == NULL) {
+        perror(out_file);
+        return 1;
+    }
+    char self[4000];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        perror("readlink");
+        return 1;
+    }
+    self[len] = '\0';
+    snprintf(stamp_cmd, sizeof(stamp_cmd), "%s --stamp", self);
+    // Children that exit while we are writing must not kill the benchmark
+    signal(SIGPIPE, SIG_IGN);
+
+    int ret = 0;
+    for (int b = 0; b < nbackends; b++) {
+        double stamp_ns = 0;
+        if (bench_noop_rate(backends[b]) == -1 ||
+            bench_exec_latency(backends[b], &stamp_ns) == -1) {
+            ret = 1;
+            continue;
+        }
+        for (int c = 0; c < ncounts; c++) {
+            if (bench_jobs(backends[b], job_counts[c], stamp_ns) == -1) {
+                ret = 1;
+            }
+        }
+    }
+    if (results != stdout) {
+        fclose(results);
+    }
+    return ret;
+}
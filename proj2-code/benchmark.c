@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "benchmark.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_USAGE "bench: usage: bench [-w WARMUP] [-b spawn|fork|server] RUNS command [args...]\n"
+#define OUTLIER_SCORE 3.5    // Modified z-score beyond which a time is an outlier
+
+/*
+ * Parse a count; returns it, or -1 if it is not a number at least 'min'
+ */
+static long parse_count(const char *s, long min) {
+    char *end;
+    errno = 0;
+    long n = s == NULL ? 0 : strtol(s, &end, 10);
+    if (s == NULL || errno != 0 || end == s || *end != '\0' || n < min || n > 1000000) {
+        return -1;
+    }
+    return n;
+}
+
+int bench_parse_options(char **argv, bench_options_t *options) {
+    options->warmup = 0;
+    options->backend = NULL;
+    int i = 1;
+    while (argv[i] != NULL && argv[i][0] == '-') {
+        long n;
+        if (strcmp(argv[i], "-w") == 0 && (n = parse_count(argv[i + 1], 0)) != -1) {
+            options->warmup = n;
+        } else if (strcmp(argv[i], "-b") == 0 && argv[i + 1] != NULL) {
+            options->backend = argv[i + 1];
+        } else {
+            fprintf(stderr, BENCH_USAGE);
+            return -1;
+        }
+        i += 2;
+    }
+    long runs = parse_count(argv[i], 1);
+    if (runs == -1 || argv[i + 1] == NULL) {
+        fprintf(stderr, BENCH_USAGE);
+        return -1;
+    }
+    options->runs = runs;
+    return i + 1;
+}
+
+static int compare_times(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double median(const double *sorted, unsigned n) {
+    return n % 2 == 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/*
+ * Count the times whose modified z-score, 0.6745 (x - median) / MAD, is
+ * beyond OUTLIER_SCORE (Iglewicz and Hoaglin); none when half of the times
+ * are the same, which leaves a MAD of zero; 'deviations' has room for n times
+ */
+static unsigned count_outliers(const double *sorted, double *deviations, unsigned n) {
+    double mid = median(sorted, n);
+    for (unsigned i = 0; i < n; i++) {
+        deviations[i] = sorted[i] > mid ? sorted[i] - mid : mid - sorted[i];
+    }
+    qsort(deviations, n, sizeof(double), compare_times);
+    double mad = median(deviations, n);
+    unsigned outliers = 0;
+    for (unsigned i = 0; mad > 0 && i < n; i++) {
+        double score = 0.6745 * (sorted[i] - mid) / mad;
+        outliers += score > OUTLIER_SCORE || score < -OUTLIER_SCORE;
+    }
+    return outliers;
+}
+
+/*
+ * Print the row of the report for one kind of time, in units of 'scale'
+ * seconds; 'times' must be sorted
+ */
+static void print_row(const char *label, const double *times, unsigned n, double scale,
+                      const char *unit) {
+    unsigned p95 = (95 * n + 99) / 100;    // Nearest rank, counted from 1
+    double row[4] = {times[0], median(times, n), times[p95 - 1], times[n - 1]};
+    fprintf(stderr, "%-6s", label);
+    for (unsigned i = 0; i < 4; i++) {
+        fprintf(stderr, "%11.3f%s", row[i] / scale, unit);
+    }
+    fprintf(stderr, "\n");
+}
+
+void bench_report(const bench_sample_t *samples, unsigned nsamples) {
+    double *real = malloc(4 * nsamples * sizeof(double));
+    if (real == NULL) {
+        perror("malloc");
+        return;
+    }
+    double *user = real + nsamples, *sys = user + nsamples, *scratch = sys + nsamples;
+    for (unsigned i = 0; i < nsamples; i++) {
+        real[i] = samples[i].real;
+        user[i] = samples[i].user;
+        sys[i] = samples[i].sys;
+    }
+    qsort(real, nsamples, sizeof(double), compare_times);
+    qsort(user, nsamples, sizeof(double), compare_times);
+    qsort(sys, nsamples, sizeof(double), compare_times);
+    // One unit for the whole report, chosen by the typical wall-clock time
+    double typical = median(real, nsamples);
+    double scale = typical < 1e-3 ? 1e-6 : typical < 1 ? 1e-3 : 1;
+    const char *unit = typical < 1e-3 ? "us" : typical < 1 ? "ms" : "s ";
+    fprintf(stderr, "%-6s%13s%13s%13s%13s\n", "", "min", "median", "p95", "max");
+    print_row("real", real, nsamples, scale, unit);
+    print_row("user", user, nsamples, scale, unit);
+    print_row("sys", sys, nsamples, scale, unit);
+    unsigned outliers = count_outliers(real, scratch, nsamples);
+    fprintf(stderr, "%u runs, %u outlier%s in real time\n", nsamples, outliers,
+            outliers == 1 ? "" : "s");
+    free(real);
+}
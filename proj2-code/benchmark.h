@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/*
+ * Repeated timing of a pipeline, in the style of hyperfine, with 'bench' at
+ * the start of the pipeline:
+ *
+ *   bench [-w WARMUP] [-b spawn|fork|server] RUNS pipeline
+ *
+ * The pipeline runs RUNS times in the foreground exactly as it would without
+ * 'bench', after WARMUP runs that are not counted, and with -b through the
+ * given launch backend. The wall-clock time of each run covers starting,
+ * waiting for and reaping the pipeline; the CPU times are those wait4()
+ * reports for its processes. A run that fails stops the benchmark.
+ *
+ * The report goes to stderr, like that of 'time': the minimum, median,
+ * 95th percentile (nearest rank) and maximum of each time, and the number of
+ * wall-clock times that are outliers by their modified z-score, which is
+ * based on the median absolute deviation and so is not thrown off by the
+ * outliers themselves.
+ */
+
+// Times of one run, in seconds
+typedef struct {
+    double real;
+    double user;
+    double sys;
+} bench_sample_t;
+
+// What the options before the pipeline ask for
+typedef struct {
+    unsigned runs;
+    unsigned warmup;
+    const char *backend;    // Launch backend to use, or NULL to keep the current one
+} bench_options_t;
+
+/*
+ * Parse "bench [-w WARMUP] [-b BACKEND] RUNS"
+ * argv: Words of the pipeline's first command, starting with "bench"
+ * options: Filled in with the options
+ * Returns the number of words they take, or -1 if they are malformed or no
+ * command follows them, which has been reported
+ */
+int bench_parse_options(char **argv, bench_options_t *options);
+
+/*
+ * Print the statistics of the runs to stderr
+ * samples: Times of the counted runs
+ * nsamples: Number of counted runs, at least 1
+ */
+void bench_report(const bench_sample_t *samples, unsigned nsamples);
+
+#endif    // BENCHMARK_H
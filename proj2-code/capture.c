@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fanout.h"
+#include "launch.h"
+#include "parser.h"
+#include "swish_funcs.h"
+
+#define READ_CHUNK (64 * 1024)    // Room made in the buffer before each read()
+
+static job_list_t *shell_jobs = NULL;
+
+void capture_init(job_list_t *jobs) {
+    shell_jobs = jobs;
+}
+
+void capture_free(capture_t *out) {
+    free(out->data);
+    out->data = NULL;
+    out->len = 0;
+    out->capacity = 0;
+}
+
+/*
+ * Make room for at least 'n' more bytes in the buffer
+ */
+static int reserve(capture_t *out, size_t n) {
+    if (out->len + n <= out->capacity) {
+        return 0;
+    }
+    size_t new_capacity = out->capacity == 0 ? READ_CHUNK : out->capacity;
+    while (new_capacity < out->len + n) {
+        new_capacity *= 2;
+    }
+    char *new_data = realloc(out->data, new_capacity);
+    if (new_data == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    out->data = new_data;
+    out->capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Append everything that can be read from a descriptor, up to end-of-file
+ */
+static int read_all(int fd, capture_t *out) {
+    while (1) {
+        if (reserve(out, READ_CHUNK) == -1) {
+            return -1;
+        }
+        ssize_t n = read(fd, out->data + out->len, out->capacity - out->len);
+        if (n == 0) {
+            return 0;
+        } else if (n > 0) {
+            out->len += n;
+        } else if (errno != EINTR) {
+            perror("read");
+            return -1;
+        }
+    }
+}
+
+/*
+ * Start one stage of the command in a child: an external command through the
+ * launch backend, and a builtin in a forked copy of the shell
+ * Returns the child's pid, or -1 if it could not be started
+ */
+static pid_t start_stage(const command_t *cmd, pid_t pgid, int in_fd, int out_fd) {
+    if (cmd->argc > 0 && !is_builtin(cmd->argv[0])) {
+        return launch_command(cmd, pgid, in_fd, out_fd);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    } else if (pid == 0) {
+        setpgid(0, pgid);
+        if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+            dup2(out_fd, STDOUT_FILENO) == -1) {
+            perror("dup2");
+            _exit(1);
+        }
+        run_builtin(cmd, shell_jobs);
+        fflush(stdout);
+        _exit(last_status);
+    }
+    setpgid(pid, pgid == 0 ? pid : pgid);
+    return pid;
+}
+
+/*
+ * Run a builtin that leaves the shell alone inside the shell, with its
+ * standard output in a memfd
+ * Returns 1 if it ran, 0 if it has to run in a process instead, or -1 on error
+ */
+static int run_in_shell(const command_t *cmd, capture_t *out) {
+    int flags = builtin_flags(cmd->argv[0]);
+    if (flags == -1 || !(flags & (BUILTIN_UTILITY | BUILTIN_PURE))) {
+        return 0;
+    }
+    int fd = memfd_create("swish-capture", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (saved == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+        perror("dup2");
+        if (saved != -1) {
+            close(saved);
+        }
+        close(fd);
+        return -1;
+    }
+    int ran = run_builtin(cmd, shell_jobs) != BUILTIN_NONE;
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    int ret = ran;
+    struct stat st;
+    if (ran && fstat(fd, &st) == 0 && st.st_size > 0) {
+        ssize_t n = -1;
+        if (reserve(out, st.st_size) == -1) {
+            ret = -1;
+        } else if ((n = pread(fd, out->data + out->len, st.st_size, 0)) == -1) {
+            perror("pread");
+            ret = -1;
+        }
+        out->len += n > 0 ? n : 0;
+    }
+    close(fd);
+    return ret;
+}
+
+/*
+ * Wait for the processes of the command, setting last_status from the last one
+ */
+static void wait_stages(const pid_t *pids, unsigned npids) {
+    for (unsigned i = 0; i < npids; i++) {
+        int status = 0;
+        while (waitpid(pids[i], &status, 0) == -1 && errno == EINTR) {
+        }
+        if (i + 1 == npids) {
+            last_status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+        }
+    }
+}
+
+/*
+ * Run the stages of the command in child processes connected by pipes, the
+ * last one writing to the pipe that is read into the buffer
+ * Returns 0 on success or -1 on error
+ */
+static int run_stages(const pipeline_t *pipeline, capture_t *out) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    unsigned nstages = pipeline->ncommands, npids = 0;
+    pid_t pids[nstages];
+    int in_fd = -1, failed_status = -1;
+    for (unsigned s = 0; s < nstages; s++) {
+        int stage_pipe[2] = {-1, pipe_fds[1]};
+        if (s + 1 < nstages && pipe2(stage_pipe, O_CLOEXEC) == -1) {
+            perror("pipe");
+            break;
+        }
+        pid_t pid = start_stage(&pipeline->commands[s], npids == 0 ? 0 : pids[0], in_fd,
+                                stage_pipe[1]);
+        if (pid != -1) {
+            pids[npids++] = pid;
+        } else if (s + 1 == nstages) {
+            failed_status = errno == ENOENT ? 127 : errno != 0 ? 126 : 1;
+        }
+        if (in_fd != -1) {
+            close(in_fd);
+        }
+        if (stage_pipe[1] != pipe_fds[1]) {
+            close(stage_pipe[1]);
+        }
+        in_fd = stage_pipe[0];
+    }
+    if (in_fd != -1) {
+        close(in_fd);
+    }
+    close(pipe_fds[1]);
+    int ret = read_all(pipe_fds[0], out);
+    close(pipe_fds[0]);
+    wait_stages(pids, npids);
+    fanout_wait();
+    if (failed_status != -1) {
+        last_status = failed_status;
+    }
+    return ret;
+}
+
+int capture_command(char *text, capture_t *out) {
+    out->len = 0;
+    cmdline_t sub;
+    cmdline_init(&sub);
+    int ret = -1;
+    if (cmdline_parse(&sub, text) == -1) {
+        goto out;
+    }
+    if (sub.npipelines == 0) {
+        last_status = 0;
+        ret = 0;
+        goto out;
+    }
+    const pipeline_t *pipeline = &sub.pipelines[0];
+    if (sub.npipelines > 1 || sub.nheredocs > 0 || pipeline->link != LINK_END ||
+        pipeline->background || pipeline->timed) {
+        fprintf(stderr, "swish: a command substitution must be a single pipeline\n");
+        goto out;
+    }
+    if (pipeline->ncommands == 1 && pipeline->commands[0].argc > 0) {
+        int ran = run_in_shell(&pipeline->commands[0], out);
+        if (ran != 0) {
+            ret = ran == 1 ? 0 : -1;
+            goto out;
+        }
+    }
+    ret = run_stages(pipeline, out);
+
+out:
+    cmdline_free(&sub);
+    return ret;
+}
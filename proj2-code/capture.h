@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+
+#include "job_list.h"
+
+/*
+ * Command substitution, $(command): the command runs while the line that
+ * contains it is parsed, and its output replaces it (see parser.h).
+ *
+ * External commands are started by the usual launch backend with a pipe as
+ * their standard output, which is read in large chunks into a growable
+ * buffer that is kept for the next substitution. Builtins that change
+ * nothing in the shell, such as echo, printf, cat and pwd, run inside the
+ * shell with their output sent to a memfd that is read back in one go, so
+ * they need no process at all. Any other builtin runs in a forked copy of
+ * the shell, so that $(cd dir) or $(exit) leave the shell itself alone.
+ */
+
+// Output collected from a command; 'data' is not '\0'-terminated
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} capture_t;
+
+/*
+ * Give the builtins run by substitutions the shell's job list
+ * jobs: The list of current jobs for the shell
+ */
+void capture_init(job_list_t *jobs);
+
+/*
+ * Run a command and collect its standard output; last_status is set to its
+ * exit status
+ * text: The command, as written between the parentheses, which is parsed
+ *       (and unquoted in place)
+ * out: Buffer the output replaces the contents of
+ * Returns 0 on success or -1 on error, which has already been reported
+ */
+int capture_command(char *text, capture_t *out);
+
+/*
+ * Free the memory held by a capture buffer
+ * out: The buffer to free
+ */
+void capture_free(capture_t *out);
+
+#endif    // CAPTURE_H
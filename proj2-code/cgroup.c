@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "cgroup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CPU_PERIOD_USEC 100000    // cpu.max period; the quota is a share of it
+#define MAX_IO_WEIGHT 10000
+
+static char *base = NULL;    // Directory the leaves are created in
+static unsigned next_leaf = 0;
+
+/**
+ * parse_size - Converts a size such as "512K", "100M" or "2G" to bytes.
+ *
+ * Returns the size, or -1 if it is malformed.
+ */
+static long long parse_size(const char *s) {
+    char *end;
+    errno = 0;
+    long long n = strtoll(s, &end, 10);
+    if (end == s || n <= 0 || errno != 0) {
+        return -1;
+    }
+    const char *units = "KMG";
+    const char *unit = *end == '\0' ? NULL : strchr(units, *end);
+    if (*end != '\0' && (unit == NULL || end[1] != '\0')) {
+        return -1;
+    }
+    for (const char *u = units; unit != NULL && u <= unit; u++) {
+        if (n > LLONG_MAX / 1024) {
+            return -1;
+        }
+        n *= 1024;
+    }
+    return n;
+}
+
+static long parse_positive(const char *s, long max) {
+    char *end;
+    errno = 0;
+    long n = strtol(s, &end, 10);
+    return end == s || *end != '\0' || errno != 0 || n <= 0 || n > max ? -1 : n;
+}
+
+int cgroup_parse_option(cgroup_limits_t *limits, const char *option, const char *value) {
+    if ((strcmp(option, "--cpu") != 0 && strcmp(option, "--mem") != 0 &&
+         strcmp(option, "--io") != 0) ||
+        value == NULL) {
+        return 0;
+    }
+    int ok;
+    if (strcmp(option, "--cpu") == 0) {
+        ok = (limits->cpu_percent = parse_positive(value, LONG_MAX / CPU_PERIOD_USEC)) > 0;
+    } else if (strcmp(option, "--mem") == 0) {
+        ok = (limits->mem_bytes = parse_size(value)) > 0;
+    } else {
+        ok = (limits->io_weight = (int) parse_positive(value, MAX_IO_WEIGHT)) > 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "run: %s: invalid value '%s'\n", option, value);
+        return -1;
+    }
+    return 1;
+}
+
+int cgroup_limits_set(const cgroup_limits_t *limits) {
+    return limits->cpu_percent > 0 || limits->mem_bytes > 0 || limits->io_weight > 0;
+}
+
+/**
+ * find_base - Finds the directory that leaves are created in: $SWISH_CGROUP,
+ * or the shell's own cgroup inside the cgroup2 mount.
+ *
+ * Returns the directory, or NULL if there is no cgroup2 hierarchy.
+ */
+static const char *find_base(void) {
+    if (base != NULL) {
+        return base;
+    }
+    const char *configured = getenv("SWISH_CGROUP");
+    if (configured != NULL) {
+        return base = strdup(configured);
+    }
+
+    char line[PATH_MAX + 256], mount[PATH_MAX] = "", own[PATH_MAX] = "";
+    FILE *f = fopen("/proc/self/mountinfo", "re");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        // Fields after " - " are the filesystem type, source and options
+        const char *fields = strstr(line, " - ");
+        if (fields != NULL && strncmp(fields + 3, "cgroup2 ", 8) == 0 &&
+            sscanf(line, "%*s %*s %*s %*s %4095s", mount) == 1) {
+            break;
+        }
+        mount[0] = '\0';
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    // The unified hierarchy is the "0::" line
+    f = fopen("/proc/self/cgroup", "re");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(own, sizeof(own), "%s", strcmp(line + 3, "/") == 0 ? "" : line + 3);
+            break;
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    if (mount[0] == '\0' || asprintf(&base, "%s%s", mount, own) == -1) {
+        base = NULL;
+    }
+    return base;
+}
+
+/**
+ * write_control - Writes a value to one of a cgroup's control files.
+ *
+ * Returns 0 on success or -1 on error, with errno set.
+ */
+static int write_control(const char *dir, const char *name, const char *value) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n = write(fd, value, strlen(value));
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return n == -1 ? -1 : 0;
+}
+
+char *cgroup_create(const cgroup_limits_t *limits) {
+    const char *dir = find_base();
+    if (dir == NULL) {
+        fprintf(stderr, "run: no cgroup v2 hierarchy is mounted\n");
+        return NULL;
+    }
+    struct {
+        const char *controller, *file;
+        int wanted;
+        char value[64];
+    } settings[] = {
+        {"cpu", "cpu.max", limits->cpu_percent > 0, ""},
+        {"memory", "memory.max", limits->mem_bytes > 0, ""},
+        {"io", "io.weight", limits->io_weight > 0, ""},
+    };
+    snprintf(settings[0].value, sizeof(settings[0].value), "%ld %d",
+             limits->cpu_percent * (CPU_PERIOD_USEC / 100), CPU_PERIOD_USEC);
+    snprintf(settings[1].value, sizeof(settings[1].value), "%lld", limits->mem_bytes);
+    snprintf(settings[2].value, sizeof(settings[2].value), "default %d", limits->io_weight);
+    unsigned nsettings = sizeof(settings) / sizeof(settings[0]);
+
+    // Controllers have to be enabled in the parent before a leaf can use them;
+    // this fails harmlessly if they already are or cannot be
+    for (unsigned i = 0; i < nsettings; i++) {
+        char enable[32];
+        snprintf(enable, sizeof(enable), "+%s", settings[i].controller);
+        if (settings[i].wanted) {
+            write_control(dir, "cgroup.subtree_control", enable);
+        }
+    }
+
+    char *path;
+    if (asprintf(&path, "%s/swish-%d.%u", dir, (int) getpid(), ++next_leaf) == -1) {
+        perror("asprintf");
+        return NULL;
+    }
+    if (mkdir(path, 0755) == -1) {
+        fprintf(stderr, "run: %s: %s\n", path, strerror(errno));
+        free(path);
+        return NULL;
+    }
+    for (unsigned i = 0; i < nsettings; i++) {
+        if (!settings[i].wanted || write_control(path, settings[i].file, settings[i].value) == 0) {
+            continue;
+        }
+        if (errno == ENOENT) {
+            fprintf(stderr, "run: the %s controller is not enabled in %s\n",
+                    settings[i].controller, dir);
+        } else {
+            fprintf(stderr, "run: %s: %s\n", settings[i].file, strerror(errno));
+        }
+        rmdir(path);
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+int cgroup_open_procs(const char *path) {
+    char procs[PATH_MAX];
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+    int fd = open(procs, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "run: %s: %s\n", procs, strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * read_control - Reads one of a cgroup's files into 'buf'.
+ *
+ * Returns 0 on success, or -1 if it does not exist (its controller is off).
+ */
+static int read_control(const char *dir, const char *name, char *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+static void format_bytes(char *buf, size_t size, unsigned long long bytes) {
+    const char *units = "BKMGT";
+    double value = bytes;
+    while (value >= 1024 && units[1] != '\0') {
+        value /= 1024;
+        units++;
+    }
+    snprintf(buf, size, units[0] == 'B' ? "%.0f%c" : "%.1f%c", value, units[0]);
+}
+
+void cgroup_print_usage(const char *path) {
+    char buf[4096], amount[32];
+    const char *name = strrchr(path, '/') == NULL ? path : strrchr(path, '/') + 1;
+    printf("    cgroup %s:", name);
+    const char *usage;
+    if (read_control(path, "cpu.stat", buf, sizeof(buf)) == 0 &&
+        (usage = strstr(buf, "usage_usec ")) != NULL) {
+        printf(" cpu %.3fs", strtoull(usage + 11, NULL, 10) / 1e6);
+    }
+    if (read_control(path, "memory.current", buf, sizeof(buf)) == 0) {
+        format_bytes(amount, sizeof(amount), strtoull(buf, NULL, 10));
+        printf(" mem %s", amount);
+    }
+    if (read_control(path, "memory.peak", buf, sizeof(buf)) == 0) {
+        format_bytes(amount, sizeof(amount), strtoull(buf, NULL, 10));
+        printf(" peak %s", amount);
+    }
+    if (read_control(path, "io.stat", buf, sizeof(buf)) == 0) {
+        // One line per device: "MAJ:MIN rbytes=N wbytes=N rios=N ..."
+        unsigned long long rbytes = 0, wbytes = 0;
+        for (const char *p = buf; (p = strstr(p, "bytes=")) != NULL; p += 6) {
+            if (p[-1] == 'r') {
+                rbytes += strtoull(p + 6, NULL, 10);
+            } else if (p[-1] == 'w') {
+                wbytes += strtoull(p + 6, NULL, 10);
+            }
+        }
+        format_bytes(amount, sizeof(amount), rbytes);
+        printf(" io read %s", amount);
+        format_bytes(amount, sizeof(amount), wbytes);
+        printf(" written %s", amount);
+    }
+    printf("\n");
+}
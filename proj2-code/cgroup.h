@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef CGROUP_H
+#define CGROUP_H
+
+/*
+ * Resource limits for single jobs through cgroup v2. A pipeline that starts
+ * with 'run' gets a leaf cgroup of its own (unless it is only given the
+ * placement options of placement.h):
+ *   run [--cpu PERCENT] [--mem SIZE] [--io WEIGHT] [--] command [args...]
+ * sets cpu.max to PERCENT of one CPU (200 allows two CPUs), memory.max to
+ * SIZE bytes (with an optional K, M or G suffix) and io.weight to WEIGHT
+ * (1 to 10000). Each process of the job moves itself into the cgroup before
+ * it calls exec, so nothing it starts can escape the limits. The cgroup is
+ * removed with the job, and 'jobs -v' reports the usage the cgroup has
+ * accounted for: CPU time, memory and bytes of I/O.
+ *
+ * Leaves are created under $SWISH_CGROUP, or else under the shell's own
+ * cgroup, as swish-<shell pid>.<n>. The controllers that the limits need
+ * must be available there; the shell tries to enable them in the parent's
+ * cgroup.subtree_control first.
+ */
+
+typedef struct {
+    long cpu_percent;      // 0 to leave cpu.max alone
+    long long mem_bytes;   // 0 to leave memory.max alone
+    int io_weight;         // 0 to leave io.weight alone
+} cgroup_limits_t;
+
+/*
+ * Parse one option of 'run' if it sets a limit
+ * limits: The limits to update, zeroed before the first option
+ * option: The option, such as "--mem"
+ * value: The word after the option, or NULL if there is none
+ * Returns 1 if the option and its value were taken, 0 if it is not a limit
+ * (or has no value), or -1 if the value is malformed, which has been reported
+ */
+int cgroup_parse_option(cgroup_limits_t *limits, const char *option, const char *value);
+
+/*
+ * Returns nonzero if any limit is set
+ */
+int cgroup_limits_set(const cgroup_limits_t *limits);
+
+/*
+ * Create a leaf cgroup with the given limits
+ * limits: The limits to set
+ * Returns the cgroup's directory (to be freed by the caller), or NULL if it
+ * could not be created or a limit could not be set, which has been reported
+ */
+char *cgroup_create(const cgroup_limits_t *limits);
+
+/*
+ * Open the file that processes write to in order to join a cgroup
+ * path: A directory returned by cgroup_create()
+ * Returns a close-on-exec descriptor for its cgroup.procs, or -1 on error
+ */
+int cgroup_open_procs(const char *path);
+
+/*
+ * Print one line of the resource usage accounted to a cgroup, for 'jobs -v'
+ * path: A directory returned by cgroup_create()
+ */
+void cgroup_print_usage(const char *path);
+
+#endif    // CGROUP_H
@@ -0,0 +1,378 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "path_cache.h"
+#include "swish_funcs.h"
+
+extern char **environ;
+
+typedef struct {
+    char *entry;          // "NAME=value"
+    unsigned name_len;
+    int exported;
+} var_t;
+
+// A variable as it was before a builtin's temporary assignment
+typedef struct {
+    char *name;
+    char *old_entry;    // NULL if it was not set
+    int old_exported;
+} saved_var_t;
+
+static var_t *vars = NULL;
+static unsigned nvars = 0, vars_capacity = 0;
+
+static char **envp = NULL;    // The exported entries, NULL-terminated; 'environ' points here
+static unsigned envp_capacity = 0;
+static unsigned generation = 1;    // Counts the rebuilds of envp
+static char **command_envp = NULL;    // Built by env_envp_with()
+static unsigned command_envp_capacity = 0;
+
+static saved_var_t *saved = NULL;
+static unsigned nsaved = 0, saved_capacity = 0;
+
+static char *empty_envp[] = {NULL};
+
+static int reserve(void **array, unsigned *capacity, unsigned needed, size_t size) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    unsigned new_capacity = *capacity == 0 ? 32 : *capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *new_array = realloc(*array, new_capacity * size);
+    if (new_array == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * rebuild_envp - Collects the exported entries into the envp array after one
+ * of them has changed.
+ *
+ * Returns 0 on success or -1 on error, in which case the old array is kept.
+ */
+static int rebuild_envp(void) {
+    if (reserve((void **) &envp, &envp_capacity, nvars + 1, sizeof(char *)) == -1) {
+        return -1;
+    }
+    unsigned n = 0;
+    for (unsigned i = 0; i < nvars; i++) {
+        if (vars[i].exported) {
+            envp[n++] = vars[i].entry;
+        }
+    }
+    envp[n] = NULL;
+    environ = envp;
+    if (++generation == 0) {
+        generation = 1;    // 0 stands for a command's own environment
+    }
+    return 0;
+}
+
+static var_t *find(const char *name, unsigned len) {
+    for (unsigned i = 0; i < nvars; i++) {
+        if (vars[i].name_len == len && memcmp(vars[i].entry, name, len) == 0) {
+            return &vars[i];
+        }
+    }
+    return NULL;
+}
+
+unsigned env_name_length(const char *s) {
+    unsigned n = 0;
+    if ((s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z') || s[0] == '_') {
+        n = 1;
+        while ((s[n] >= 'a' && s[n] <= 'z') || (s[n] >= 'A' && s[n] <= 'Z') ||
+               (s[n] >= '0' && s[n] <= '9') || s[n] == '_') {
+            n++;
+        }
+    }
+    return n;
+}
+
+int env_valid_name(const char *name, unsigned len) {
+    return len > 0 && env_name_length(name) >= len;
+}
+
+/**
+ * put_entry - Stores a "NAME=value" entry (which the table takes over) as the
+ * variable NAME, replacing any earlier value.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int put_entry(char *entry, unsigned name_len, int export) {
+    var_t *var = find(entry, name_len);
+    if (var == NULL) {
+        if (reserve((void **) &vars, &vars_capacity, nvars + 1, sizeof(var_t)) == -1) {
+            free(entry);
+            return -1;
+        }
+        var = &vars[nvars++];
+        var->exported = 0;
+    } else {
+        free(var->entry);
+    }
+    var->entry = entry;
+    var->name_len = name_len;
+    var->exported |= export;
+    if (name_len == 4 && memcmp(entry, "PATH", 4) == 0) {
+        path_cache_clear();    // Entries were found in the old PATH
+    }
+    return var->exported ? rebuild_envp() : 0;
+}
+
+int env_init(void) {
+    for (char **e = environ; e != NULL && *e != NULL; e++) {
+        const char *eq = strchr(*e, '=');
+        if (eq == NULL || find(*e, eq - *e) != NULL) {
+            continue;
+        }
+        if (reserve((void **) &vars, &vars_capacity, nvars + 1, sizeof(var_t)) == -1) {
+            return -1;
+        }
+        var_t *var = &vars[nvars];
+        if ((var->entry = strdup(*e)) == NULL) {
+            perror("strdup");
+            return -1;
+        }
+        var->name_len = eq - *e;
+        var->exported = 1;
+        nvars++;
+    }
+    return rebuild_envp();
+}
+
+const char *env_get(const char *name, unsigned len) {
+    const var_t *var = find(name, len);
+    return var == NULL ? NULL : var->entry + var->name_len + 1;
+}
+
+int env_set(const char *name, const char *value, int export) {
+    char *entry;
+    if (asprintf(&entry, "%s=%s", name, value) == -1) {
+        perror("asprintf");
+        return -1;
+    }
+    return put_entry(entry, strlen(name), export);
+}
+
+void env_unset(const char *name) {
+    var_t *var = find(name, strlen(name));
+    if (var == NULL) {
+        return;
+    }
+    int exported = var->exported;
+    int is_path = strcmp(name, "PATH") == 0;
+    free(var->entry);
+    // Keep the order, so the environment stays in the order it was built in
+    memmove(var, var + 1, (vars + nvars - (var + 1)) * sizeof(var_t));
+    nvars--;
+    if (is_path) {
+        path_cache_clear();
+    }
+    if (exported) {
+        rebuild_envp();
+    }
+}
+
+static int assign_word(const char *assign, int export) {
+    unsigned len = strchr(assign, '=') - assign;
+    char *entry = strdup(assign);
+    if (entry == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    return put_entry(entry, len, export);
+}
+
+int env_assign(char *const *assigns, unsigned n) {
+    for (unsigned i = 0; i < n; i++) {
+        if (assign_word(assigns[i], 0) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+unsigned env_begin_temporary(char *const *assigns, unsigned n) {
+    unsigned mark = nsaved;
+    for (unsigned i = 0; i < n; i++) {
+        unsigned len = strchr(assigns[i], '=') - assigns[i];
+        if (reserve((void **) &saved, &saved_capacity, nsaved + 1, sizeof(saved_var_t)) == -1) {
+            break;
+        }
+        const var_t *var = find(assigns[i], len);
+        saved_var_t *s = &saved[nsaved];
+        s->name = strndup(assigns[i], len);
+        s->old_entry = var == NULL ? NULL : strdup(var->entry);
+        s->old_exported = var != NULL && var->exported;
+        if (s->name == NULL || (var != NULL && s->old_entry == NULL)) {
+            perror("strdup");
+            free(s->name);
+            free(s->old_entry);
+            break;
+        }
+        nsaved++;
+        if (assign_word(assigns[i], 1) == -1) {
+            break;
+        }
+    }
+    return mark;
+}
+
+void env_end_temporary(unsigned mark) {
+    // Newest first, so a name assigned twice ends up with its original value
+    while (nsaved > mark) {
+        saved_var_t *s = &saved[--nsaved];
+        if (s->old_entry == NULL) {
+            env_unset(s->name);
+        } else {
+            put_entry(s->old_entry, strlen(s->name), 0);
+            var_t *var = find(s->name, strlen(s->name));
+            if (var != NULL && var->exported != s->old_exported) {
+                var->exported = s->old_exported;
+                rebuild_envp();
+            }
+        }
+        free(s->name);
+    }
+}
+
+char **env_envp(void) {
+    return envp == NULL ? empty_envp : envp;
+}
+
+unsigned env_generation(void) {
+    return generation;
+}
+
+char **env_envp_with(char *const *assigns, unsigned n) {
+    char **base = env_envp();
+    unsigned nbase = 0;
+    while (base[nbase] != NULL) {
+        nbase++;
+    }
+    if (reserve((void **) &command_envp, &command_envp_capacity, nbase + n + 1,
+                sizeof(char *)) == -1) {
+        return base;
+    }
+    memcpy(command_envp, base, nbase * sizeof(char *));
+    unsigned count = nbase;
+    for (unsigned i = 0; i < n; i++) {
+        size_t len = strchr(assigns[i], '=') - assigns[i] + 1;    // With the '='
+        unsigned j = 0;
+        while (j < count && strncmp(command_envp[j], assigns[i], len) != 0) {
+            j++;
+        }
+        command_envp[j] = assigns[i];
+        count += j == count;
+    }
+    command_envp[count] = NULL;
+    return command_envp;
+}
+
+/**
+ * print_quoted - Prints a value in single quotes, so that it can be read back.
+ */
+static void print_quoted(const char *value) {
+    putchar('\'');
+    for (const char *p = value; *p != '\0'; p++) {
+        if (*p == '\'') {
+            fputs("'\\''", stdout);
+        } else {
+            putchar(*p);
+        }
+    }
+    putchar('\'');
+}
+
+/**
+ * builtin_export - Exports each NAME, setting it first for NAME=value; with
+ * no names (or just "-p"), lists the exported variables.
+ */
+static int builtin_export(strvec_t *args, job_list_t *jobs) {
+    unsigned first = args->length > 1 && strcmp(args->data[1], "-p") == 0 ? 2 : 1;
+    if (first == args->length) {
+        for (char **e = env_envp(); *e != NULL; e++) {
+            const char *eq = strchr(*e, '=');
+            printf("export %.*s=", (int) (eq - *e), *e);
+            print_quoted(eq + 1);
+            putchar('\n');
+        }
+        return 0;
+    }
+    int ret = 0;
+    for (unsigned i = first; i < args->length; i++) {
+        const char *arg = args->data[i];
+        const char *eq = strchr(arg, '=');
+        unsigned len = eq == NULL ? strlen(arg) : (unsigned) (eq - arg);
+        if (!env_valid_name(arg, len)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", arg);
+            ret = 1;
+            continue;
+        }
+        if (eq != NULL) {
+            if (assign_word(arg, 1) == -1) {
+                ret = 1;
+            }
+            continue;
+        }
+        var_t *var = find(arg, len);
+        if (var != NULL && !var->exported) {
+            var->exported = 1;
+            rebuild_envp();
+        }
+    }
+    return ret;
+}
+
+/**
+ * builtin_unset - Removes each named variable.
+ */
+static int builtin_unset(strvec_t *args, job_list_t *jobs) {
+    int ret = 0;
+    for (unsigned i = 1; i < args->length; i++) {
+        if (!env_valid_name(args->data[i], strlen(args->data[i]))) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", args->data[i]);
+            ret = 1;
+            continue;
+        }
+        env_unset(args->data[i]);
+    }
+    return ret;
+}
+
+void env_register(void) {
+    builtin_register("export", builtin_export, BUILTIN_SHELL_STATE);
+    builtin_register("unset", builtin_unset, BUILTIN_SHELL_STATE);
+}
+
+void env_free(void) {
+    env_end_temporary(0);
+    for (unsigned i = 0; i < nvars; i++) {
+        free(vars[i].entry);
+    }
+    environ = empty_envp;
+    free(vars);
+    free(envp);
+    free(command_envp);
+    free(saved);
+    vars = NULL;
+    envp = command_envp = NULL;
+    saved = NULL;
+    nvars = vars_capacity = envp_capacity = command_envp_capacity = 0;
+    nsaved = saved_capacity = 0;
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef ENV_H
+#define ENV_H
+
+/*
+ * Shell variables. Every variable is a "NAME=value" string in one table;
+ * the exported ones also make up an envp array that the shell maintains
+ * itself and that 'environ' points to. The array is rebuilt only when an
+ * exported variable changes, so starting a command passes it as it is, and
+ * getenv() and execvp() see the shell's variables.
+ *
+ *   NAME=value              Set a variable (exported only if it already is)
+ *   NAME=value cmd [args]   Run cmd with NAME in its environment; a builtin
+ *                           sees the value until it returns
+ *   export [NAME[=value]]   Export variables, or list the exported ones
+ *   unset NAME...           Remove variables
+ *   $NAME  ${NAME}          The value of a variable (see parser.h)
+ *
+ * Changing PATH flushes the path cache. A command's own assignments do not
+ * change where it is looked up; it is still searched for in the shell's PATH.
+ */
+
+/*
+ * Load the variables from the environment the shell was started with and
+ * point 'environ' at the shell's own array
+ * Returns 0 on success or -1 on error
+ */
+int env_init(void);
+
+/*
+ * Returns the value of a variable, or NULL if it is not set
+ * name: The variable's name
+ * len: Length of the name, which need not be terminated
+ */
+const char *env_get(const char *name, unsigned len);
+
+/*
+ * Set a variable
+ * name: Its name, which must be valid (see env_valid_name())
+ * value: Its new value
+ * export: Nonzero to export it; otherwise it keeps being exported if it was
+ * Returns 0 on success or -1 on error
+ */
+int env_set(const char *name, const char *value, int export);
+
+/*
+ * Remove a variable; does nothing if it is not set
+ */
+void env_unset(const char *name);
+
+/*
+ * Returns nonzero if name[0..len) may name a variable: a letter or '_',
+ * followed by letters, digits and '_'
+ */
+int env_valid_name(const char *name, unsigned len);
+
+/*
+ * Returns the length of the variable name at the start of 's' (0 if there is none)
+ */
+unsigned env_name_length(const char *s);
+
+/*
+ * Set a variable from each "NAME=value" word of an assignment that stands on
+ * its own, such as "A=1 B=2"
+ * Returns 0 on success or -1 on error
+ */
+int env_assign(char *const *assigns, unsigned n);
+
+/*
+ * Set exported variables from "NAME=value" words for as long as a builtin
+ * runs
+ * Returns a mark to pass to env_end_temporary(), which puts the variables
+ * back as they were
+ */
+unsigned env_begin_temporary(char *const *assigns, unsigned n);
+
+/*
+ * Undo the assignments made since env_begin_temporary() returned 'mark'
+ */
+void env_end_temporary(unsigned mark);
+
+/*
+ * Returns the environment of commands: the exported variables, NULL-terminated
+ */
+char **env_envp(void);
+
+/*
+ * Returns a number, never 0, that changes whenever env_envp() does
+ */
+unsigned env_generation(void);
+
+/*
+ * Returns the environment for one command with "NAME=value" words of its own
+ * added to (or replacing) the exported variables; valid until the next call
+ */
+char **env_envp_with(char *const *assigns, unsigned n);
+
+/*
+ * Add the 'export' and 'unset' builtins to the builtin table
+ */
+void env_register(void);
+
+/*
+ * Free every variable; 'environ' is left empty
+ */
+void env_free(void);
+
+#endif    // ENV_H
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "fanout.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHUNK (64 * 1024)    // Most bytes passed on per round, at most a pipe's capacity
+
+// Helpers started and not yet taken over by a caller
+static pid_t *pending = NULL;
+static unsigned npending = 0, pending_capacity = 0;
+
+/*
+ * Move 'len' bytes from a pipe to a file, with splice() unless the file is of
+ * a kind that it does not support (such as a terminal)
+ * Returns 0 on success, or the number of bytes left in the pipe if the file
+ * cannot be written any more
+ */
+static size_t drain(int from, int to, size_t len) {
+    char buf[4096];
+    while (len > 0) {
+        ssize_t n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == -1 && errno == EINVAL) {
+            if ((n = read(from, buf, len < sizeof(buf) ? len : sizeof(buf))) > 0 &&
+                write(to, buf, n) != n) {
+                n = -1;
+            }
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return len;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Throw away 'len' bytes of a pipe, for a file that cannot be written
+ */
+static void discard(int from, size_t len) {
+    char buf[4096];
+    while (len > 0) {
+        ssize_t n = read(from, buf, len < sizeof(buf) ? len : sizeof(buf));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        len -= n;
+    }
+}
+
+/*
+ * The helper: copy everything from 'in' to every file until end-of-file
+ * Doesn't return
+ */
+static void copy_out(int in, const int *sinks, unsigned nsinks) {
+    int ok[nsinks];
+    for (unsigned i = 0; i < nsinks; i++) {
+        ok[i] = 1;
+    }
+    int copy[2];
+    if (pipe(copy) == -1) {
+        perror("pipe");
+        _exit(1);
+    }
+    while (1) {
+        // Duplicate what is waiting into the second pipe for each file but
+        // the last; the first tee() also waits for data, or for end-of-file
+        ssize_t len = 0;
+        for (unsigned i = 0; i + 1 < nsinks; i++) {
+            ssize_t n;
+            while ((n = tee(in, copy[1], len == 0 ? CHUNK : (size_t) len, 0)) == -1 &&
+                   errno == EINTR) {
+            }
+            if (n == -1) {
+                perror("tee");
+                _exit(1);
+            } else if (n == 0) {
+                _exit(0);
+            }
+            len = len == 0 ? n : len;
+            size_t left = ok[i] ? drain(copy[0], sinks[i], n) : (size_t) n;
+            if (left > 0) {
+                ok[i] = 0;    // Later output is dropped for this file only
+                discard(copy[0], left);
+            }
+        }
+        // ...and move it from the pipe itself into the last file
+        unsigned last = nsinks - 1;
+        size_t left = ok[last] ? drain(in, sinks[last], len) : (size_t) len;
+        if (left > 0) {
+            ok[last] = 0;
+            discard(in, left);
+        }
+    }
+}
+
+int fanout_start(const int *sinks, unsigned nsinks) {
+    if (npending == pending_capacity) {
+        unsigned new_capacity = pending_capacity == 0 ? 8 : 2 * pending_capacity;
+        pid_t *new_pending = realloc(pending, new_capacity * sizeof(pid_t));
+        if (new_pending == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        pending = new_pending;
+        pending_capacity = new_capacity;
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    } else if (pid == 0) {
+        // Keep only the pipe on 0 and the files on 1, 2, ...; any other
+        // descriptor of the shell, such as another command's pipe or this
+        // pipe's write end, must not be held open by the helper
+        int highest = fds[0];
+        for (unsigned i = 0; i < nsinks; i++) {
+            highest = sinks[i] > highest ? sinks[i] : highest;
+        }
+        int moved[nsinks + 1];
+        moved[0] = fcntl(fds[0], F_DUPFD, highest + 1);
+        for (unsigned i = 0; i < nsinks; i++) {
+            moved[i + 1] = fcntl(sinks[i], F_DUPFD, highest + 1);
+        }
+        for (unsigned i = 0; i <= nsinks; i++) {
+            if (moved[i] == -1 || dup2(moved[i], (int) i) == -1) {
+                perror("dup2");
+                _exit(1);
+            }
+        }
+        close_range(nsinks + 1, ~0U, 0);
+        signal(SIGCHLD, SIG_DFL);
+        int targets[nsinks];
+        for (unsigned i = 0; i < nsinks; i++) {
+            targets[i] = (int) i + 1;
+        }
+        copy_out(0, targets, nsinks);
+    }
+    close(fds[0]);
+    pending[npending++] = pid;
+    return fds[1];
+}
+
+unsigned fanout_take(pid_t *pids, unsigned max) {
+    unsigned n = npending < max ? npending : max;
+    memcpy(pids, pending + (npending - n), n * sizeof(pid_t));
+    npending -= n;
+    return n;
+}
+
+void fanout_wait(void) {
+    for (unsigned i = 0; i < npending; i++) {
+        while (waitpid(pending[i], NULL, 0) == -1 && errno == EINTR) {
+        }
+    }
+    npending = 0;
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <sys/types.h>
+
+/*
+ * Output that fans out to several files. As with zsh's MULTIOS option, a
+ * command that redirects one descriptor to more than one file, as in
+ *
+ *   cmd > a.log >> b.log
+ *
+ * writes everything to every one of them, instead of only the last. The
+ * descriptor gets the write end of a pipe, and a helper process copies the
+ * pipe to the files: tee(2) duplicates what is in the pipe into a second
+ * pipe for all files but the last, which splice(2) drains, and the original
+ * is then spliced into the last file. The data stays in the kernel from the
+ * command's write() to the files, and no external 'tee' is run.
+ *
+ * A helper runs until every copy of the pipe's write end is closed. The
+ * shell makes it part of the command's job (see job_t.nstages), so that
+ * waiting for the job also waits for the last of its output to be written.
+ */
+
+/*
+ * Start a helper copying a new pipe to several files
+ * sinks: Descriptors of the files, which the helper inherits; the caller
+ *        still closes its own copies
+ * nsinks: Number of files, at least 2
+ * Returns the write end of the pipe (close-on-exec), or -1 on error
+ */
+int fanout_start(const int *sinks, unsigned nsinks);
+
+/*
+ * Take over the helpers started since the last call, which the caller must
+ * then wait for
+ * pids: Room for 'max' process IDs
+ * max: Most helpers to take; any others stay for the next call
+ * Returns the number of helpers taken
+ */
+unsigned fanout_take(pid_t *pids, unsigned max);
+
+/*
+ * Wait for the helpers started since the last fanout_take() to exit, once
+ * the caller has closed its copies of their pipes
+ */
+void fanout_wait(void);
+
+#endif    // FANOUT_H
@@ -0,0 +1,492 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "fork_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "placement.h"
+
+#define MAX_FDS 64          // Descriptors one request may carry, with the working directory
+#define HIGH_FD 100         // The server moves its descriptors above every redirection target
+#define ENV_CACHED UINT32_MAX
+
+// The fixed part of a request. It is followed by 'nmoves' fork_server_fd_t,
+// then the program's path, its arguments and (unless nenv is ENV_CACHED)
+// its environment, each string terminated by '\0'. After the descriptors
+// the moves refer to come the shell's working directory and, for a
+// foreground job, the terminal.
+typedef struct {
+    int32_t pgid;
+    uint32_t nargs;
+    uint32_t nenv;          // ENV_CACHED to use the environment kept from an earlier request
+    uint32_t generation;    // Nonzero if the server should keep this environment
+    uint32_t nmoves;
+    uint32_t foreground;    // Nonzero if the child's process group takes the terminal
+} request_t;
+
+typedef struct {
+    int32_t pid;    // -1 if no child was created
+    int32_t err;    // errno of the failed clone or exec, or 0
+} reply_t;
+
+// Shell side
+static int server_sock = -1;
+static pid_t server_pid = -1;
+static unsigned sent_generation = 0;    // Environment the server has kept
+static char *request = NULL;
+static size_t request_capacity = 0;
+
+// --- Server side ---
+
+/**
+ * move_high - Moves a descriptor to HIGH_FD or above, close-on-exec.
+ *
+ * Returns the new descriptor, or -1 on error (the old one is closed anyway).
+ */
+static int move_high(int fd) {
+    if (fd >= HIGH_FD) {
+        return fd;
+    }
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, HIGH_FD);
+    close(fd);
+    return high;
+}
+
+/**
+ * run_child - Sets up a new child and executes the program; a failure is
+ * written to 'status_fd' as an errno value.
+ */
+static void run_child(const char *path, char *const *argv, char *const *envp,
+                      const fork_server_fd_t *moves, unsigned nmoves, const int *fds,
+                      int cwd_fd, int terminal_fd, pid_t pgid, int status_fd) {
+    if (fchdir(cwd_fd) == -1 || setpgid(0, pgid) == -1) {
+        goto fail;
+    }
+    // A foreground job takes the terminal before it can read from it; the
+    // shell does the same once it has the reply, which SIGTTIN would beat.
+    // SIGTTOU is still ignored here.
+    if (terminal_fd != -1) {
+        tcsetpgrp(terminal_fd, getpgrp());
+    }
+    for (unsigned m = 0; m < nmoves; m++) {
+        int source = moves[m].passed ? fds[moves[m].source] : moves[m].source;
+        if (dup2(source, moves[m].target) == -1) {
+            goto fail;
+        }
+    }
+    // The server ignores the job control signals; the program must not
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    int defaults[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+    for (unsigned i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+        signal(defaults[i], SIG_DFL);
+    }
+    execve(path, argv, envp);
+
+fail:;
+    int err = errno;
+    ssize_t ignored = write(status_fd, &err, sizeof(err));
+    (void) ignored;
+    _exit(127);
+}
+
+/**
+ * start_child - Creates a child of the shell (not of the server) that runs
+ * the program, and waits until it has called exec or failed to.
+ *
+ * Returns the reply for the shell.
+ */
+static reply_t start_child(const char *path, char *const *argv, char *const *envp,
+                           const fork_server_fd_t *moves, const request_t *req, int *fds,
+                           unsigned nfds) {
+    reply_t reply = {.pid = -1, .err = 0};
+    // No move can then overwrite a descriptor that a later move reads
+    for (unsigned i = 0; i < nfds; i++) {
+        if ((fds[i] = move_high(fds[i])) == -1) {
+            reply.err = errno;
+        }
+    }
+    int status_pipe[2];
+    if (reply.err != 0 || pipe2(status_pipe, O_CLOEXEC) == -1) {
+        reply.err = reply.err != 0 ? reply.err : errno;
+        return reply;
+    }
+    status_pipe[0] = move_high(status_pipe[0]);
+    status_pipe[1] = move_high(status_pipe[1]);
+    if (status_pipe[0] == -1 || status_pipe[1] == -1) {
+        reply.err = errno;
+    } else {
+        // Like fork(), but the shell becomes the parent and gets its SIGCHLD
+        pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+        if (pid == 0) {
+            int cwd_fd = fds[nfds - 1 - (req->foreground != 0)];
+            int terminal_fd = req->foreground ? fds[nfds - 1] : -1;
+            run_child(path, argv, envp, moves, req->nmoves, fds, cwd_fd, terminal_fd, req->pgid,
+                      status_pipe[1]);
+        }
+        reply.pid = pid;
+        reply.err = pid == -1 ? errno : 0;
+    }
+    if (status_pipe[1] != -1) {
+        close(status_pipe[1]);
+    }
+    if (reply.pid > 0) {
+        // Closed by a successful exec, or carries the errno of a failed one
+        int err;
+        ssize_t n;
+        while ((n = read(status_pipe[0], &err, sizeof(err))) == -1 && errno == EINTR) {
+        }
+        reply.err = n == sizeof(err) ? err : 0;
+    }
+    if (status_pipe[0] != -1) {
+        close(status_pipe[0]);
+    }
+    return reply;
+}
+
+/**
+ * take_strings - Points the entries of 'vec' at 'n' consecutive strings of a
+ * request and terminates it with NULL.
+ *
+ * Returns the position after the strings, or NULL if they run past 'end'.
+ */
+static char *take_strings(char *p, const char *end, char **vec, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        char *nul = p < end ? memchr(p, '\0', end - p) : NULL;
+        if (nul == NULL) {
+            return NULL;
+        }
+        vec[i] = p;
+        p = nul + 1;
+    }
+    vec[n] = NULL;
+    return p;
+}
+
+/**
+ * handle_request - Decodes one request and starts its child. An environment
+ * that the shell marks as lasting is copied into 'cached_env' (and its
+ * strings into 'cached_block'), replacing the one kept before.
+ *
+ * Returns the reply for the shell.
+ */
+static reply_t handle_request(char *buf, size_t len, int *fds, unsigned nfds, char ***cached_env,
+                              char **cached_block) {
+    reply_t bad = {.pid = -1, .err = EINVAL};
+    request_t req;
+    if (len < sizeof(req)) {
+        return bad;
+    }
+    memcpy(&req, buf, sizeof(req));
+    unsigned nextra = 1 + (req.foreground != 0);    // Working directory and terminal
+    if (nfds < nextra) {
+        return bad;
+    }
+    const char *end = buf + len;
+    size_t moves_len = (size_t) req.nmoves * sizeof(fork_server_fd_t);
+    if (moves_len > len - sizeof(req) || req.nargs > len ||
+        (req.nenv != ENV_CACHED && req.nenv > len)) {
+        return bad;
+    }
+    fork_server_fd_t *moves = malloc(moves_len + 1);
+    char **argv = malloc((req.nargs + 1) * sizeof(char *));
+    char **envp = req.nenv == ENV_CACHED ? NULL : malloc((req.nenv + 1) * sizeof(char *));
+    reply_t reply = bad;
+    if (moves == NULL || argv == NULL || (req.nenv != ENV_CACHED && envp == NULL)) {
+        reply.err = ENOMEM;
+        goto out;
+    }
+    memcpy(moves, buf + sizeof(req), moves_len);
+    for (uint32_t m = 0; m < req.nmoves; m++) {
+        unsigned source = moves[m].source;
+        if (moves[m].passed && (moves[m].source < 0 || source >= nfds - nextra)) {
+            goto out;
+        }
+    }
+    char *path = buf + sizeof(req) + moves_len;
+    char *nul = memchr(path, '\0', end - path);
+    char *p = nul == NULL ? NULL : take_strings(nul + 1, end, argv, req.nargs);
+    char *env_start = p;
+    if (p == NULL || (envp != NULL && (p = take_strings(p, end, envp, req.nenv)) == NULL)) {
+        goto out;
+    }
+
+    if (envp != NULL && req.generation != 0) {
+        // Kept for the requests that do not send it again
+        char *block = malloc(p - env_start + 1);
+        char **vec = malloc((req.nenv + 1) * sizeof(char *));
+        if (block != NULL && vec != NULL) {
+            memcpy(block, env_start, p - env_start);
+            take_strings(block, block + (p - env_start), vec, req.nenv);
+            free(*cached_block);
+            free(*cached_env);
+            *cached_block = block;
+            *cached_env = vec;
+        } else {
+            free(block);
+            free(vec);
+        }
+    }
+    static char *no_env[] = {NULL};
+    char **env = envp != NULL ? envp : *cached_env != NULL ? *cached_env : no_env;
+    reply = start_child(path, argv, env, moves, &req, fds, nfds);
+
+out:
+    free(moves);
+    free(argv);
+    free(envp);
+    return reply;
+}
+
+/**
+ * serve - The server's main loop: one request, one reply, until the shell
+ * closes its end of the socket.
+ */
+static void serve(int sock) {
+    char *buf = NULL, **cached_env = NULL, *cached_block = NULL;
+    size_t capacity = 0;
+    while (1) {
+        // The size of the next request, without taking it yet
+        ssize_t size = recv(sock, NULL, 0, MSG_PEEK | MSG_TRUNC);
+        if (size == -1 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            break;
+        }
+        if ((size_t) size > capacity) {
+            char *new_buf = realloc(buf, size);
+            if (new_buf == NULL) {
+                break;
+            }
+            buf = new_buf;
+            capacity = size;
+        }
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(MAX_FDS * sizeof(int))];
+        } control;
+        struct iovec iov = {.iov_base = buf, .iov_len = size};
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.space,
+            .msg_controllen = sizeof(control.space),
+        };
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        int fds[MAX_FDS];
+        unsigned nfds = 0;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+            }
+        }
+        reply_t reply = handle_request(buf, n, fds, nfds, &cached_env, &cached_block);
+        if (msg.msg_flags & MSG_CTRUNC) {
+            reply.err = reply.pid == -1 ? EMFILE : reply.err;
+        }
+        for (unsigned i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        if (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) == -1) {
+            break;
+        }
+    }
+    _exit(0);
+}
+
+// --- Shell side ---
+
+int fork_server_start(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // Out of the shell's process group, so that ^C and ^Z at the prompt
+        // leave the server alone
+        close(sv[0]);
+        setpgid(0, 0);
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGCHLD, SIG_DFL);
+        placement_enter_job_cpus();    // Children inherit the server's CPUs
+        serve(sv[1]);
+    }
+    close(sv[1]);
+    server_sock = sv[0];
+    server_pid = pid;
+    sent_generation = 0;
+    return 0;
+}
+
+/**
+ * append - Appends to the request being built, growing it as needed.
+ *
+ * Returns 0 on success or -1 if memory runs out.
+ */
+static int append(size_t *len, const void *data, size_t n) {
+    if (*len + n > request_capacity) {
+        size_t capacity = request_capacity == 0 ? 4096 : request_capacity;
+        while (capacity < *len + n) {
+            capacity *= 2;
+        }
+        char *new_request = realloc(request, capacity);
+        if (new_request == NULL) {
+            return -1;
+        }
+        request = new_request;
+        request_capacity = capacity;
+    }
+    memcpy(request + *len, data, n);
+    *len += n;
+    return 0;
+}
+
+static int append_strings(size_t *len, char *const *vec, uint32_t *count) {
+    *count = 0;
+    for (; vec[*count] != NULL; (*count)++) {
+        if (append(len, vec[*count], strlen(vec[*count]) + 1) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+pid_t fork_server_spawn(const char *path, char *const *argv, char *const *envp,
+                        unsigned generation, const int *fds, unsigned nfds,
+                        const fork_server_fd_t *moves, unsigned nmoves, pid_t pgid,
+                        int terminal) {
+    if (server_sock == -1) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (nfds + 2 > MAX_FDS) {
+        errno = EMFILE;
+        return -1;
+    }
+    request_t req = {
+        .pgid = pgid,
+        .nmoves = nmoves,
+        .generation = generation,
+        .foreground = terminal != -1,
+    };
+    int send_env = generation == 0 || generation != sent_generation;
+    size_t len = 0;
+    if (append(&len, &req, sizeof(req)) == -1 ||
+        append(&len, moves, nmoves * sizeof(fork_server_fd_t)) == -1 ||
+        append(&len, path, strlen(path) + 1) == -1 ||
+        append_strings(&len, argv, &req.nargs) == -1 ||
+        (send_env && append_strings(&len, envp, &req.nenv) == -1)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (!send_env) {
+        req.nenv = ENV_CACHED;
+    }
+    memcpy(request, &req, sizeof(req));    // Now with the counts
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    // The child starts in the server's directory, so it is told the shell's
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd == -1) {
+        return -1;
+    }
+    int sent[nfds + 2];
+    memcpy(sent, fds, nfds * sizeof(int));
+    unsigned nsent = nfds;
+    sent[nsent++] = cwd;
+    if (terminal != -1) {
+        sent[nsent++] = terminal;
+    }
+    struct iovec iov = {.iov_base = request, .iov_len = len};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.space,
+        .msg_controllen = CMSG_SPACE(nsent * sizeof(int)),
+    };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(nsent * sizeof(int));
+    memcpy(CMSG_DATA(c), sent, nsent * sizeof(int));
+
+    reply_t reply;
+    ssize_t n;
+    while ((n = sendmsg(server_sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+    }
+    if (n != -1) {
+        while ((n = recv(server_sock, &reply, sizeof(reply), 0)) == -1 && errno == EINTR) {
+        }
+    }
+    int saved_errno = errno;
+    close(cwd);
+    errno = saved_errno;
+    if (n != (ssize_t) sizeof(reply)) {
+        // The server is gone, or the request could not be sent
+        errno = n == 0 ? EPIPE : errno;
+        return -1;
+    }
+    if (send_env && generation != 0) {
+        sent_generation = generation;
+    }
+    if (reply.err != 0) {
+        if (reply.pid > 0) {
+            waitpid(reply.pid, NULL, 0);    // Our child, which failed to exec
+            if (terminal != -1 && tcgetpgrp(terminal) == reply.pid) {
+                tcsetpgrp(terminal, getpgrp());    // It may have taken the terminal
+            }
+        }
+        errno = reply.err;
+        return -1;
+    }
+    return reply.pid;
+}
+
+void fork_server_stop(void) {
+    if (server_sock == -1) {
+        return;
+    }
+    close(server_sock);
+    server_sock = -1;
+    waitpid(server_pid, NULL, 0);
+    server_pid = -1;
+    free(request);
+    request = NULL;
+    request_capacity = 0;
+}
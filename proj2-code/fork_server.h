@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef FORK_SERVER_H
+#define FORK_SERVER_H
+
+#include <sys/types.h>
+
+/*
+ * A fork server starts commands on behalf of the shell (SWISH_LAUNCH=server).
+ * It is forked first thing at startup, while the shell is still small, and
+ * after that it never allocates more than one request needs, so the cost of
+ * creating a process does not grow with the shell's history, job table and
+ * caches.
+ *
+ * The shell sends each launch over a SOCK_SEQPACKET socket: the program,
+ * argv, the process group and a list of descriptor moves, with the
+ * descriptors themselves and the working directory attached as SCM_RIGHTS.
+ * The environment goes along only when it has changed since the last
+ * request; the server keeps a copy.
+ * The server creates the child with clone(CLONE_PARENT), which makes it a
+ * child of the shell rather than of the server. The kernel therefore
+ * reports its exit and stops to the shell itself, with SIGCHLD, wait4() and
+ * pidfds, and the job table sees no difference. The child reports a failed
+ * exec through a close-on-exec pipe, and the server sends back its pid
+ * together with that error.
+ */
+
+// One step of setting up a child's descriptors; the steps apply in order
+typedef struct {
+    int target;    // Descriptor to set up in the child
+    int source;    // Index into the descriptors sent along, or a descriptor
+                   // of the child's own to copy
+    int passed;    // Nonzero if 'source' is an index into the descriptors sent
+} fork_server_fd_t;
+
+/*
+ * Fork the server
+ * Returns 0 on success or -1 on error, which has been reported
+ */
+int fork_server_start(void);
+
+/*
+ * Start a program through the server
+ * path: The program to execute
+ * argv: Its arguments, NULL-terminated
+ * envp: Its environment, NULL-terminated
+ * generation: Version of envp, so that an unchanged environment is not sent
+ *             again; 0 for an environment used only by this command
+ * fds: Descriptors to send along
+ * nfds: Number of entries in fds
+ * moves: How the child sets up its descriptors from them
+ * nmoves: Number of entries in moves
+ * pgid: Process group for the child to join, or 0 to lead a new one
+ * terminal: Terminal whose foreground process group the child's group
+ *           becomes before exec, or -1 to leave it alone
+ * Returns the child's pid, or -1 with errno set if it could not be started
+ * (for example ENOENT if exec failed); the failed child has been reaped
+ */
+pid_t fork_server_spawn(const char *path, char *const *argv, char *const *envp,
+                        unsigned generation, const int *fds, unsigned nfds,
+                        const fork_server_fd_t *moves, unsigned nmoves, pid_t pgid,
+                        int terminal);
+
+/*
+ * Tell the server to exit by closing its socket
+ */
+void fork_server_stop(void);
+
+#endif    // FORK_SERVER_H
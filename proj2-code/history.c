@@ -0,0 +1,380 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "history.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "swish_funcs.h"
+
+#define MIN_MAPPING (1 << 20)    // Address space reserved for the file at first
+#define INITIAL_ENTRIES 256
+
+static int hist_fd = -1;
+static char *hist_path = NULL;
+static unsigned max_entries = 0;
+static char *map = NULL;
+static size_t mapped = 0;       // Length of the mapping, which extends past the end of the file
+static size_t file_size = 0;    // Bytes of the file known to be written
+static unsigned appended = 0;   // Entries added by this shell
+
+// Entries found so far, in the order they appear in the file
+static size_t *starts = NULL;                // Offset of each entry
+static unsigned *prev_same_initial = NULL;   // Previous entry with the same first character + 1
+static unsigned last_with_initial[256];      // Newest entry starting with a character + 1
+static unsigned nentries = 0, entries_capacity = 0;
+static size_t indexed_end = 0;               // Offset up to which entries have been found
+
+// The line that history_expand() returns
+static char *expansion = NULL;
+static size_t expansion_capacity = 0;
+
+static size_t round_to_pages(size_t n) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    return (n + page - 1) / page * page;
+}
+
+/**
+ * map_file - Maps the history file with room to grow, so that appended
+ * entries can be read through the mapping without mapping it again.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int map_file(void) {
+    struct stat st;
+    if (fstat(hist_fd, &st) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    file_size = st.st_size;
+    mapped = round_to_pages(2 * file_size > MIN_MAPPING ? 2 * file_size : MIN_MAPPING);
+    map = mmap(NULL, mapped, PROT_READ, MAP_SHARED, hist_fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * grow_mapping - Makes sure the first 'size' bytes of the file are mapped.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int grow_mapping(size_t size) {
+    if (size <= mapped) {
+        return 0;
+    }
+    size_t new_mapped = round_to_pages(2 * size);
+    char *new_map = mremap(map, mapped, new_mapped, MREMAP_MAYMOVE);
+    if (new_map == MAP_FAILED) {
+        perror("mremap");
+        return -1;
+    }
+    map = new_map;
+    mapped = new_mapped;
+    return 0;
+}
+
+static void reset_index(void) {
+    nentries = 0;
+    indexed_end = 0;
+    memset(last_with_initial, 0, sizeof(last_with_initial));
+}
+
+static int add_entry(size_t start) {
+    if (nentries == entries_capacity) {
+        unsigned capacity = entries_capacity == 0 ? INITIAL_ENTRIES : 2 * entries_capacity;
+        size_t *new_starts = realloc(starts, capacity * sizeof(size_t));
+        if (new_starts == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        starts = new_starts;
+        unsigned *new_prev = realloc(prev_same_initial, capacity * sizeof(unsigned));
+        if (new_prev == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        prev_same_initial = new_prev;
+        entries_capacity = capacity;
+    }
+    unsigned char initial = map[start];
+    starts[nentries] = start;
+    prev_same_initial[nentries] = last_with_initial[initial];
+    last_with_initial[initial] = ++nentries;
+    return 0;
+}
+
+/**
+ * update_index - Finds the entries in the part of the file that has not been
+ * looked at yet, which includes anything other shells have appended.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int update_index(void) {
+    while (indexed_end < file_size) {
+        const char *nl = memchr(map + indexed_end, '\n', file_size - indexed_end);
+        if (map[indexed_end] != '\n' && add_entry(indexed_end) == -1) {
+            return -1;
+        }
+        indexed_end = nl == NULL ? file_size : (size_t) (nl + 1 - map);
+    }
+    return 0;
+}
+
+static size_t entry_length(unsigned i) {
+    const char *start = map + starts[i];
+    const char *nl = memchr(start, '\n', file_size - starts[i]);
+    return nl == NULL ? file_size - starts[i] : (size_t) (nl - start);
+}
+
+/**
+ * compact - Replaces the history file with one that holds only its newest
+ * max_entries entries. The new file is written next to the old one and
+ * renamed over it, so the history is never left half-written.
+ *
+ * Returns 0 on success (or if there is nothing to drop) or -1 on error.
+ */
+static int compact(void) {
+    if (update_index() == -1 || nentries <= max_entries) {
+        return 0;
+    }
+    size_t keep_from = max_entries == 0 ? file_size : starts[nentries - max_entries];
+    char *tmp_path;
+    if (asprintf(&tmp_path, "%s.tmp", hist_path) == -1) {
+        perror("asprintf");
+        return -1;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        perror(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    int ret = 0;
+    for (size_t done = keep_from; done < file_size;) {
+        ssize_t n = write(fd, map + done, file_size - done);
+        if (n == -1 && errno != EINTR) {
+            perror("write");
+            ret = -1;
+            break;
+        }
+        done += n > 0 ? n : 0;
+    }
+    close(fd);
+    if (ret == 0 && rename(tmp_path, hist_path) == -1) {
+        perror("rename");
+        ret = -1;
+    }
+    if (ret == -1) {
+        unlink(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    free(tmp_path);
+
+    // Switch to the new file
+    munmap(map, mapped);
+    map = NULL;
+    close(hist_fd);
+    reset_index();
+    hist_fd = open(hist_path, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (hist_fd == -1 || map_file() == -1) {
+        if (hist_fd == -1) {
+            perror(hist_path);
+        }
+        history_free();
+        return -1;
+    }
+    return 0;
+}
+
+int history_init(const char *path, unsigned max) {
+    hist_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (hist_fd == -1) {
+        perror(path);
+        return -1;
+    }
+    if ((hist_path = strdup(path)) == NULL || map_file() == -1) {
+        if (hist_path == NULL) {
+            perror("strdup");
+        }
+        history_free();
+        return -1;
+    }
+    max_entries = max;
+    reset_index();
+    return 0;
+}
+
+int history_add(const char *line) {
+    if (hist_fd == -1 || line[strspn(line, " \t")] == '\0') {
+        return 0;
+    }
+    // One write, so that entries from shells sharing the file do not interleave
+    struct iovec iov[3];
+    int n = 0;
+    if (file_size > 0 && map[file_size - 1] != '\n') {
+        iov[n++] = (struct iovec){.iov_base = "\n", .iov_len = 1};    // After a torn write
+    }
+    iov[n++] = (struct iovec){.iov_base = (char *) line, .iov_len = strlen(line)};
+    iov[n++] = (struct iovec){.iov_base = "\n", .iov_len = 1};
+    if (writev(hist_fd, iov, n) == -1) {
+        perror("writev");
+        return -1;
+    }
+    off_t end = lseek(hist_fd, 0, SEEK_CUR);
+    if (end == -1 || grow_mapping(end) == -1) {
+        return -1;
+    }
+    file_size = end;
+    appended++;
+    // Compact only while the index is in use anyway, and at exit otherwise
+    if (indexed_end > 0 && update_index() == 0 && nentries > 2 * max_entries) {
+        return compact();
+    }
+    return 0;
+}
+
+/**
+ * find_event - Finds the entry that a history reference names.
+ *
+ * Returns its index, or -1 if there is none.
+ */
+static long find_event(const char *ref, size_t len) {
+    if (len == 1 && ref[0] == '!') {
+        return (long) nentries - 1;
+    }
+    if (isdigit((unsigned char) ref[0]) || ref[0] == '-') {
+        long n = strtol(ref, NULL, 10);
+        long idx = n > 0 ? n - 1 : (long) nentries + n;
+        return n == 0 || idx < 0 || idx >= nentries ? -1 : idx;
+    }
+    // Only entries with the same first character can match the prefix
+    for (unsigned e = last_with_initial[(unsigned char) ref[0]]; e != 0;
+         e = prev_same_initial[e - 1]) {
+        if (entry_length(e - 1) >= len && memcmp(map + starts[e - 1], ref, len) == 0) {
+            return e - 1;
+        }
+    }
+    return -1;
+}
+
+char *history_expand(char *line) {
+    if (hist_fd == -1 || line[0] != '!' || strchr(" \t=(", line[1]) != NULL) {
+        return line;    // strchr() also matches the '\0' of a lone '!'
+    }
+    const char *ref = line + 1;
+    size_t len;
+    if (ref[0] == '!') {
+        len = 1;
+    } else if (ref[0] == '-' || isdigit((unsigned char) ref[0])) {
+        len = 1 + strspn(ref + 1, "0123456789");
+    } else {
+        len = strcspn(ref, " \t");
+    }
+    long idx = update_index() == -1 ? -1 : find_event(ref, len);
+    if (idx == -1) {
+        fprintf(stderr, "swish: !%.*s: event not found\n", (int) len, ref);
+        return NULL;
+    }
+
+    // The recalled command followed by the rest of the line
+    size_t entry_len = entry_length(idx);
+    const char *rest = ref + len;
+    size_t needed = entry_len + strlen(rest) + 1;
+    if (needed > expansion_capacity) {
+        char *new_expansion = realloc(expansion, needed);
+        if (new_expansion == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        expansion = new_expansion;
+        expansion_capacity = needed;
+    }
+    memcpy(expansion, map + starts[idx], entry_len);
+    strcpy(expansion + entry_len, rest);
+    printf("%s\n", expansion);    // Show what is run, as other shells do
+    return expansion;
+}
+
+/**
+ * builtin_history - Lists the history with entry numbers, or only its last N
+ * entries; "-c" clears it.
+ */
+static int builtin_history(strvec_t *args, job_list_t *jobs) {
+    if (args->length > 2) {
+        fprintf(stderr, "history: too many arguments\n");
+        return 2;
+    }
+    if (hist_fd == -1) {
+        return 0;    // Only interactive shells keep a history
+    }
+    const char *arg = strvec_get(args, 1);
+    if (arg != NULL && strcmp(arg, "-c") == 0) {
+        if (ftruncate(hist_fd, 0) == -1) {
+            perror("ftruncate");
+            return 1;
+        }
+        file_size = 0;
+        reset_index();
+        return 0;
+    }
+    unsigned long count = ~0UL;
+    if (arg != NULL) {
+        char *end;
+        count = strtoul(arg, &end, 10);
+        if (end == arg || *end != '\0' || arg[0] == '-') {
+            fprintf(stderr, "history: %s: numeric argument required\n", arg);
+            return 2;
+        }
+    }
+    if (update_index() == -1) {
+        return 1;
+    }
+    for (unsigned i = count < nentries ? nentries - count : 0; i < nentries; i++) {
+        printf("%5u  %.*s\n", i + 1, (int) entry_length(i), map + starts[i]);
+    }
+    return 0;
+}
+
+void history_register(void) {
+    builtin_register("history", builtin_history, 0);
+}
+
+void history_free(void) {
+    if (hist_fd != -1 && map != NULL && appended > 0) {
+        appended = 0;
+        compact();
+    }
+    if (map != NULL) {
+        munmap(map, mapped);
+        map = NULL;
+    }
+    if (hist_fd != -1) {
+        close(hist_fd);
+        hist_fd = -1;
+    }
+    free(hist_path);
+    free(starts);
+    free(prev_same_initial);
+    free(expansion);
+    hist_path = NULL;
+    starts = NULL;
+    prev_same_initial = NULL;
+    expansion = NULL;
+    nentries = entries_capacity = 0;
+    expansion_capacity = 0;
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/*
+ * Command history, kept in an append-only file with one command per line
+ * ($SWISH_HISTFILE, or ~/.swish_history). The file is mmapped when the shell
+ * starts, so loading costs the same however long the history is; lines are
+ * located only when they are first needed, by one pass with memchr() over
+ * the part of the file not yet indexed. Each entry is also linked to the
+ * previous entry with the same first character, so '!prefix' looks only at
+ * entries that can match. New commands are appended with a single write(),
+ * and the mapping shares the page cache, so they are visible through it at
+ * once.
+ *
+ * Recall, at the start of a line:
+ *   !!          The previous command
+ *   !N  !-N     Command number N, or the Nth most recent one
+ *   !prefix     The most recent command that starts with prefix
+ * The rest of the line is kept after the recalled command.
+ *
+ * The file holds at most $SWISH_HISTSIZE entries (default 1000). It may grow
+ * to twice that before it is compacted by writing the newest entries to a
+ * new file that replaces it, so the cost of compacting is spread over many
+ * commands.
+ */
+
+/*
+ * Open (or create) the history file and map it
+ * path: The history file
+ * max_entries: Number of entries to keep in the file
+ * Returns 0 on success or -1 on error, in which case the shell runs without
+ * history
+ */
+int history_init(const char *path, unsigned max_entries);
+
+/*
+ * Append a command to the history
+ * line: The command, without its trailing newline; blank lines are skipped
+ * Returns 0 on success or -1 on error
+ */
+int history_add(const char *line);
+
+/*
+ * Replace a history reference at the start of a command line by the command
+ * it recalls
+ * line: The command line as read
+ * Returns 'line' itself if it does not start with a reference, a buffer owned
+ * by the history (valid until the next call) with the recalled command, or
+ * NULL if no command matches, which has been reported on stderr
+ */
+char *history_expand(char *line);
+
+/*
+ * Add the 'history' builtin to the builtin table
+ *   history       List every entry with its number
+ *   history N     List the last N entries
+ *   history -c    Clear the history
+ */
+void history_register(void);
+
+/*
+ * Compact the history file if it has grown past its size, then unmap and
+ * close it
+ */
+void history_free(void);
+
+#endif    // HISTORY_H
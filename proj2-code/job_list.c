@@ -1,55 +1,247 @@
 // Author: John Kolb <jhkolb@umn.edu>
 // SPDX-License-Identifier: GPL-3.0-or-later
 
+#define _GNU_SOURCE
+
 #include "job_list.h"
 
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/pidfd.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "job_shm.h"
+
+#define JOB_CHUNK 64           // Job slots per chunk, must be a power of two
+#define INITIAL_PID_SLOTS 16    // Must be a power of two
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1U << 2)    // Linux 6.9; missing from older headers
+#endif
+
+struct job_pid_slot {
+    pid_t pid;    // 0 for an empty slot
+    unsigned id;
+};
+
+static job_t *slot(const job_list_t *list, unsigned id) {
+    return &list->chunks[id / JOB_CHUNK][id % JOB_CHUNK];
+}
 
 void job_list_init(job_list_t *list) {
-    list->head = NULL;
-    list->length = 0;
+    memset(list, 0, sizeof(job_list_t));
+    list->free_head = JOB_ID_NONE;
 }
 
 void job_list_free(job_list_t *list) {
-    job_t *current = list->head;
-    while (current != NULL) {
-        job_t *temp = current;
-        current = current->next;
-        free(temp);
+    // Jobs still in the list give up their pidfds, timers and cgroups first
+    while (list->length > 0) {
+        job_list_remove(list, list->length - 1);
+    }
+    for (unsigned c = 0; c < list->nchunks; c++) {
+        for (unsigned i = 0; i < JOB_CHUNK; i++) {
+            free(list->chunks[c][i].procs);
+            free(list->chunks[c][i].cgroup);
+        }
+        free(list->chunks[c]);
     }
-    list->head = NULL;
-    list->length = 0;
+    free(list->chunks);
+    free(list->order);
+    free(list->pid_map);
+    job_list_init(list);
 }
 
-int job_list_add(job_list_t *list, pid_t pid, const char *name, job_status_t status) {
-    if (list->head == NULL) {
-        if ((list->head = malloc(sizeof(job_t))) == NULL) {
-            return -1;
+// --- pid -> job ID map: open addressing with linear probing ---
+
+static unsigned pid_hash(pid_t pid, unsigned capacity) {
+    return ((uint32_t) pid * 2654435761u) & (capacity - 1);    // Knuth's multiplicative hash
+}
+
+static struct job_pid_slot *pid_slot(const job_list_t *list, pid_t pid) {
+    unsigned i = pid_hash(pid, list->pid_map_capacity);
+    while (list->pid_map[i].pid != 0 && list->pid_map[i].pid != pid) {
+        i = (i + 1) & (list->pid_map_capacity - 1);
+    }
+    return &list->pid_map[i];
+}
+
+static int pid_map_grow(job_list_t *list) {
+    unsigned old_capacity = list->pid_map_capacity;
+    struct job_pid_slot *old_map = list->pid_map;
+    unsigned new_capacity = old_capacity == 0 ? INITIAL_PID_SLOTS : 2 * old_capacity;
+    struct job_pid_slot *new_map = calloc(new_capacity, sizeof(struct job_pid_slot));
+    if (new_map == NULL) {
+        return -1;
+    }
+    list->pid_map = new_map;
+    list->pid_map_capacity = new_capacity;
+    for (unsigned i = 0; i < old_capacity; i++) {
+        if (old_map[i].pid != 0) {
+            *pid_slot(list, old_map[i].pid) = old_map[i];
         }
-        strncpy(list->head->name, name, NAME_LEN);
-        list->head->name[NAME_LEN - 1] = '\0';
-        list->head->status = status;
-        list->head->next = NULL;
-        list->head->pid = pid;
-        list->length = 1;
-        return 0;
     }
+    free(old_map);
+    return 0;
+}
 
-    job_t *current = list->head;
-    while (current->next != NULL) {
-        current = current->next;
+static int pid_map_put(job_list_t *list, pid_t pid, unsigned id) {
+    if ((list->pid_map_count + 1) * 4 > list->pid_map_capacity * 3 && pid_map_grow(list) == -1) {
+        return -1;
+    }
+    struct job_pid_slot *entry = pid_slot(list, pid);
+    if (entry->pid == 0) {
+        list->pid_map_count++;
     }
-    if ((current->next = malloc(sizeof(job_t))) == NULL) {
+    // A pid that was reaped and reused now belongs to the newer job
+    entry->pid = pid;
+    entry->id = id;
+    return 0;
+}
+
+static void pid_map_remove(job_list_t *list, pid_t pid, unsigned id) {
+    if (list->pid_map_capacity == 0) {
+        return;
+    }
+    struct job_pid_slot *entry = pid_slot(list, pid);
+    if (entry->pid == 0 || entry->id != id) {
+        return;
+    }
+    entry->pid = 0;
+    list->pid_map_count--;
+
+    // Re-insert the rest of the probe run so that lookups never stop early
+    unsigned mask = list->pid_map_capacity - 1;
+    unsigned i = ((unsigned) (entry - list->pid_map) + 1) & mask;
+    while (list->pid_map[i].pid != 0) {
+        struct job_pid_slot moved = list->pid_map[i];
+        list->pid_map[i].pid = 0;
+        *pid_slot(list, moved.pid) = moved;
+        i = (i + 1) & mask;
+    }
+}
+
+// --- Job slots ---
+
+static unsigned alloc_slot(job_list_t *list) {
+    if (list->free_head == JOB_ID_NONE) {
+        job_t **new_chunks = realloc(list->chunks, (list->nchunks + 1) * sizeof(job_t *));
+        if (new_chunks == NULL) {
+            return JOB_ID_NONE;
+        }
+        list->chunks = new_chunks;
+        job_t *chunk = calloc(JOB_CHUNK, sizeof(job_t));
+        if (chunk == NULL) {
+            return JOB_ID_NONE;
+        }
+        list->chunks[list->nchunks] = chunk;
+        // Thread the new slots onto the free list in ascending order
+        unsigned base = list->nchunks * JOB_CHUNK;
+        for (unsigned i = 0; i < JOB_CHUNK; i++) {
+            chunk[i].next_free = i + 1 < JOB_CHUNK ? base + i + 1 : JOB_ID_NONE;
+        }
+        list->free_head = base;
+        list->nchunks++;
+    }
+    unsigned id = list->free_head;
+    list->free_head = slot(list, id)->next_free;
+    return id;
+}
+
+static void close_pidfd(job_proc_t *proc) {
+    if (proc->pidfd != -1) {
+        close(proc->pidfd);
+        proc->pidfd = -1;
+    }
+}
+
+static void release_slot(job_list_t *list, unsigned id) {
+    job_t *job = slot(list, id);
+    for (unsigned i = 0; i < job->nprocs; i++) {
+        pid_map_remove(list, job->procs[i].pid, id);
+        close_pidfd(&job->procs[i]);
+    }
+    if (job->cgroup != NULL) {
+        rmdir(job->cgroup);    // Fails if something the job started is still in it
+        free(job->cgroup);
+        job->cgroup = NULL;
+    }
+    if (job->timer_fd != -1) {
+        close(job->timer_fd);
+        job->timer_fd = -1;
+    }
+    job->in_use = 0;
+    job->nprocs = 0;
+    job_shm_clear(id);
+    job->next_free = list->free_head;    // procs is kept for the slot's next job
+    list->free_head = id;
+}
+
+int job_list_add(job_list_t *list, pid_t pid, const char *name, job_status_t status) {
+    return job_list_add_group(list, &pid, 1, name, status);
+}
+
+int job_list_add_group(job_list_t *list, const pid_t *pids, unsigned npids, const char *name,
+                       job_status_t status) {
+    if (list->length == list->order_capacity) {
+        unsigned new_capacity = list->order_capacity == 0 ? JOB_CHUNK : 2 * list->order_capacity;
+        unsigned *new_order = realloc(list->order, new_capacity * sizeof(unsigned));
+        if (new_order == NULL) {
+            return -1;
+        }
+        list->order = new_order;
+        list->order_capacity = new_capacity;
+    }
+    unsigned id = alloc_slot(list);
+    if (id == JOB_ID_NONE) {
         return -1;
     }
-    strncpy(current->next->name, name, NAME_LEN);
-    current->next->name[NAME_LEN - 1] = '\0';
-    current->next->status = status;
-    current->next->next = NULL;
-    current->next->pid = pid;
-    list->length++;
+    job_t *job = slot(list, id);
+    if (job->procs_capacity < npids) {
+        job_proc_t *new_procs = realloc(job->procs, npids * sizeof(job_proc_t));
+        if (new_procs == NULL) {
+            job->next_free = list->free_head;
+            list->free_head = id;
+            return -1;
+        }
+        job->procs = new_procs;
+        job->procs_capacity = npids;
+    }
+    job->cgroup = NULL;
+    job->timer_fd = -1;
+    job->timed_out = 0;
+    for (unsigned i = 0; i < npids; i++) {
+        job->procs[i].pid = pids[i];
+        job->procs[i].state = status == STOPPED ? PROC_STOPPED : PROC_RUNNING;
+        job->procs[i].wait_status = 0;
+        job->procs[i].pidfd = -1;
+        if (pid_map_put(list, pids[i], id) == -1) {
+            job->nprocs = i;
+            release_slot(list, id);
+            return -1;
+        }
+        // The process has not been reaped yet, so the pid is still its own
+        job->procs[i].pidfd = pidfd_open(pids[i], 0);
+    }
+    job->nprocs = npids;
+    job->nstages = npids;
+    strncpy(job->name, name, NAME_LEN);
+    job->name[NAME_LEN - 1] = '\0';
+    job->status = status;
+    job->pid = pids[0];
+    job->id = id;
+    job->in_use = 1;
+    memset(&job->usage, 0, sizeof(job_usage_t));
+    clock_gettime(CLOCK_MONOTONIC, &job->usage.start);
+    job_shm_update(job);
+
+    list->order[list->length++] = id;
     return 0;
 }
 
@@ -57,60 +249,230 @@ job_t *job_list_get(job_list_t *list, unsigned idx) {
     if (idx >= list->length) {
         return NULL;
     }
+    return slot(list, list->order[idx]);
+}
+
+job_t *job_list_get_id(job_list_t *list, unsigned id) {
+    if (id >= list->nchunks * JOB_CHUNK || !slot(list, id)->in_use) {
+        return NULL;
+    }
+    return slot(list, id);
+}
+
+job_t *job_list_find_pid(job_list_t *list, pid_t pid) {
+    if (list->pid_map_capacity == 0 || pid <= 0) {
+        return NULL;
+    }
+    struct job_pid_slot *entry = pid_slot(list, pid);
+    if (entry->pid == 0) {
+        return NULL;
+    }
+    return slot(list, entry->id);
+}
 
-    job_t *current = list->head;
-    for (int i = 0; i < idx; i++) {
-        if (current == NULL) {
-            return NULL;
+int job_list_index(const job_list_t *list, const job_t *job) {
+    for (unsigned i = 0; i < list->length; i++) {
+        if (list->order[i] == job->id) {
+            return i;
         }
-        current = current->next;
     }
-    return current;
+    return -1;
 }
 
 int job_list_remove(job_list_t *list, unsigned idx) {
     if (idx >= list->length) {
         return -1;
     }
+    release_slot(list, list->order[idx]);
+    memmove(&list->order[idx], &list->order[idx + 1], (list->length - idx - 1) * sizeof(unsigned));
+    list->length--;
+    return 0;
+}
 
-    if (idx == 0) {
-        job_t *temp = list->head;
-        list->head = list->head->next;
-        free(temp);
-        list->length--;
-        return 0;
+void job_list_remove_by_status(job_list_t *list, job_status_t status) {
+    // One pass that compacts the order array in place
+    unsigned kept = 0;
+    for (unsigned i = 0; i < list->length; i++) {
+        unsigned id = list->order[i];
+        if (slot(list, id)->status == status) {
+            release_slot(list, id);
+        } else {
+            list->order[kept++] = id;
+        }
     }
+    list->length = kept;
+}
 
-    job_t *current = list->head;
-    for (int i = 0; i < idx - 1; i++) {
-        current = current->next;
+/*
+ * Add the resources used by one exited process to its job's totals
+ */
+static void add_usage(job_t *job, const struct rusage *usage) {
+    timeradd(&job->usage.utime, &usage->ru_utime, &job->usage.utime);
+    timeradd(&job->usage.stime, &usage->ru_stime, &job->usage.stime);
+    if (usage->ru_maxrss > job->usage.maxrss) {
+        job->usage.maxrss = usage->ru_maxrss;
+    }
+}
+
+int job_update_proc(job_t *job, pid_t pid, int wait_status, const struct rusage *usage) {
+    for (unsigned i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].pid == pid) {
+            if (WIFSTOPPED(wait_status)) {
+                job->procs[i].state = PROC_STOPPED;
+            } else if (WIFCONTINUED(wait_status)) {
+                job->procs[i].state = PROC_RUNNING;
+            } else if (job->procs[i].state != PROC_DONE) {
+                job->procs[i].state = PROC_DONE;
+                close_pidfd(&job->procs[i]);
+                if (usage != NULL) {
+                    add_usage(job, usage);
+                }
+                if (job_count_procs(job, PROC_DONE) == job->nprocs) {
+                    clock_gettime(CLOCK_MONOTONIC, &job->usage.end);
+                }
+            }
+            job->procs[i].wait_status = wait_status;
+            job_shm_update(job);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+unsigned job_count_procs(const job_t *job, proc_state_t state) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].state == state) {
+            n++;
+        }
+    }
+    return n;
+}
+
+void job_mark_running(job_t *job) {
+    for (unsigned i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].state == PROC_STOPPED) {
+            job->procs[i].state = PROC_RUNNING;
+        }
+    }
+    job_shm_update(job);
+}
+
+void job_set_status(job_t *job, job_status_t status) {
+    job->status = status;
+    job_shm_update(job);
+}
+
+int job_signal(const job_t *job, int sig) {
+    // Any process that has not been reaped still belongs to the job's group
+    for (unsigned i = 0; i < job->nprocs; i++) {
+        const job_proc_t *proc = &job->procs[i];
+        if (proc->state == PROC_DONE || proc->pidfd == -1) {
+            continue;
+        }
+        if (pidfd_send_signal(proc->pidfd, sig, NULL, PIDFD_SIGNAL_PROCESS_GROUP) == 0) {
+            return 0;
+        }
+        if (errno == EINVAL) {
+            break;    // No group signals through pidfds; try each process instead
+        }
+        if (errno != ESRCH) {
+            return -1;
+        }
+    }
+
+    unsigned sent = 0;
+    for (unsigned i = 0; i < job->nprocs; i++) {
+        const job_proc_t *proc = &job->procs[i];
+        if (proc->state == PROC_DONE) {
+            continue;
+        }
+        int ret = proc->pidfd != -1 ? pidfd_send_signal(proc->pidfd, sig, NULL, 0)
+                                    : kill(proc->pid, sig);
+        if (ret == 0) {
+            sent++;
+        } else if (errno != ESRCH) {
+            return -1;
+        }
+    }
+    if (sent == 0) {
+        errno = ESRCH;
+        return -1;
     }
-    job_t *temp = current->next;
-    current->next = current->next->next;
-    free(temp);
-    list->length--;
     return 0;
 }
 
-void job_list_remove_by_status(job_list_t *list, job_status_t status) {
-    while (list->head != NULL && list->head->status == status) {
-        job_t *temp = list->head;
-        list->head = list->head->next;
-        list->length--;
-        free(temp);
-    }
-
-    if (list->head != NULL) {    // Could have removed all nodes in loop above
-        job_t *current = list->head;
-        while (current->next != NULL) {
-            if (current->next->status == status) {
-                job_t *temp = current->next;
-                current->next = current->next->next;
-                list->length--;
-                free(temp);
-            } else {
-                current = current->next;
+int job_exit_status(const job_t *job) {
+    if (job->timed_out && job_count_procs(job, PROC_DONE) == job->nprocs) {
+        return TIMEOUT_STATUS;
+    }
+    if (job_count_procs(job, PROC_DONE) != job->nprocs) {
+        for (unsigned i = 0; i < job->nprocs; i++) {
+            if (job->procs[i].state == PROC_STOPPED) {
+                return 128 + WSTOPSIG(job->procs[i].wait_status);
             }
         }
     }
+    int status = job->procs[job->nstages - 1].wait_status;
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+int job_timer_create(const struct timespec *after) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd == -1) {
+        perror("timerfd_create");
+        return -1;
+    }
+    // An all-zero it_value would disarm the timer instead
+    struct itimerspec spec = {.it_value = *after};
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(fd, 0, &spec, NULL) == -1) {
+        perror("timerfd_settime");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int job_set_timeout(job_t *job, const struct timespec *after, const struct timespec *grace) {
+    if ((job->timer_fd = job_timer_create(after)) == -1) {
+        return -1;
+    }
+    job->timed_out = 0;
+    job->grace = *grace;
+    return 0;
+}
+
+int job_check_timeout(job_t *job) {
+    uint64_t expirations;
+    if (job->timer_fd == -1 ||
+        read(job->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return 0;
+    }
+    job->timed_out++;
+    if (job->timed_out == 1) {
+        job_signal(job, SIGTERM);
+        job_signal(job, SIGCONT);    // A stopped job would not act on SIGTERM
+    } else {
+        job_signal(job, SIGKILL);
+    }
+    if (job->timed_out == 1 && (job->grace.tv_sec != 0 || job->grace.tv_nsec != 0)) {
+        struct itimerspec spec = {.it_value = job->grace};
+        timerfd_settime(job->timer_fd, 0, &spec, NULL);
+    } else {
+        close(job->timer_fd);    // Nothing more is due
+        job->timer_fd = -1;
+    }
+    return 1;
+}
+
+void job_list_check_timeouts(job_list_t *list) {
+    for (unsigned i = 0; i < list->length; i++) {
+        job_check_timeout(job_list_get(list, i));
+    }
 }
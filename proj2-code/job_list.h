@@ -5,27 +5,80 @@
 #define JOB_LIST_H
 
 #include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 
 #define NAME_LEN 32
 
 typedef enum {
     STOPPED,
     BACKGROUND,
+    FOREGROUND,
 } job_status_t;
 
+typedef enum {
+    PROC_RUNNING,
+    PROC_STOPPED,
+    PROC_DONE,
+} proc_state_t;
+
+// One process of a job; a pipeline job has one of these per stage
+typedef struct {
+    pid_t pid;
+    proc_state_t state;
+    int wait_status;    // Most recent status reported by wait4()
+    int pidfd;          // Refers to the process until it is reaped; -1 if there is none
+} job_proc_t;
+
+// Resources used by a job, collected from wait4() as its processes exit
+typedef struct {
+    struct timespec start;    // CLOCK_MONOTONIC time the job was added
+    struct timespec end;      // Time its last process was reaped; zero while running
+    struct timeval utime;     // User CPU time of the processes reaped so far
+    struct timeval stime;     // System CPU time of the processes reaped so far
+    long maxrss;              // Largest resident set of any of them, in KiB
+} job_usage_t;
+
 typedef struct job {
     char name[NAME_LEN];
     int status;
-    pid_t pid;
-    struct job *next;
+    pid_t pid;            // First process of the job, which leads its process group
+    job_proc_t *procs;    // Every process in the job, in pipeline order
+    unsigned nprocs;
+    unsigned nstages;     // The first nstages procs run the pipeline; any others copy
+                          // its output to several files (see fanout.h)
+    unsigned id;          // Stable identifier; never changes while the job exists
+    job_usage_t usage;
+    char *cgroup;         // Leaf cgroup the job runs in ('run'), removed with the job; or NULL
+    int timer_fd;         // timerfd of the job's 'timeout' deadline, closed with the job; or -1
+    int timed_out;        // Signals sent since the deadline: 0, 1 (SIGTERM) or 2 (SIGKILL)
+    struct timespec grace;    // Time from SIGTERM to SIGKILL; zero to send no SIGKILL
+    // Table bookkeeping, not to be modified by users of the list
+    unsigned procs_capacity;    // Slots allocated in procs, kept when the job is reused
+    unsigned next_free;         // Next unused job slot while this one is unused
+    int in_use;
 } job_t;
 
+// Jobs live in fixed-size chunks that are never moved, so job_t pointers and
+// IDs stay valid until the job is removed. 'order' holds the IDs of the jobs
+// in the order they were added, which is what job indices refer to, and a
+// hash map finds the job owning any of its processes' pids.
 typedef struct {
-    job_t *head;
+    job_t **chunks;
+    unsigned nchunks;
+    unsigned free_head;    // First unused slot, or JOB_ID_NONE
+    unsigned *order;
+    unsigned order_capacity;
     unsigned length;
+    struct job_pid_slot *pid_map;
+    unsigned pid_map_capacity;    // Zero or a power of two
+    unsigned pid_map_count;
 } job_list_t;
 
+#define JOB_ID_NONE ((unsigned) -1)
+
 /*
  * Initialize a new, empty jobs list
  * list: Pointer to the jobs list to initialize
@@ -33,12 +86,23 @@ typedef struct {
 void job_list_init(job_list_t *list);
 
 /*
- * Removes all entries from a jobs list
+ * Removes all entries from a jobs list, releasing each job's resources as
+ * job_list_remove() does
  * The underlying memory for the entries is also freed
  * list: Pointer to the job list to clear
  */
 void job_list_free(job_list_t *list);
 
+/*
+ * Every process added to a jobs list gets a pidfd (Linux 5.3 or later). A
+ * pidfd keeps referring to the same process even after it has exited, so
+ * signals sent through it can never reach an unrelated process that was
+ * given a reused pid, and it becomes readable once the process has exited.
+ * The list closes a process's pidfd when the process is reaped (reported by
+ * job_update_proc()) or its job is removed. Where pidfd_open() is not
+ * available, pidfd is -1 and plain pids are used instead.
+ */
+
 /*
  * Add a new job to a jobs list
  * list: The jobs list to add to
@@ -49,6 +113,19 @@ void job_list_free(job_list_t *list);
  */
 int job_list_add(job_list_t *list, pid_t pid, const char *name, job_status_t status);
 
+/*
+ * Add a new job made up of several processes (e.g., a pipeline) to a jobs list
+ * All processes must belong to the process group led by pids[0]
+ * list: The jobs list to add to
+ * pids: The process IDs of the job's processes, in pipeline order
+ * npids: Number of entries in pids (at least 1)
+ * name: The name of the job's program (e.g., "ls", "cat", or "wc")
+ * status: The job's current status
+ * Returns 0 on success or -1 on error
+ */
+int job_list_add_group(job_list_t *list, const pid_t *pids, unsigned npids, const char *name,
+                       job_status_t status);
+
 /*
  * Retrieve an element from a jobs list
  * list: Pointer to the jobs list to retrieve from
@@ -57,9 +134,34 @@ int job_list_add(job_list_t *list, pid_t pid, const char *name, job_status_t sta
  */
 job_t *job_list_get(job_list_t *list, unsigned idx);
 
+/*
+ * Retrieve a job by its stable ID in constant time
+ * list: Pointer to the jobs list to retrieve from
+ * id: The job's 'id' field
+ * Returns a pointer to the job_t (not a copy) or NULL if no job has that ID
+ */
+job_t *job_list_get_id(job_list_t *list, unsigned id);
+
+/*
+ * Find the job that one of the shell's child processes belongs to, in
+ * constant expected time
+ * list: Pointer to the jobs list to search
+ * pid: Process ID of any process in the job (not just its leader)
+ * Returns a pointer to the job_t (not a copy) or NULL if no job owns the pid
+ */
+job_t *job_list_find_pid(job_list_t *list, pid_t pid);
+
+/*
+ * Find the current index of a job, i.e. the number that 'fg' or 'jobs' use
+ * list: Pointer to the jobs list to search
+ * job: A job stored in the list
+ * Returns the job's index or -1 if it is not in the list
+ */
+int job_list_index(const job_list_t *list, const job_t *job);
+
 /*
  * Removes an element at a specific index from a jobs list
- * The memory for this element is freed
+ * The element's slot is kept for reuse by a later job_list_add()
  * list: Pointer to the jobs list to remove from
  * idx: Index of the element to remove
  * Returns 0 on success or -1 on error
@@ -68,10 +170,104 @@ int job_list_remove(job_list_t *list, unsigned idx);
 
 /*
  * Remove all jobs of a specific status (STOPPED or BACKGROUND) from a jobs list
- * The memory for all entries removed from the list is freed
+ * The slots of all entries removed from the list are kept for reuse
  * list: The jobs list to remove from
  * status: The status of all jobs that should be removed (BACKGROUND or STOPPED)
  */
 void job_list_remove_by_status(job_list_t *list, job_status_t status);
 
+/*
+ * Record a state change reported by wait4() for one of a job's processes
+ * When the process has exited, its resource usage is added to the job's, and
+ * the job's end time is set once no process of it is left
+ * job: The job to update
+ * pid: The process ID returned by wait4()
+ * wait_status: The status returned by wait4()
+ * usage: The resource usage returned by wait4(), or NULL if not known
+ * Returns 0 on success or -1 if the process does not belong to the job
+ */
+int job_update_proc(job_t *job, pid_t pid, int wait_status, const struct rusage *usage);
+
+/*
+ * Count the processes of a job that are in a given state
+ * job: The job to examine
+ * state: PROC_RUNNING, PROC_STOPPED or PROC_DONE
+ * Returns the number of matching processes
+ */
+unsigned job_count_procs(const job_t *job, proc_state_t state);
+
+/*
+ * Mark every process of a job that has not exited as running again, e.g.
+ * after it has been sent SIGCONT
+ * job: The job to update
+ */
+void job_mark_running(job_t *job);
+
+/*
+ * Move a job to the foreground or the background, or record that it stopped
+ * (job_t.status is only changed through here, so that the shared-memory job
+ * table sees every change; see job_shm.h)
+ * job: The job to update
+ * status: Its new status
+ */
+void job_set_status(job_t *job, job_status_t status);
+
+/*
+ * Send a signal to a job through the pidfds of its processes
+ * The whole process group is signalled, so processes started by the job's own
+ * processes receive it too. Kernels before Linux 6.9 cannot signal a group
+ * through a pidfd; there, and for processes without a pidfd, each process of
+ * the job that has not been reaped is signalled on its own.
+ * job: The job to signal
+ * sig: The signal number
+ * Returns 0 on success or -1 on error, with errno set (ESRCH if every process
+ * of the job has already exited)
+ */
+int job_signal(const job_t *job, int sig);
+
+/*
+ * Compute a job's status the way $? reports it
+ * job: The job to examine
+ * Returns the exit code of its last stage, 128 plus the signal number if
+ * that stage was killed, or 128 plus the stop signal if the job stopped;
+ * TIMEOUT_STATUS if its 'timeout' deadline killed it
+ */
+int job_exit_status(const job_t *job);
+
+#define TIMEOUT_STATUS 124    // Status of a job or wait that ran out of time, as in timeout(1)
+
+/*
+ * Create a timer that expires once
+ * after: Time until it expires; zero makes it expire at once
+ * Returns a timerfd (close-on-exec and non-blocking) that becomes readable
+ * when it expires, or -1 on error, which has been reported
+ */
+int job_timer_create(const struct timespec *after);
+
+/*
+ * Give a job a deadline: once it passes, the job is sent SIGTERM (and
+ * SIGCONT, in case it is stopped), and if it is still there after 'grace',
+ * SIGKILL. The deadline is enforced by job_check_timeout(), which the shell
+ * calls when the timer descriptor (timer_fd) becomes readable while it waits
+ * for jobs, and before every prompt.
+ * job: The job
+ * after: Time from now until the deadline
+ * grace: Time from SIGTERM to SIGKILL, or zero to only send SIGTERM
+ * Returns 0 on success or -1 on error, which has been reported
+ */
+int job_set_timeout(job_t *job, const struct timespec *after, const struct timespec *grace);
+
+/*
+ * Send the signals that a job's deadline calls for, if it has passed
+ * job: The job, which may or may not have a deadline
+ * Returns 1 if a signal was sent, or 0 if none was due
+ */
+int job_check_timeout(job_t *job);
+
+/*
+ * Send the signals due for every job in a list whose deadline has passed
+ * list: The jobs list
+ */
+void job_list_check_timeouts(job_list_t *list);
+
 #endif    // JOB_LIST_H
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "job_shm.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TABLE_SIZE (sizeof(job_shm_t) + JOB_SHM_SLOTS * sizeof(job_shm_entry_t))
+
+static job_shm_t *table = NULL;
+static char *table_path = NULL;
+
+/*
+ * A forked copy of the shell must leave the table to the shell itself, even
+ * if it changes its own copy of the job list
+ */
+static void forget_table(void) {
+    table = NULL;
+    free(table_path);
+    table_path = NULL;
+}
+
+int job_shm_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    if (ftruncate(fd, TABLE_SIZE) == -1) {
+        perror("ftruncate");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    void *mapped = mmap(NULL, TABLE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        unlink(path);
+        return -1;
+    }
+    // The file is deleted at exit, wherever the shell has gone by then
+    if ((table_path = realpath(path, NULL)) == NULL) {
+        perror("realpath");
+        munmap(mapped, TABLE_SIZE);
+        unlink(path);
+        return -1;
+    }
+    // The file starts out zeroed, so every slot is empty and 'seq' is even
+    table = mapped;
+    table->version = JOB_SHM_VERSION;
+    table->shell_pid = getpid();
+    table->nslots = JOB_SHM_SLOTS;
+    atomic_thread_fence(memory_order_release);
+    table->magic = JOB_SHM_MAGIC;    // Last, so a reader that sees it sees the rest
+    static int registered = 0;
+    if (!registered) {
+        pthread_atfork(NULL, NULL, forget_table);
+        registered = 1;
+    }
+    return 0;
+}
+
+/*
+ * Make 'seq' odd; the stores that follow cannot become visible before it
+ */
+static void begin_write(void) {
+    uint64_t seq = atomic_load_explicit(&table->seq, memory_order_relaxed);
+    atomic_store_explicit(&table->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/*
+ * Make 'seq' even again once everything written before is visible
+ */
+static void end_write(void) {
+    uint64_t seq = atomic_load_explicit(&table->seq, memory_order_relaxed);
+    atomic_store_explicit(&table->seq, seq + 1, memory_order_release);
+}
+
+void job_shm_update(const job_t *job) {
+    if (table == NULL || job->id >= JOB_SHM_SLOTS) {
+        return;
+    }
+    unsigned ndone = job_count_procs(job, PROC_DONE);
+    int done = ndone == job->nprocs;
+    job_shm_entry_t *entry = &table->jobs[job->id];
+
+    begin_write();
+    if (!entry->in_use) {
+        table->njobs++;
+    }
+    if (job->id >= table->high) {
+        table->high = job->id + 1;
+    }
+    entry->in_use = 1;
+    entry->id = job->id;
+    entry->state = done                     ? JOB_SHM_DONE
+                   : job->status == STOPPED ? JOB_SHM_STOPPED
+                   : job->status == BACKGROUND ? JOB_SHM_BACKGROUND
+                                               : JOB_SHM_FOREGROUND;
+    entry->pgid = job->pid;
+    entry->exit_status = done ? job_exit_status(job) : -1;
+    entry->nprocs = job->nprocs;
+    entry->ndone = ndone;
+    entry->start_ns = job->usage.start.tv_sec * 1000000000ull + job->usage.start.tv_nsec;
+    entry->utime_us = job->usage.utime.tv_sec * 1000000ull + job->usage.utime.tv_usec;
+    entry->stime_us = job->usage.stime.tv_sec * 1000000ull + job->usage.stime.tv_usec;
+    memcpy(entry->name, job->name, NAME_LEN);
+    end_write();
+}
+
+void job_shm_clear(unsigned id) {
+    if (table == NULL || id >= JOB_SHM_SLOTS || !table->jobs[id].in_use) {
+        return;
+    }
+    begin_write();
+    memset(&table->jobs[id], 0, sizeof(job_shm_entry_t));
+    table->njobs--;
+    end_write();
+}
+
+void job_shm_close(void) {
+    if (table == NULL) {
+        return;
+    }
+    munmap(table, TABLE_SIZE);
+    unlink(table_path);
+    forget_table();
+}
+
+void job_shm_unlink(void) {
+    if (table != NULL) {
+        unlink(table_path);
+    }
+}
+
+int job_shm_relink(void) {
+    if (table == NULL) {
+        return 0;
+    }
+    job_shm_t *old = table;
+    char *path = table_path;
+    table = NULL;
+    table_path = NULL;
+    int ret = job_shm_open(path);
+    if (ret == 0) {
+        begin_write();
+        table->high = old->high;
+        table->njobs = old->njobs;
+        memcpy(table->jobs, old->jobs, old->high * sizeof(job_shm_entry_t));
+        end_write();
+    }
+    munmap(old, TABLE_SIZE);
+    free(path);
+    return ret;
+}
+
+unsigned job_shm_snapshot(const job_shm_t *shm, job_shm_entry_t *out, unsigned max) {
+    while (1) {
+        uint64_t before = atomic_load_explicit(&shm->seq, memory_order_acquire);
+        if (before % 2 == 1) {
+            sched_yield();    // The shell is in the middle of an update
+            continue;
+        }
+        unsigned n = 0;
+        unsigned high = shm->high < shm->nslots ? shm->high : shm->nslots;
+        for (unsigned i = 0; i < high && n < max; i++) {
+            if (shm->jobs[i].in_use) {
+                out[n++] = shm->jobs[i];
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shm->seq, memory_order_relaxed) == before) {
+            return n;
+        }
+    }
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef JOB_SHM_H
+#define JOB_SHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "job_list.h"
+
+/*
+ * The job table in shared memory, for supervisors that watch the shell's
+ * jobs without scraping the output of 'jobs'. When $SWISH_JOB_TABLE names a
+ * file (under /dev/shm, say), the shell creates it at startup, maps it, and
+ * rewrites a job's entry whenever the job is added, one of its processes
+ * stops, continues or exits, it moves between the foreground and the
+ * background, or it is removed. The file is deleted when the shell exits or
+ * is replaced by 'exec'; if the exec fails, it is created again.
+ *
+ * Entries are indexed by job ID (job_t.id), which never changes while the
+ * job exists, so an update only writes one entry. Jobs with IDs from
+ * JOB_SHM_SLOTS on, which only exist while that many jobs do, are not shown.
+ *
+ * The table is guarded by a sequence lock: the shell makes 'seq' odd before
+ * it changes anything and even again afterwards. A reader maps the file
+ * read-only and copies what it needs between two reads of 'seq'; if they
+ * differ, or the first was odd, it copies again. Readers never block the
+ * shell and need no system call at all; job_shm_snapshot() does this.
+ */
+
+#define JOB_SHM_MAGIC 0x6a687377    // "wshj"
+#define JOB_SHM_VERSION 1
+#define JOB_SHM_SLOTS 1024
+
+// What a job is doing
+enum {
+    JOB_SHM_STOPPED,
+    JOB_SHM_BACKGROUND,
+    JOB_SHM_FOREGROUND,
+    JOB_SHM_DONE,    // Every process has exited; the shell has not removed the job yet
+};
+
+typedef struct {
+    uint32_t in_use;         // 0 for a slot without a job
+    uint32_t id;             // The job's ID, which is also its slot
+    uint32_t state;          // JOB_SHM_*
+    int32_t pgid;            // The job's process group, led by its first process
+    int32_t exit_status;     // As $? reports it once the job is done, -1 until then
+    uint32_t nprocs;         // Processes in the job
+    uint32_t ndone;          // ...of which have exited
+    uint32_t reserved;
+    uint64_t start_ns;       // CLOCK_MONOTONIC time the job started
+    uint64_t utime_us;       // User CPU time of the processes that have exited
+    uint64_t stime_us;       // System CPU time of the processes that have exited
+    char name[NAME_LEN];     // Program of the job's first external stage
+} job_shm_entry_t;
+
+typedef struct {
+    uint32_t magic;          // JOB_SHM_MAGIC
+    uint32_t version;        // JOB_SHM_VERSION
+    int32_t shell_pid;
+    uint32_t nslots;         // Entries in 'jobs'
+    _Atomic uint64_t seq;    // Odd while the shell is writing
+    uint32_t high;           // Only slots below this have ever been used
+    uint32_t njobs;          // Slots in use
+    job_shm_entry_t jobs[];
+} job_shm_t;
+
+/*
+ * Create and map the table; the shell publishes its jobs in it from now on
+ * path: File to create, replacing any existing one
+ * Returns 0 on success or -1 on error, which has been reported
+ */
+int job_shm_open(const char *path);
+
+/*
+ * Publish the current state of a job (nothing happens without a table)
+ * job: The job, which must be in use
+ */
+void job_shm_update(const job_t *job);
+
+/*
+ * Empty the entry of a job that has been removed
+ * id: The ID the job had
+ */
+void job_shm_clear(unsigned id);
+
+/*
+ * Unmap the table and delete its file, before the shell exits
+ */
+void job_shm_close(void);
+
+/*
+ * Delete the table's file before an exec that replaces the shell, which
+ * drops the mapping; the table is still kept up to date until then
+ */
+void job_shm_unlink(void);
+
+/*
+ * Create the file again, with the jobs as they are, after a failed exec;
+ * readers have to map the new file
+ * Returns 0 on success (or without a table) or -1 on error, which has been
+ * reported and leaves the shell without a table
+ */
+int job_shm_relink(void);
+
+/*
+ * Copy a consistent snapshot of the jobs out of a table mapped by a reader
+ * shm: The mapped table
+ * out: Room for 'max' entries, filled with the jobs in ID order
+ * max: Most entries to copy
+ * Returns the number of entries copied
+ */
+unsigned job_shm_snapshot(const job_shm_t *shm, job_shm_entry_t *out, unsigned max);
+
+#endif    // JOB_SHM_H
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "job_wait.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "reaper.h"
+#include "stats.h"
+
+#define SELF_PIPE_EVENT UINT64_MAX    // epoll data of the reaper's self-pipe
+#define TIMER_EVENT (1ULL << 62)      // Added to a job's index for the epoll data of its timer
+#define MAX_EVENTS 64
+
+// One process being waited for, through its job's pidfd when it has one
+struct watch {
+    pid_t pid;
+    unsigned job_idx;
+    unsigned proc_idx;
+    int active;    // 0 once the process has been reaped or its job resolved
+};
+
+// Jobs being waited for, indexed by their position in the job list
+struct wait_state {
+    int epfd;
+    struct watch *watches;
+    unsigned *first_watch;    // Per job: its first entry in 'watches'...
+    unsigned *nwatches;       // ...and how many entries it has
+    char *resolved;           // Per job: nonzero once it has finished or stopped
+    unsigned pending;         // Background jobs still running
+    unsigned resolved_count;
+    unsigned unwatched;       // Processes without a pidfd, checked on every SIGCHLD
+    int notify;
+    int *status;
+};
+
+static int watch_fd(job_list_t *jobs, const struct watch *w) {
+    return job_list_get(jobs, w->job_idx)->procs[w->proc_idx].pidfd;
+}
+
+static void unwatch(struct wait_state *st, job_list_t *jobs, struct watch *w) {
+    int fd = watch_fd(jobs, w);
+    if (fd != -1) {
+        epoll_ctl(st->epfd, EPOLL_CTL_DEL, fd, NULL);
+    } else {
+        st->unwatched--;
+    }
+    w->active = 0;
+}
+
+static void unwatch_job(struct wait_state *st, job_list_t *jobs, unsigned idx) {
+    for (unsigned w = st->first_watch[idx]; w < st->first_watch[idx] + st->nwatches[idx]; w++) {
+        if (st->watches[w].active) {
+            unwatch(st, jobs, &st->watches[w]);
+        }
+    }
+}
+
+/*
+ * Called once a waited-for job has no running process left
+ */
+static void resolve_job(struct wait_state *st, job_list_t *jobs, unsigned idx) {
+    job_t *job = job_list_get(jobs, idx);
+    if (st->resolved[idx] || job_count_procs(job, PROC_RUNNING) > 0) {
+        return;
+    }
+    st->resolved[idx] = 1;
+    st->resolved_count++;
+    st->pending--;
+    unwatch_job(st, jobs, idx);
+    if (job_count_procs(job, PROC_DONE) != job->nprocs) {
+        job_set_status(job, STOPPED);
+    }
+    if (st->notify) {
+        reaper_print_notice(job, idx);
+        fflush(stdout);
+    }
+    if (st->status != NULL) {
+        *st->status = job_exit_status(job);
+    }
+}
+
+/*
+ * Collect processes that have stopped; pidfds only report exits
+ */
+static void collect_stops(struct wait_state *st, job_list_t *jobs) {
+    siginfo_t info;
+    while (1) {
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WNOHANG) == -1 || info.si_pid == 0) {
+            return;
+        }
+        job_t *job = job_list_find_pid(jobs, info.si_pid);
+        if (job == NULL) {
+            continue;
+        }
+        job_update_proc(job, info.si_pid, W_STOPCODE(info.si_status), NULL);
+        int idx = job_list_index(jobs, job);
+        if (idx != -1 && job->status == BACKGROUND) {
+            resolve_job(st, jobs, idx);
+        }
+    }
+}
+
+static void reap_watch(struct wait_state *st, job_list_t *jobs, struct watch *w) {
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(w->pid, &status, WNOHANG, &usage);
+    if (pid == 0) {
+        return;    // Not a zombie yet
+    }
+    // Unwatched before the job list closes the pidfd
+    unwatch(st, jobs, w);
+    job_t *job = job_list_get(jobs, w->job_idx);
+    if (pid == w->pid) {
+        job_update_proc(job, pid, status, &usage);
+    } else {
+        // Already reaped elsewhere; nothing is known about how it ended
+        job_update_proc(job, w->pid, 0, NULL);
+    }
+    resolve_job(st, jobs, w->job_idx);
+}
+
+/*
+ * Processes without a pidfd give no event of their own; try to reap them
+ */
+static void reap_unwatched(struct wait_state *st, job_list_t *jobs, unsigned nwatches) {
+    for (unsigned i = 0; i < nwatches && st->unwatched > 0; i++) {
+        struct watch *w = &st->watches[i];
+        if (w->active && watch_fd(jobs, w) == -1) {
+            reap_watch(st, jobs, w);
+        }
+    }
+}
+
+/*
+ * Add the pidfd of every running process of every background job to the
+ * epoll set
+ * Returns the number of processes being watched, or -1 on error
+ */
+static int watch_jobs(struct wait_state *st, job_list_t *jobs) {
+    unsigned nprocs = 0;
+    for (unsigned i = 0; i < jobs->length; i++) {
+        nprocs += job_list_get(jobs, i)->nprocs;
+    }
+    st->watches = malloc((nprocs + 1) * sizeof(struct watch));
+    st->first_watch = calloc(jobs->length + 1, sizeof(unsigned));
+    st->nwatches = calloc(jobs->length + 1, sizeof(unsigned));
+    st->resolved = calloc(jobs->length + 1, 1);
+    if (st->watches == NULL || st->first_watch == NULL || st->nwatches == NULL ||
+        st->resolved == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    unsigned nwatches = 0;
+    for (unsigned i = 0; i < jobs->length; i++) {
+        job_t *job = job_list_get(jobs, i);
+        st->first_watch[i] = nwatches;
+        if (job->status != BACKGROUND) {
+            st->resolved[i] = 1;    // Not waited for
+            continue;
+        }
+        st->pending++;
+        if (job->timer_fd != -1) {
+            struct epoll_event ev = {.events = EPOLLIN, .data.u64 = TIMER_EVENT + i};
+            if (epoll_ctl(st->epfd, EPOLL_CTL_ADD, job->timer_fd, &ev) == -1) {
+                perror("epoll_ctl");
+                return -1;
+            }
+        }
+        for (unsigned p = 0; p < job->nprocs; p++) {
+            if (job->procs[p].state != PROC_RUNNING) {
+                continue;
+            }
+            struct watch *w = &st->watches[nwatches];
+            w->pid = job->procs[p].pid;
+            w->job_idx = i;
+            w->proc_idx = p;
+            w->active = 1;
+            if (job->procs[p].pidfd == -1) {
+                st->unwatched++;
+            } else {
+                struct epoll_event ev = {.events = EPOLLIN, .data.u64 = nwatches};
+                if (epoll_ctl(st->epfd, EPOLL_CTL_ADD, job->procs[p].pidfd, &ev) == -1) {
+                    perror("epoll_ctl");
+                    return -1;
+                }
+            }
+            nwatches++;
+            st->nwatches[i]++;
+        }
+    }
+    // Jobs that finished or stopped before the wait started
+    for (unsigned i = 0; i < jobs->length; i++) {
+        if (!st->resolved[i]) {
+            resolve_job(st, jobs, i);
+        }
+    }
+    return nwatches;
+}
+
+int job_wait_background(job_list_t *jobs, int wait_any, int notify, int *status) {
+    uint64_t start = stats_now();
+    struct wait_state st = {
+        .epfd = epoll_create1(EPOLL_CLOEXEC),
+        .notify = notify,
+        .status = status,
+    };
+    int ret = 0;
+    int nwatches = 0;
+    if (st.epfd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = SELF_PIPE_EVENT};
+    if (reaper_fd() != -1 && epoll_ctl(st.epfd, EPOLL_CTL_ADD, reaper_fd(), &ev) == -1) {
+        perror("epoll_ctl");
+        ret = -1;
+    }
+    if (ret == 0 && (nwatches = watch_jobs(&st, jobs)) == -1) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        collect_stops(&st, jobs);
+        reap_unwatched(&st, jobs, nwatches);
+    }
+
+    while (ret == 0 && st.pending > 0 && !(wait_any && st.resolved_count > 0)) {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(st.epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            ret = -1;
+            break;
+        }
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.u64 == SELF_PIPE_EVENT) {
+                reaper_drain();
+                collect_stops(&st, jobs);
+                reap_unwatched(&st, jobs, nwatches);
+            } else if (events[e].data.u64 >= TIMER_EVENT) {
+                // The exits it causes arrive through the pidfds
+                job_check_timeout(job_list_get(jobs, events[e].data.u64 - TIMER_EVENT));
+            } else {
+                struct watch *w = &st.watches[events[e].data.u64];
+                if (w->active) {
+                    reap_watch(&st, jobs, w);
+                }
+            }
+        }
+    }
+
+    // Closing the epoll set drops the pidfds that are still in it; the job
+    // list keeps them open. Finished jobs are removed from the back so that
+    // the indices of the ones still to be removed stay valid.
+    for (unsigned i = jobs->length; i-- > 0;) {
+        job_t *job = job_list_get(jobs, i);
+        if (st.resolved != NULL && st.resolved[i] && job->status == BACKGROUND &&
+            job_count_procs(job, PROC_DONE) == job->nprocs) {
+            job_list_remove(jobs, i);
+        }
+    }
+    close(st.epfd);
+    free(st.watches);
+    free(st.first_watch);
+    free(st.nwatches);
+    free(st.resolved);
+    stats_record(STAT_WAIT_TIME, start);
+    return ret == -1 ? -1 : (int) st.resolved_count;
+}
+
+int job_wait_timed(job_t *job, int wait_timer) {
+    struct pollfd fds[] = {
+        {.fd = reaper_fd(), .events = POLLIN},
+        {.fd = job->timer_fd, .events = POLLIN},
+        {.fd = wait_timer, .events = POLLIN},
+    };
+    while (1) {
+        // Every change that SIGCHLD has announced so far
+        while (job_count_procs(job, PROC_RUNNING) > 0) {
+            int status;
+            struct rusage usage;
+            pid_t pid = wait4(-job->pid, &status, WNOHANG | WUNTRACED, &usage);
+            if (pid == 0) {
+                break;
+            } else if (pid < 0) {
+                perror("wait4");
+                return -1;
+            }
+            job_update_proc(job, pid, status, &usage);
+        }
+        if (job_count_procs(job, PROC_RUNNING) == 0) {
+            return 0;
+        }
+        fds[1].fd = job->timer_fd;    // Closed once the last signal is sent
+        if (poll(fds, sizeof(fds) / sizeof(fds[0]), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+        if (fds[0].revents & POLLIN) {
+            reaper_drain();
+        }
+        if (fds[1].revents & POLLIN) {
+            job_check_timeout(job);
+        }
+        if (fds[2].revents & POLLIN) {
+            return 1;
+        }
+    }
+}
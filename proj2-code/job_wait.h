@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef JOB_WAIT_H
+#define JOB_WAIT_H
+
+#include "job_list.h"
+
+/*
+ * Waits for background jobs in the order they complete. The pidfds that the
+ * job list keeps for every process are watched with epoll together with the
+ * reaper's SIGCHLD self-pipe, which reports processes that stop. Each event
+ * costs constant work: the pidfd of an exited process is reaped with wait4()
+ * and any stop is matched to its job through the job list's pid map.
+ * Processes that have no pidfd are checked whenever SIGCHLD arrives.
+ */
+
+/*
+ * Wait for background jobs to finish or stop
+ * Jobs that finish are removed from the list and jobs that stop are marked
+ * STOPPED. Job indices do not change until the wait is over, so notices use
+ * the numbers that 'jobs' showed before it.
+ * jobs: The list of current jobs for the shell
+ * wait_any: 1 to return as soon as one job has finished or stopped, or 0 to
+ *           wait until none is running in the background
+ * notify: 1 to print a line for every job as it finishes or stops
+ * status: If not NULL, set to the exit status of the last job that finished
+ *         or stopped, as reported by $?
+ * Returns the number of jobs that finished or stopped, or -1 on error
+ */
+int job_wait_background(job_list_t *jobs, int wait_any, int notify, int *status);
+
+/*
+ * Wait for one job's processes to exit or stop, like wait4() on its process
+ * group, while enforcing the job's 'timeout' deadline and the caller's own
+ * The reaper's self-pipe and both timers are watched with poll(), so the
+ * shell sleeps until one of them fires.
+ * job: The job to wait for
+ * wait_timer: A timerfd (see job_timer_create()) that limits the wait, or -1
+ * Returns 0 once no process of the job is running, 1 if wait_timer expired
+ * first, or -1 on error
+ */
+int job_wait_timed(job_t *job, int wait_timer);
+
+#endif    // JOB_WAIT_H
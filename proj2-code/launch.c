@@ -0,0 +1,412 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "launch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "fanout.h"
+#include "fork_server.h"
+#include "parser.h"
+#include "path_cache.h"
+#include "placement.h"
+#include "stats.h"
+#include "swish_funcs.h"
+
+static launch_backend_t backend = LAUNCH_SPAWN;
+static int cgroup_procs = -1;    // cgroup.procs of the cgroup new processes join, or -1
+static const placement_t *placement = NULL;    // Placement of new processes, if any
+static int terminal = -1;    // Terminal that new processes take over, or -1
+
+// Processes started for process substitutions, which no job tracks
+static pid_t *substitution_pids = NULL;
+static unsigned nsubstitution_pids = 0, substitution_pids_capacity = 0;
+
+void launch_set_backend(launch_backend_t new_backend) {
+    backend = new_backend;
+}
+
+int launch_set_backend_by_name(const char *name) {
+    if (strcmp(name, "spawn") == 0) {
+        backend = LAUNCH_SPAWN;
+    } else if (strcmp(name, "fork") == 0) {
+        backend = LAUNCH_FORK;
+    } else if (strcmp(name, "server") == 0) {
+        backend = LAUNCH_SERVER;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+launch_backend_t launch_get_backend(void) {
+    return backend;
+}
+
+void launch_set_cgroup(int procs_fd) {
+    cgroup_procs = procs_fd;
+}
+
+void launch_set_placement(const placement_t *p) {
+    placement = p;
+}
+
+void launch_set_terminal(int fd) {
+    terminal = fd;
+}
+
+/**
+ * launch_fork - Starts a command by forking a full copy of the shell and
+ * calling run_command() in the child, which sets up redirection, signals and
+ * the process group itself before calling exec. The redirections are opened
+ * here first, so that process substitutions are started by the shell. A
+ * child that belongs in a cgroup moves itself there, and a placed child sets
+ * its affinity and scheduling, before exec.
+ *
+ * Returns the child's pid, or -1 if fork() fails.
+ */
+static pid_t launch_fork(const command_t *cmd, pid_t pgid, int in_fd, int out_fd) {
+    // Resolve the command in the parent so the path cache learns about it;
+    // the child then finds it in its copy of the cache.
+    if (cmd->argc > 0) {
+        path_cache_lookup(cmd->argv[0]);
+    }
+    int fds[cmd->nredirs + 1];
+    if (open_redirections(cmd, fds) == -1) {
+        errno = 0;
+        return -1;
+    }
+
+    pid_t cpid = fork();
+    if (cpid < 0) {
+        perror("fork failed.");
+        close_redirections(cmd, fds, cmd->nredirs);
+        errno = 0;
+        return -1;
+    } else if (cpid == 0) {
+        // A foreground job takes the terminal before anything can read from
+        // it; SIGTTOU is still ignored here, as in the shell
+        if (terminal != -1 && setpgid(0, pgid) == 0) {
+            tcsetpgrp(terminal, getpgrp());
+        }
+        // Writing 0 to cgroup.procs moves the writer itself
+        if (cgroup_procs != -1 && write(cgroup_procs, "0", 1) == -1) {
+            perror("cgroup.procs");
+            _exit(1);
+        }
+        if (placement != NULL && placement_apply(placement) == -1) {
+            _exit(1);
+        }
+        // Pipe ends are close-on-exec; only the copies on 0 and 1 survive exec
+        if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+            (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1)) {
+            perror("dup2");
+            _exit(1);
+        }
+        run_command_in_group(cmd, fds, pgid);
+        _exit(1);    // Only reached if run_command() failed before exec
+    }
+    close_redirections(cmd, fds, cmd->nredirs);
+    // Also set the process group from the parent so that it is in place before
+    // the shell hands the terminal to the child, whichever process runs first.
+    // EACCES just means the child has already called exec.
+    if (setpgid(cpid, pgid == 0 ? cpid : pgid) == -1 && errno != EACCES) {
+        perror("setpgid");
+    }
+    return cpid;
+}
+
+/**
+ * launch_spawn - Starts a command with posix_spawn(), so the shell's address
+ * space is never copied. The program is located through the path cache.
+ * Redirection files are opened here in the parent and installed in the child
+ * as file actions, in the order they appear; the process group and the TTY
+ * signal dispositions are set by the spawn attributes, and a foreground job
+ * takes the terminal through a file action as well.
+ *
+ * Returns the child's pid, or -1 if the command could not be started.
+ */
+static pid_t launch_spawn(const command_t *cmd, pid_t pgid, int pipe_in, int pipe_out) {
+    char **args = cmd->argv;
+    if (cmd->argc == 0) {
+        fprintf(stderr, "Error: No command to execute.\n");
+        errno = 0;
+        return -1;
+    }
+    int fds[cmd->nredirs + 1];
+    if (open_redirections(cmd, fds) == -1) {
+        errno = 0;
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    // A foreground job takes the terminal before anything can read from it.
+    // This comes first, while the terminal is still on its descriptor, and
+    // runs with every signal blocked, so SIGTTOU does not stop the child.
+    if (terminal != -1) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, terminal);
+    }
+    // Pipe ends are close-on-exec; only the copies on 0 and 1 survive exec
+    if (pipe_in != -1) {
+        posix_spawn_file_actions_adddup2(&actions, pipe_in, STDIN_FILENO);
+    }
+    if (pipe_out != -1) {
+        posix_spawn_file_actions_adddup2(&actions, pipe_out, STDOUT_FILENO);
+    }
+    // The opened files are close-on-exec as well
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        int source = fds[i] != -1 ? fds[i] : cmd->redirs[i].dup_fd;
+        posix_spawn_file_actions_adddup2(&actions, source, cmd->redirs[i].fd);
+    }
+
+    // The shell ignores SIGTTIN and SIGTTOU, and ignored dispositions survive
+    // exec, so they have to be reset explicitly.
+    sigset_t default_sigs;
+    sigemptyset(&default_sigs);
+    sigaddset(&default_sigs, SIGTTIN);
+    sigaddset(&default_sigs, SIGTTOU);
+    posix_spawnattr_setsigdefault(&attr, &default_sigs);
+    posix_spawnattr_setpgroup(&attr, pgid);    // 0 makes the child a new group leader
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_USEVFORK);
+
+    // The shell's own envp, unless the command has assignments of its own
+    char **envp = cmd->nassigns == 0 ? env_envp() : env_envp_with(cmd->assigns, cmd->nassigns);
+    pid_t cpid;
+    int err = ENOENT;
+    const char *path = path_cache_lookup(args[0]);
+    if (path != NULL) {
+        err = posix_spawn(&cpid, path, &actions, &attr, args, envp);
+        if (err == ENOENT && path != args[0]) {
+            // The cached file has gone away; search PATH again and retry once
+            path_cache_forget(args[0]);
+            if ((path = path_cache_lookup(args[0])) != NULL) {
+                err = posix_spawn(&cpid, path, &actions, &attr, args, envp);
+            }
+        }
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close_redirections(cmd, fds, cmd->nredirs);
+    if (err != 0) {
+        // A child that failed to exec may have taken the terminal already; a
+        // later stage leaves it with the job, which the shell waits for
+        if (terminal != -1 && pgid == 0) {
+            tcsetpgrp(terminal, getpgrp());
+        }
+        fprintf(stderr, "exec: %s\n", strerror(err));
+        errno = err;
+        return -1;
+    }
+    return cpid;
+}
+
+/**
+ * launch_server - Starts a command through the fork server. The redirection
+ * files are opened here and sent along with the standard descriptors; the
+ * child installs them in the order they appear, just like the file actions
+ * of launch_spawn().
+ *
+ * Returns the child's pid, or -1 if the command could not be started.
+ */
+static pid_t launch_server(const command_t *cmd, pid_t pgid, int pipe_in, int pipe_out) {
+    char **args = cmd->argv;
+    if (cmd->argc == 0) {
+        fprintf(stderr, "Error: No command to execute.\n");
+        errno = 0;
+        return -1;
+    }
+    int fds[cmd->nredirs + 1];
+    if (open_redirections(cmd, fds) == -1) {
+        errno = 0;
+        return -1;
+    }
+
+    // The child starts with the server's descriptors, so all three standard
+    // ones are sent, followed by the opened files
+    int sent[cmd->nredirs + 3];
+    fork_server_fd_t moves[cmd->nredirs + 3];
+    sent[0] = pipe_in != -1 ? pipe_in : STDIN_FILENO;
+    sent[1] = pipe_out != -1 ? pipe_out : STDOUT_FILENO;
+    sent[2] = STDERR_FILENO;
+    unsigned nsent = 3, nmoves = 0;
+    for (int i = 0; i < 3; i++) {
+        moves[nmoves++] = (fork_server_fd_t){.target = i, .source = i, .passed = 1};
+    }
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        moves[nmoves].target = cmd->redirs[i].fd;
+        moves[nmoves].passed = fds[i] != -1;
+        moves[nmoves].source = fds[i] != -1 ? (int) nsent : cmd->redirs[i].dup_fd;
+        if (fds[i] != -1) {
+            sent[nsent++] = fds[i];
+        }
+        nmoves++;
+    }
+
+    // The shell's own envp, unless the command has assignments of its own
+    char **envp = env_envp();
+    unsigned generation = env_generation();
+    if (cmd->nassigns > 0) {
+        envp = env_envp_with(cmd->assigns, cmd->nassigns);
+        generation = 0;
+    }
+    pid_t cpid = -1;
+    int err = ENOENT;
+    const char *path = path_cache_lookup(args[0]);
+    if (path != NULL) {
+        cpid = fork_server_spawn(path, args, envp, generation, sent, nsent, moves, nmoves, pgid,
+                                 terminal);
+        err = cpid == -1 ? errno : 0;
+        if (err == ENOENT && path != args[0]) {
+            // The cached file has gone away; search PATH again and retry once
+            path_cache_forget(args[0]);
+            if ((path = path_cache_lookup(args[0])) != NULL) {
+                cpid = fork_server_spawn(path, args, envp, generation, sent, nsent, moves, nmoves,
+                                         pgid, terminal);
+                err = cpid == -1 ? errno : 0;
+            }
+        }
+    }
+    close_redirections(cmd, fds, cmd->nredirs);
+    if (err != 0) {
+        fprintf(stderr, "exec: %s\n", strerror(err));
+        errno = err;
+        return -1;
+    }
+    return cpid;
+}
+
+pid_t launch_command(const command_t *cmd, pid_t pgid, int in_fd, int out_fd) {
+    // Anything the shell has printed must reach the output before the child's
+    // own output does; in batch mode stdout is fully buffered.
+    fflush(stdout);
+    uint64_t start = stats_now();
+    // posix_spawn() can neither place the child in a cgroup nor set its
+    // affinity or niceness before it runs, so processes that need that are
+    // forked. CPUs reserved for the shell are left by both.
+    int entered = placement_enter_job_cpus();
+    pid_t pid;
+    if (backend == LAUNCH_FORK || cgroup_procs != -1 || placement != NULL) {
+        pid = launch_fork(cmd, pgid, in_fd, out_fd);
+    } else if (backend == LAUNCH_SERVER) {
+        pid = launch_server(cmd, pgid, in_fd, out_fd);
+    } else {
+        pid = launch_spawn(cmd, pgid, in_fd, out_fd);
+    }
+    placement_leave_job_cpus(entered);
+    stats_record(STAT_LAUNCH_TIME, start);
+    stats_count(pid == -1 ? STAT_LAUNCH_FAILURES : STAT_LAUNCHES);
+    return pid;
+}
+
+/**
+ * remember_substitution - Records a process started for a process
+ * substitution so that launch_reap_substitutions() can collect it.
+ */
+static void remember_substitution(pid_t pid) {
+    if (nsubstitution_pids == substitution_pids_capacity) {
+        unsigned capacity = substitution_pids_capacity == 0 ? 8 : 2 * substitution_pids_capacity;
+        pid_t *pids = realloc(substitution_pids, capacity * sizeof(pid_t));
+        if (pids == NULL) {
+            return;    // Left for the reaper to collect
+        }
+        substitution_pids = pids;
+        substitution_pids_capacity = capacity;
+    }
+    substitution_pids[nsubstitution_pids++] = pid;
+}
+
+int launch_substitution(const char *text) {
+    // The text is parsed (and unquoted in place) as a line of its own
+    char *copy = strdup(text);
+    if (copy == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    cmdline_t sub;
+    cmdline_init(&sub);
+    int ret = -1;
+    int pipe_fds[2] = {-1, -1};
+    if (cmdline_parse(&sub, copy) == -1) {
+        goto out;
+    }
+    if (sub.npipelines > 1 || sub.nheredocs > 0 ||
+        (sub.npipelines == 1 && (sub.pipelines[0].link != LINK_END ||
+                                 sub.pipelines[0].background || sub.pipelines[0].timed))) {
+        fprintf(stderr, "swish: a process substitution must be a single pipeline\n");
+        goto out;
+    }
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        goto out;
+    }
+
+    // The stages run in a process group of their own, like a background job
+    int saved_terminal = terminal;
+    terminal = -1;
+    const pipeline_t *pipeline = sub.npipelines == 1 ? &sub.pipelines[0] : NULL;
+    unsigned nstages = pipeline == NULL ? 0 : pipeline->ncommands;
+    pid_t pgid = 0;
+    int in_fd = -1;
+    for (unsigned s = 0; s < nstages; s++) {
+        int stage_pipe[2] = {-1, pipe_fds[1]};
+        if (s + 1 < nstages && pipe2(stage_pipe, O_CLOEXEC) == -1) {
+            perror("pipe");
+            break;
+        }
+        pid_t pid = launch_command(&pipeline->commands[s], pgid, in_fd, stage_pipe[1]);
+        if (pid != -1) {
+            pgid = pgid == 0 ? pid : pgid;
+            remember_substitution(pid);
+        }
+        pid_t helper;
+        while (fanout_take(&helper, 1) == 1) {
+            remember_substitution(helper);
+        }
+        if (in_fd != -1) {
+            close(in_fd);
+        }
+        if (stage_pipe[1] != pipe_fds[1]) {
+            close(stage_pipe[1]);
+        }
+        in_fd = stage_pipe[0];
+    }
+    if (in_fd != -1) {
+        close(in_fd);
+    }
+    close(pipe_fds[1]);
+    terminal = saved_terminal;
+    ret = pipe_fds[0];
+
+out:
+    cmdline_free(&sub);
+    free(copy);
+    return ret;
+}
+
+void launch_reap_substitutions(void) {
+    unsigned i = 0;
+    while (i < nsubstitution_pids) {
+        pid_t pid = waitpid(substitution_pids[i], NULL, WNOHANG);
+        if (pid == 0) {
+            i++;    // Still running
+        } else {
+            // Reaped now, or already by someone else (ECHILD)
+            substitution_pids[i] = substitution_pids[--nsubstitution_pids];
+        }
+    }
+}
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+
+#include "parser.h"
+#include "placement.h"
+
+typedef enum {
+    LAUNCH_SPAWN,    // posix_spawn(), which glibc runs on a vfork-style clone
+    LAUNCH_FORK,     // fork() a copy of the shell, then run_command() in the child
+    LAUNCH_SERVER,   // Ask the fork server, which must have been started (see fork_server.h)
+} launch_backend_t;
+
+/*
+ * Select the mechanism used to start external commands
+ * backend: LAUNCH_SPAWN, LAUNCH_FORK or LAUNCH_SERVER
+ */
+void launch_set_backend(launch_backend_t backend);
+
+/*
+ * Select the launch mechanism by name ("spawn", "fork" or "server")
+ * name: Name of the backend to use
+ * Returns 0 on success or -1 if the name is not recognized
+ */
+int launch_set_backend_by_name(const char *name);
+
+/*
+ * Returns the mechanism currently used to start external commands
+ */
+launch_backend_t launch_get_backend(void);
+
+/*
+ * Make the processes started from now on join a cgroup before they exec
+ * procs_fd: Descriptor of the cgroup's cgroup.procs file, or -1 to stop
+ */
+void launch_set_cgroup(int procs_fd);
+
+/*
+ * Make the processes started from now on apply a placement before they exec
+ * p: The placement, which must stay valid until it is replaced, or NULL to stop
+ */
+void launch_set_placement(const placement_t *p);
+
+/*
+ * Make the processes started from now on take over a terminal, as the
+ * foreground process group, before they exec, so that a foreground job can
+ * read it straight away instead of being stopped by SIGTTIN before the shell
+ * hands the terminal over
+ * fd: The terminal, or -1 to stop
+ */
+void launch_set_terminal(int fd);
+
+/*
+ * Start an external command in a new child process, including redirections
+ * The child has the default dispositions for SIGTTIN and SIGTTOU, just as
+ * run_command() sets up
+ * cmd: The command to run (e.g., "wc -l < in.txt")
+ * pgid: Process group for the child to join, or 0 to make it the leader of a
+ *       new group
+ * in_fd: Descriptor to use as the child's standard input, or -1 to inherit
+ *        the shell's; the command's own redirections are applied after it
+ * out_fd: Descriptor to use as the child's standard output, or -1 to inherit
+ *         the shell's; the command's own redirections are applied after it
+ * Returns the child's pid on success or -1 on error, in which case an
+ * error message has already been printed and errno holds the reason the
+ * program could not be executed (e.g., ENOENT), or 0 if setting up the
+ * command (such as opening a redirection file) failed
+ */
+pid_t launch_command(const command_t *cmd, pid_t pgid, int in_fd, int out_fd);
+
+/*
+ * Start the pipeline of a process substitution, <(pipeline)
+ * Its processes run in a new process group and are not tracked as a job;
+ * launch_reap_substitutions() collects them once they exit
+ * text: The pipeline, as written between the parentheses
+ * Returns the read end of a pipe (close-on-exec) that carries the output of
+ * the pipeline, or -1 on error, which has already been reported
+ */
+int launch_substitution(const char *text);
+
+/*
+ * Collect the processes of process substitutions that have exited, without
+ * blocking
+ */
+void launch_reap_substitutions(void);
+
+#endif    // LAUNCH_H
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "line_reader.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TTY_BLOCK 4096
+#define FILE_BLOCK (64 * 1024)
+
+int line_reader_init(line_reader_t *reader, int fd) {
+    reader->fd = fd;
+    reader->block = isatty(fd) ? TTY_BLOCK : FILE_BLOCK;
+    reader->capacity = reader->block + 1;    // Room for a terminating '\0'
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    if ((reader->buf = malloc(reader->capacity)) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+int line_reader_init_string(line_reader_t *reader, const char *text) {
+    size_t len = strlen(text);
+    reader->fd = -1;
+    reader->block = FILE_BLOCK;
+    reader->capacity = len + 1;
+    reader->start = 0;
+    reader->end = len;
+    reader->eof = 1;    // Nothing more will ever be read
+    if ((reader->buf = malloc(reader->capacity)) == NULL) {
+        return -1;
+    }
+    memcpy(reader->buf, text, len);
+    return 0;
+}
+
+/*
+ * Make room for at least one block after the buffered data, moving the
+ * unread bytes to the front or growing the buffer as needed
+ */
+static int make_room(line_reader_t *reader) {
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    if (reader->capacity - reader->end < reader->block + 1) {
+        size_t new_capacity = reader->capacity * 2;
+        while (new_capacity - reader->end < reader->block + 1) {
+            new_capacity *= 2;
+        }
+        char *new_buf = realloc(reader->buf, new_capacity);
+        if (new_buf == NULL) {
+            return -1;
+        }
+        reader->buf = new_buf;
+        reader->capacity = new_capacity;
+    }
+    return 0;
+}
+
+char *line_reader_next(line_reader_t *reader, size_t *len) {
+    size_t scanned = reader->start;    // Bytes already known not to be '\n'
+    while (1) {
+        char *newline = memchr(reader->buf + scanned, '\n', reader->end - scanned);
+        if (newline != NULL) {
+            char *line = reader->buf + reader->start;
+            *newline = '\0';
+            if (len != NULL) {
+                *len = newline - line;
+            }
+            reader->start = newline - reader->buf + 1;
+            return line;
+        }
+        if (reader->eof) {
+            if (reader->start == reader->end) {
+                return NULL;
+            }
+            // Last line of the input has no trailing newline
+            char *line = reader->buf + reader->start;
+            reader->buf[reader->end] = '\0';
+            if (len != NULL) {
+                *len = reader->end - reader->start;
+            }
+            reader->start = reader->end;
+            return line;
+        }
+
+        if (make_room(reader) == -1) {
+            perror("line_reader");
+            return NULL;
+        }
+        scanned = reader->end;    // Everything buffered so far has been searched
+        ssize_t n = read(reader->fd, reader->buf + reader->end, reader->block);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            return NULL;
+        }
+        if (n == 0) {
+            reader->eof = 1;
+        }
+        reader->end += n;
+    }
+}
+
+int line_reader_at_end(line_reader_t *reader) {
+    while (!reader->eof && reader->start == reader->end) {
+        // Only the free space after the buffered data is read into, so that
+        // the last line returned stays valid
+        size_t room = reader->capacity - reader->end - 1;
+        if (room == 0) {
+            return 0;
+        }
+        ssize_t n = read(reader->fd, reader->buf + reader->end, room);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            return 0;    // Reported by the next line_reader_next()
+        } else if (n == 0) {
+            reader->eof = 1;
+        }
+        reader->end += n;
+    }
+    return reader->eof && reader->start == reader->end;
+}
+
+void line_reader_free(line_reader_t *reader) {
+    free(reader->buf);
+    reader->buf = NULL;
+    reader->capacity = 0;
+    reader->start = reader->end = 0;
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stddef.h>
+
+/*
+ * Reads lines of any length from a file descriptor into one buffer that is
+ * reused for every line. Input that is not a terminal (a script or a pipe) is
+ * read in large blocks, so many lines are returned per read() call; a
+ * terminal returns one line per read() anyway. Because of this read-ahead, a
+ * command run from a redirected script cannot read the script's later lines
+ * from its own standard input.
+ */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t capacity;
+    size_t start;    // Offset of the first byte not yet returned
+    size_t end;      // Offset just past the last byte read
+    size_t block;    // Bytes requested per read()
+    int eof;
+} line_reader_t;
+
+/*
+ * Initialize a line reader
+ * reader: Pointer to the reader to initialize
+ * fd: Descriptor to read from; the reader does not close it
+ * Returns 0 on success or -1 on error
+ */
+int line_reader_init(line_reader_t *reader, int fd);
+
+/*
+ * Initialize a line reader that returns the lines of a string, such as the
+ * commands given with 'swish -c'
+ * reader: Pointer to the reader to initialize
+ * text: The lines to return; the reader keeps its own copy
+ * Returns 0 on success or -1 on error
+ */
+int line_reader_init_string(line_reader_t *reader, const char *text);
+
+/*
+ * Read the next line
+ * reader: Pointer to the reader
+ * len: If not NULL, set to the length of the line
+ * Returns the line without its trailing newline, terminated by '\0', or NULL
+ * at end of input or on a read error. The line lives in the reader's buffer
+ * and may be modified by the caller; it stays valid until the next call.
+ * A final line without a trailing newline is returned as a normal line.
+ */
+char *line_reader_next(line_reader_t *reader, size_t *len);
+
+/*
+ * Check whether every line has been read, reading ahead if need be
+ * reader: Pointer to the reader
+ * Returns 1 at end of input, or 0 if there may be more lines (it also
+ * answers 0 when telling would mean moving the line returned last)
+ */
+int line_reader_at_end(line_reader_t *reader);
+
+/*
+ * Free the memory held by a line reader
+ * reader: Pointer to the reader to free
+ */
+void line_reader_free(line_reader_t *reader);
+
+#endif    // LINE_READER_H
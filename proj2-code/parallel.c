@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "parallel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/pidfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "launch.h"
+#include "line_reader.h"
+#include "parser.h"
+#include "placement.h"
+
+#define USAGE "parallel: usage: parallel [-j N] [-a FILE] [--spread] command [args...]\n"
+#define POLL_MS 10    // How often commands without a pidfd are checked for
+
+/*
+ * Build the command for one input line in 'cmd': the template tokens with
+ * every "{}" replaced by the line, or the line appended if there is no "{}"
+ */
+static int build_command(strvec_t *cmd, strvec_t *tokens, unsigned first, char *line) {
+    strvec_clear(cmd);
+    int substituted = 0;
+    for (unsigned i = first; i < tokens->length; i++) {
+        const char *arg = tokens->data[i];
+        if (strcmp(arg, "{}") == 0) {
+            arg = line;
+            substituted = 1;
+        }
+        if (strvec_add(cmd, arg) != 0) {
+            return -1;
+        }
+    }
+    if (!substituted && strvec_add(cmd, line) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Parse the value of -j; returns the limit or 0 if it is not a positive number
+ */
+static long parse_limit(const char *s) {
+    char *end;
+    errno = 0;
+    long n = strtol(s, &end, 10);
+    if (errno != 0 || end == s || *end != '\0' || n <= 0) {
+        return 0;
+    }
+    return n;
+}
+
+/*
+ * Wait until at least one of the commands may have exited: one of their
+ * pidfds is readable, or, with commands that have none, a short while has
+ * passed. Returns 0, or -1 if poll() fails.
+ */
+static int wait_for_exit(const int *pidfds, long running) {
+    struct pollfd fds[running];
+    int timeout = -1;
+    for (long i = 0; i < running; i++) {
+        fds[i].fd = pidfds[i];
+        fds[i].events = POLLIN;
+        if (pidfds[i] == -1) {
+            timeout = POLL_MS;
+        }
+    }
+    if (poll(fds, running, timeout) == -1 && errno != EINTR) {
+        perror("poll");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Pick the CPU for the next command in --spread mode: the one with the fewest
+ * of our commands on it, looking from 'next' on so that ties go round-robin
+ */
+static unsigned pick_cpu(const unsigned *load, unsigned ncpus, unsigned *next) {
+    unsigned best = *next % ncpus;
+    for (unsigned k = 1; k < ncpus; k++) {
+        unsigned c = (*next + k) % ncpus;
+        if (load[c] < load[best]) {
+            best = c;
+        }
+    }
+    *next = best + 1;
+    return best;
+}
+
+int parallel_builtin(strvec_t *tokens, job_list_t *jobs) {
+    long max_running = sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_running <= 0) {
+        max_running = 1;
+    }
+    const char *arg_file = NULL;
+    int spread = 0;
+    unsigned first = 1;    // Index of the command's first token
+    while (first < tokens->length && tokens->data[first][0] == '-') {
+        const char *opt = tokens->data[first];
+        const char *value = strvec_get(tokens, first + 1);
+        if (strcmp(opt, "--spread") == 0) {
+            spread = 1;
+            first++;
+            continue;
+        }
+        if (strcmp(opt, "-j") == 0 && value != NULL) {
+            if ((max_running = parse_limit(value)) == 0) {
+                fprintf(stderr, "parallel: -j: invalid job limit '%s'\n", value);
+                return -1;
+            }
+        } else if (strcmp(opt, "-a") == 0 && value != NULL) {
+            arg_file = value;
+        } else {
+            fprintf(stderr, USAGE);
+            return -1;
+        }
+        first += 2;
+    }
+    if (first == tokens->length) {
+        fprintf(stderr, USAGE);
+        return -1;
+    }
+
+    int in_fd = STDIN_FILENO;
+    if (arg_file != NULL && (in_fd = open(arg_file, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror(arg_file);
+        return -1;
+    }
+    // The commands must not compete with us (or with each other) for the input
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    pid_t *children = malloc(max_running * sizeof(pid_t));
+    int *child_pidfds = malloc(max_running * sizeof(int));    // -1 without pidfd_open()
+    unsigned *child_cpus = malloc(max_running * sizeof(unsigned));    // With --spread
+    int cpus[CPU_SETSIZE];
+    unsigned ncpus = spread ? placement_job_cpus(cpus) : 0;
+    unsigned *load = calloc(ncpus + 1, sizeof(unsigned));    // Commands on each CPU
+    unsigned next_cpu = 0;
+    line_reader_t input;
+    strvec_t cmd;
+    if (null_fd == -1 || children == NULL || child_pidfds == NULL || child_cpus == NULL ||
+        load == NULL || line_reader_init(&input, in_fd) != 0) {
+        perror("parallel");
+        if (null_fd != -1) {
+            close(null_fd);
+        }
+        if (in_fd != STDIN_FILENO) {
+            close(in_fd);
+        }
+        free(children);
+        free(child_pidfds);
+        free(child_cpus);
+        free(load);
+        return -1;
+    }
+    strvec_init(&cmd);
+    placement_t pin;
+    placement_init(&pin);
+    pin.has_cpus = 1;
+
+    unsigned started = 0, failed = 0;
+    long running = 0;
+    int ret = 0, eof = 0;
+    while (!eof || running > 0) {
+        // Fill every free slot with the command for the next line
+        while (!eof && running < max_running) {
+            char *line = line_reader_next(&input, NULL);
+            if (line == NULL) {
+                eof = 1;
+                break;
+            }
+            if (line[0] == '\0') {
+                continue;
+            }
+            if (build_command(&cmd, tokens, first, line) != 0) {
+                eof = 1;
+                ret = -1;
+                break;
+            }
+            started++;
+            char *argv[cmd.length + 1];
+            memcpy(argv, cmd.data, cmd.length * sizeof(char *));
+            argv[cmd.length] = NULL;
+            command_t command = {.argv = argv, .argc = cmd.length};
+            unsigned cpu = 0;
+            if (ncpus > 0) {
+                cpu = pick_cpu(load, ncpus, &next_cpu);
+                CPU_ZERO(&pin.cpus);
+                CPU_SET(cpus[cpu], &pin.cpus);
+                launch_set_placement(&pin);
+            }
+            pid_t pid = launch_command(&command, 0, null_fd, -1);
+            launch_set_placement(NULL);
+            if (pid == -1) {
+                failed++;
+                continue;
+            }
+            load[cpu]++;
+            if (job_list_add(jobs, pid, cmd.data[0], BACKGROUND) == -1) {
+                fprintf(stderr, "Failed to add job to job list\n");
+            }
+            child_cpus[running] = cpu;
+            child_pidfds[running] = pidfd_open(pid, 0);
+            children[running++] = pid;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        // Reap whichever of our commands have exited, and only those: other
+        // children of the shell (background jobs, fanout helpers, process
+        // substitutions) are left to whatever waits for them
+        if (wait_for_exit(child_pidfds, running) == -1) {
+            ret = -1;
+            break;
+        }
+        for (long i = running - 1; i >= 0; i--) {
+            int status;
+            struct rusage usage;
+            pid_t pid = wait4(children[i], &status, WNOHANG, &usage);
+            if (pid == 0 || (pid == -1 && errno == EINTR)) {
+                continue;
+            }
+            job_t *job = job_list_find_pid(jobs, children[i]);
+            if (pid == -1) {
+                perror("wait4");    // Counted as a failure
+            } else if (job != NULL) {
+                job_update_proc(job, pid, status, &usage);
+            }
+            if (job != NULL) {
+                job_list_remove(jobs, job_list_index(jobs, job));
+            }
+            if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                failed++;
+            }
+            if (child_pidfds[i] != -1) {
+                close(child_pidfds[i]);
+            }
+            load[child_cpus[i]]--;
+            running--;
+            children[i] = children[running];
+            child_pidfds[i] = child_pidfds[running];
+            child_cpus[i] = child_cpus[running];
+        }
+    }
+    for (long i = 0; i < running; i++) {
+        if (child_pidfds[i] != -1) {
+            close(child_pidfds[i]);    // Left running after an error
+        }
+    }
+
+    printf("parallel: %u jobs, %u succeeded, %u failed\n", started, started - failed, failed);
+    strvec_free(&cmd);
+    line_reader_free(&input);
+    free(children);
+    free(child_pidfds);
+    free(child_cpus);
+    free(load);
+    close(null_fd);
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
+    return ret == -1 ? -1 : (int) failed;
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "job_list.h"
+#include "string_vector.h"
+
+/*
+ * The 'parallel' builtin runs one command per line of input, keeping at most
+ * a fixed number of them running at once, in the style of 'xargs -P' and GNU
+ * parallel:
+ *
+ *   parallel [-j N] [-a FILE] [--spread] command [args...]
+ *
+ * Lines are read from FILE, or from standard input without -a. Each line
+ * replaces every "{}" argument of the command, or is appended as its last
+ * argument if there is none. -j defaults to the number of online CPUs.
+ * Every command is started as a background job in the job list and removed
+ * from it once it has been reaped; the commands read from /dev/null. Only
+ * these commands are waited for, so other jobs that finish meanwhile are
+ * left for 'wait-for', 'jobs' and the notices at the prompt.
+ *
+ * A script read by the shell from its standard input cannot feed 'parallel'
+ * the lines that follow it, since the shell has already read them ahead (see
+ * line_reader.h); scripts name the input with -a FILE or a redirection.
+ *
+ * With --spread, each command is pinned to one of the CPUs that jobs may use
+ * (see placement.h), the one running the fewest of the other commands, in
+ * round-robin order; with -j at most the number of CPUs, every command gets
+ * a core to itself instead of the kernel scheduler's choice.
+ */
+
+/*
+ * Run the 'parallel' builtin and print a summary line once every command has
+ * finished
+ * tokens: Tokens from the command typed in by the user
+ * jobs: The list of current jobs for the shell
+ * Returns the number of commands that failed (exited with a nonzero status,
+ * were killed by a signal or could not be started), or -1 on error
+ */
+int parallel_builtin(strvec_t *tokens, job_list_t *jobs);
+
+#endif    // PARALLEL_H
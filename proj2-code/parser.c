@@ -0,0 +1,1078 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "env.h"
+#include "swish_funcs.h"
+#include "wildcard.h"
+
+#define INITIAL_CAPACITY 8
+#define MAX_REDIR_FD 9    // Highest descriptor a redirection may name, as POSIX requires
+#define PROCSUB_FD 63     // Descriptor of a command's first process substitution, as in bash
+#define MAX_PROCSUBS 16   // Process substitutions per command; they count down from PROCSUB_FD
+
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,
+    TOK_AMP,
+    TOK_SEMI,
+    TOK_AND,
+    TOK_OR,
+    TOK_REDIR,
+    TOK_PROCSUB,
+    TOK_END,
+} token_kind_t;
+
+typedef struct {
+    token_kind_t kind;
+    const char *text;    // The word, or the operator as written (for error messages)
+    char *word;          // TOK_WORD: the unquoted word; TOK_PROCSUB: the text inside <( )
+    int quoted;          // TOK_WORD: nonzero if any part of it was quoted or escaped
+    int expanded;        // TOK_WORD: nonzero if a variable was expanded in it
+    int assignment;      // TOK_WORD: nonzero if it starts with an unquoted NAME=
+    int glob;            // TOK_WORD: nonzero if it has an unquoted *, ? or [
+    int blank_after;     // TOK_WORD: nonzero if a blank ended it
+    unsigned nfields;    // TOK_WORD: words in line->fields that come before this one
+    redir_kind_t redir;  // TOK_REDIR
+    int fd;              // TOK_REDIR: descriptor redirected, or -1 for both stdout and stderr
+    int heredoc;         // TOK_REDIR: 1 for <<, 2 for <<-, otherwise 0
+} token_t;
+
+typedef struct {
+    char *p;      // Next character to examine
+    char held;    // The character at p, if the '\0' ending the previous word overwrote it
+    cmdline_t *line;
+} lexer_t;
+
+// A word being unquoted: in place, until an expansion makes it longer than
+// the text it came from and it moves to the scratch buffer
+typedef struct {
+    char *start;    // Start of the word in the line
+    char *w;        // Where its next character goes while it is in place
+    size_t len;     // Its length in the scratch buffer once it has moved there
+    int moved;
+    int kept;       // Has a quoted part, so it is a word even if it is empty
+    int split;      // Ends at the next character put into it (output of $(...) was split)
+    int assignment; // A NAME=value word, in which the output of $(...) is not split
+} word_t;
+
+void cmdline_init(cmdline_t *line) {
+    memset(line, 0, sizeof(cmdline_t));
+    line->matches.arena = &line->arena;    // Their arrays are allocated on first use
+    line->fields.arena = &line->arena;
+}
+
+void cmdline_free(cmdline_t *line) {
+    free(line->pipelines);
+    free(line->commands);
+    free(line->words);
+    free(line->redirs);
+    free(line->assigns);
+    free(line->scratch);
+    free(line->doc);
+    free(line->literals);
+    free(line->rest);
+    free(line->copy);
+    strvec_free(&line->matches);
+    strvec_free(&line->fields);
+    capture_free(&line->output);
+    strvec_arena_free(&line->arena);
+    cmdline_init(line);
+}
+
+/*
+ * Make room for one more element in one of the line's arrays
+ */
+static int reserve(void **array, unsigned *capacity, unsigned length, size_t size) {
+    if (length < *capacity) {
+        return 0;
+    }
+    unsigned new_capacity = *capacity == 0 ? INITIAL_CAPACITY : 2 * *capacity;
+    void *new_array = realloc(*array, new_capacity * size);
+    if (new_array == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Append to a buffer that grows as needed, keeping room for a '\0'
+ */
+static int buffer_append(char **buf, size_t *capacity, size_t *len, const char *s, size_t n) {
+    if (*len + n + 1 > *capacity) {
+        size_t new_capacity = *capacity == 0 ? 256 : *capacity;
+        while (new_capacity < *len + n + 1) {
+            new_capacity *= 2;
+        }
+        char *new_buf = realloc(*buf, new_capacity);
+        if (new_buf == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        *buf = new_buf;
+        *capacity = new_capacity;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    return 0;
+}
+
+/*
+ * Append to the scratch buffer, in which strings are put together before
+ * they are copied into the arena
+ */
+static int scratch_append(cmdline_t *line, size_t *len, const char *s, size_t n) {
+    return buffer_append(&line->scratch, &line->scratch_capacity, len, s, n);
+}
+
+/*
+ * Copy a string into the line's arena
+ * Returns the copy, or NULL on error
+ */
+static char *arena_copy(cmdline_t *line, const char *s, size_t n) {
+    char *copy = strvec_arena_strndup(&line->arena, s, n);
+    if (copy == NULL) {
+        perror("malloc");
+    }
+    return copy;
+}
+
+// --- Lexer ---
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static int is_operator_char(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+static char peek(const lexer_t *lx, unsigned ahead) {
+    return ahead == 0 && lx->held != '\0' ? lx->held : lx->p[ahead];
+}
+
+static void advance(lexer_t *lx, unsigned n) {
+    lx->held = '\0';
+    lx->p += n;
+}
+
+static int all_digits(const char *s) {
+    if (*s == '\0') {
+        return 0;
+    }
+    for (; *s != '\0'; s++) {
+        if (*s < '0' || *s > '9') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Lex a redirection or control operator; 'fd' is the descriptor number
+ * written right before it, or -1 if there was none
+ */
+static void lex_operator(lexer_t *lx, token_t *tok, int fd) {
+    char c = peek(lx, 0), next = peek(lx, 1);
+    tok->kind = TOK_REDIR;
+    tok->heredoc = 0;
+    if (c == '|') {
+        tok->kind = next == '|' ? TOK_OR : TOK_PIPE;
+        tok->text = next == '|' ? "||" : "|";
+    } else if (c == ';') {
+        tok->kind = TOK_SEMI;
+        tok->text = ";";
+    } else if (c == '&' && next == '>') {
+        tok->redir = lx->p[2] == '>' ? REDIR_APPEND : REDIR_WRITE;
+        tok->text = lx->p[2] == '>' ? "&>>" : "&>";
+        tok->fd = -1;
+    } else if (c == '&') {
+        tok->kind = next == '&' ? TOK_AND : TOK_AMP;
+        tok->text = next == '&' ? "&&" : "&";
+    } else if (c == '<' && next == '<') {
+        tok->redir = REDIR_STRING;
+        tok->text = lx->p[2] == '<' ? "<<<" : lx->p[2] == '-' ? "<<-" : "<<";
+        tok->heredoc = lx->p[2] == '<' ? 0 : lx->p[2] == '-' ? 2 : 1;
+        tok->fd = fd == -1 ? 0 : fd;
+    } else if (c == '<') {
+        tok->redir = next == '&' ? REDIR_DUP : REDIR_READ;
+        tok->text = next == '&' ? "<&" : "<";
+        tok->fd = fd == -1 ? 0 : fd;
+    } else {
+        tok->redir = next == '>' ? REDIR_APPEND : next == '&' ? REDIR_DUP : REDIR_WRITE;
+        tok->text = next == '>' ? ">>" : next == '&' ? ">&" : ">";
+        tok->fd = fd == -1 ? 1 : fd;
+    }
+    advance(lx, strlen(tok->text));
+}
+
+/*
+ * Move what has been unquoted of a word so far to the scratch buffer
+ */
+static int move_word(cmdline_t *line, word_t *word) {
+    if (word->moved) {
+        return 0;
+    }
+    word->len = 0;
+    if (scratch_append(line, &word->len, word->start, word->w - word->start) == -1) {
+        return -1;
+    }
+    word->moved = 1;
+    return 0;
+}
+
+/*
+ * End the word where the output of a substitution was split, and start the
+ * next one; the word has moved to the scratch buffer
+ */
+static int split_word(cmdline_t *line, word_t *word) {
+    char *field = arena_copy(line, line->scratch, word->len);
+    if (field == NULL || strvec_add_ref(&line->fields, field) == -1) {
+        return -1;
+    }
+    word->len = 0;
+    word->kept = 0;
+    word->split = 0;
+    line->nliterals = 0;
+    return 0;
+}
+
+static int put(cmdline_t *line, word_t *word, const char *s, size_t n) {
+    if (word->split && n > 0 && split_word(line, word) == -1) {
+        return -1;
+    }
+    if (word->moved) {
+        return scratch_append(line, &word->len, s, n);
+    }
+    memmove(word->w, s, n);    // The word never overtakes the text it is read from
+    word->w += n;
+    return 0;
+}
+
+/*
+ * Put quoted characters into the word, remembering where the ones that
+ * would otherwise be pattern characters went
+ */
+static int put_quoted(cmdline_t *line, word_t *word, const char *s, size_t n) {
+    if (word->split && n > 0 && split_word(line, word) == -1) {
+        return -1;
+    }
+    word->kept = 1;
+    for (size_t i = 0; i < n; i++) {
+        if (strchr("*?[\\", s[i]) == NULL) {
+            continue;
+        }
+        if (reserve((void **) &line->literals, &line->literals_capacity, line->nliterals,
+                    sizeof(unsigned)) == -1) {
+            return -1;
+        }
+        size_t at = word->moved ? word->len : (size_t) (word->w - word->start);
+        line->literals[line->nliterals++] = (unsigned) (at + i);
+    }
+    return put(line, word, s, n);
+}
+
+/*
+ * Find the ')' that closes a parenthesis, skipping quoted text
+ * p: The first character after the '('
+ * Returns a pointer to the ')', or NULL if there is none
+ */
+static char *find_close_paren(char *p) {
+    unsigned depth = 1;
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '\'' && strchr(p + 1, '\'') != NULL) {
+            p = strchr(p + 1, '\'');
+        } else if (*p == '"') {
+            for (p++; *p != '\0' && *p != '"'; p++) {
+                if (*p == '\\' && p[1] != '\0') {
+                    p++;
+                }
+            }
+            if (*p == '\0') {
+                return NULL;
+            }
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int is_field_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/*
+ * Run the command of the $(...) at 'r' and put its output into the word,
+ * splitting it into several words unless it is quoted
+ * Returns a pointer past the ')', or NULL on error
+ */
+static char *substitute(cmdline_t *line, word_t *word, char *r, int split, int *expanded) {
+    char *close = find_close_paren(r + 2);
+    if (close == NULL) {
+        fprintf(stderr, "swish: unexpected end of line while looking for matching `)'\n");
+        return NULL;
+    }
+    if (line->skip) {
+        // The pipeline will not run, so neither does the command
+        *expanded = 1;
+        return move_word(line, word) == -1 ? NULL : close + 1;
+    }
+    char *text = arena_copy(line, r + 2, close - (r + 2));
+    if (text == NULL || move_word(line, word) == -1 ||
+        capture_command(text, &line->output) == -1) {
+        return NULL;
+    }
+    const char *out = line->output.data;
+    size_t len = line->output.len;
+    while (len > 0 && out[len - 1] == '\n') {
+        len--;
+    }
+    if (!split) {
+        if (put_quoted(line, word, out, len) == -1) {
+            return NULL;
+        }
+    } else {
+        for (size_t i = 0; i < len;) {
+            size_t n = 0;
+            while (i + n < len && !is_field_separator(out[i + n])) {
+                n++;
+            }
+            if (n > 0) {
+                if (put_quoted(line, word, out + i, n) == -1) {
+                    return NULL;
+                }
+                i += n;
+            } else {
+                // A word ends here if it has begun
+                word->split |= word->len > 0 || word->kept;
+                i++;
+            }
+        }
+    }
+    *expanded = 1;
+    return close + 1;
+}
+
+/*
+ * Expand the variable named after the '$' at 'r' into the word; the value
+ * of an unquoted variable may hold pattern characters, setting *glob
+ * Returns a pointer past the name, or NULL if ${ is not closed; a '$' not
+ * followed by a name is kept as it is
+ */
+static char *expand(cmdline_t *line, word_t *word, char *r, int quoted, int *expanded,
+                    int *glob) {
+    if (r[1] == '(') {
+        return substitute(line, word, r, !quoted && !word->assignment, expanded);
+    }
+    int braced = r[1] == '{';
+    char *name = r + 1 + braced;
+    if (*name == '?' && (!braced || name[1] == '}')) {
+        // $? is the status of the last pipeline
+        char status[16];
+        int n = snprintf(status, sizeof(status), "%d", last_status);
+        if (move_word(line, word) == -1 || put(line, word, status, n) == -1) {
+            return NULL;
+        }
+        *expanded = 1;
+        return name + 1 + braced;
+    }
+    unsigned len = env_name_length(name);
+    if (len == 0 || (braced && name[len] != '}')) {
+        if (braced) {
+            fprintf(stderr, "swish: bad substitution\n");
+            return NULL;
+        }
+        return put(line, word, r, 1) == -1 ? NULL : r + 1;
+    }
+    // What has been unquoted so far moves along with the value
+    if (move_word(line, word) == -1) {
+        return NULL;
+    }
+    const char *value = env_get(name, len);
+    if (value != NULL) {
+        if (quoted) {
+            if (put_quoted(line, word, value, strlen(value)) == -1) {
+                return NULL;
+            }
+        } else if (put(line, word, value, strlen(value)) == -1) {
+            return NULL;
+        } else if (strpbrk(value, "*?[") != NULL) {
+            *glob = 1;
+        }
+    }
+    *expanded = 1;
+    return name + len + braced;
+}
+
+/*
+ * Lex a word, removing its quotes in place and expanding $NAME and ${NAME}
+ * outside single quotes; a word with an expansion is built in the arena.
+ * The offsets of its quoted pattern characters are left in line->literals.
+ * Returns 0 on success or -1 if a quote is not closed
+ */
+static int lex_word(lexer_t *lx, token_t *tok) {
+    cmdline_t *line = lx->line;
+    char *r = lx->p;
+    word_t word = {.start = lx->p, .w = lx->p, .len = 0, .moved = 0, .kept = 0, .split = 0};
+    int quoted = 0, expanded = 0, glob = 0;
+    line->nliterals = 0;
+    strvec_clear(&line->fields);
+    unsigned name_len = env_name_length(r);
+    tok->assignment = name_len > 0 && r[name_len] == '=';
+    word.assignment = tok->assignment;
+    while (*r != '\0' && !is_blank(*r) && !is_operator_char(*r)) {
+        if (*r == '\'') {
+            char *close = strchr(r + 1, '\'');
+            if (close == NULL) {
+                fprintf(stderr, "swish: unexpected end of line while looking for matching `''\n");
+                return -1;
+            }
+            if (put_quoted(line, &word, r + 1, close - (r + 1)) == -1) {
+                return -1;
+            }
+            r = close + 1;
+            quoted = 1;
+        } else if (*r == '"') {
+            for (r++; *r != '"';) {
+                if (*r == '\0') {
+                    fprintf(stderr,
+                            "swish: unexpected end of line while looking for matching `\"'\n");
+                    return -1;
+                }
+                if (*r == '$') {
+                    if ((r = expand(line, &word, r, 1, &expanded, &glob)) == NULL) {
+                        return -1;
+                    }
+                    continue;
+                }
+                if (*r == '\\' && r[1] != '\0' && strchr("\"\\$`", r[1]) != NULL) {
+                    r++;
+                }
+                if (put_quoted(line, &word, r++, 1) == -1) {
+                    return -1;
+                }
+            }
+            r++;
+            quoted = 1;
+        } else if (*r == '$') {
+            if ((r = expand(line, &word, r, 0, &expanded, &glob)) == NULL) {
+                return -1;
+            }
+        } else if (*r == '\\' && r[1] != '\0') {
+            if (put_quoted(line, &word, r + 1, 1) == -1) {
+                return -1;
+            }
+            r += 2;
+            quoted = 1;
+        } else {
+            glob |= *r == '*' || *r == '?' || *r == '[';
+            if (put(line, &word, r++, 1) == -1) {
+                return -1;
+            }
+        }
+    }
+    tok->kind = TOK_WORD;
+    tok->quoted = quoted;
+    tok->expanded = expanded;
+    tok->glob = glob;
+    tok->nfields = line->fields.length;
+
+    char stop = *r;
+    lx->p = r;
+    if (word.moved) {
+        if ((tok->word = arena_copy(line, line->scratch, word.len)) == NULL) {
+            return -1;
+        }
+    } else {
+        tok->word = word.start;
+        *word.w = '\0';
+        if (word.w == r && stop != '\0' && !is_blank(stop)) {
+            lx->held = stop;    // The terminator went where the next operator starts
+        }
+    }
+    tok->text = tok->word;
+    tok->blank_after = is_blank(stop);
+    if (tok->blank_after) {
+        lx->p++;
+    }
+    return 0;
+}
+
+/*
+ * Lex a process substitution, from its "<(" up to the matching ")"; the
+ * text in between is left as it is, quotes included, to be parsed when the
+ * substitution runs
+ * Returns 0 on success or -1 if the parenthesis is not closed
+ */
+static int lex_procsub(lexer_t *lx, token_t *tok) {
+    char *p = find_close_paren(lx->p + 2);
+    if (p == NULL) {
+        fprintf(stderr, "swish: unexpected end of line while looking for matching `)'\n");
+        return -1;
+    }
+    *p = '\0';
+    tok->kind = TOK_PROCSUB;
+    tok->text = "<(";
+    tok->word = lx->p + 2;
+    advance(lx, p + 1 - lx->p);
+    return 0;
+}
+
+/*
+ * Read the next token
+ * Returns 0 on success or -1 on a lexical error, which has been reported
+ */
+static int next_token(lexer_t *lx, token_t *tok) {
+    while (is_blank(peek(lx, 0))) {
+        advance(lx, 1);
+    }
+    char c = peek(lx, 0);
+    if (c == '\0' || c == '#') {
+        tok->kind = TOK_END;
+        tok->text = "newline";
+        return 0;
+    }
+    if (c == '<' && peek(lx, 1) == '(') {
+        return lex_procsub(lx, tok);
+    }
+    if (is_operator_char(c)) {
+        lex_operator(lx, tok, -1);
+        return 0;
+    }
+    if (lex_word(lx, tok) == -1) {
+        return -1;
+    }
+    // An unquoted expansion to nothing is no word at all; in a pipeline that
+    // will not run, $(...) expands to nothing but stands for a word
+    if (tok->expanded && !tok->quoted && tok->word[0] == '\0' && !lx->line->skip) {
+        return next_token(lx, tok);
+    }
+    // An unquoted number right before '<' or '>', with no blank in between,
+    // names the descriptor to redirect
+    char stop = peek(lx, 0);
+    if (!tok->quoted && !tok->blank_after && tok->nfields == 0 && (stop == '<' || stop == '>') &&
+        all_digits(tok->word)) {
+        long fd = strtol(tok->word, NULL, 10);
+        if (fd > MAX_REDIR_FD) {
+            fprintf(stderr, "swish: %s: bad file descriptor\n", tok->word);
+            return -1;
+        }
+        lex_operator(lx, tok, (int) fd);
+    }
+    return 0;
+}
+
+// --- Parser ---
+
+static int syntax_error(const token_t *tok) {
+    fprintf(stderr, "swish: syntax error near unexpected token `%s'\n", tok->text);
+    return -1;
+}
+
+static int add_word(cmdline_t *line, char *word) {
+    if (reserve((void **) &line->words, &line->words_capacity, line->nwords, sizeof(char *)) ==
+        -1) {
+        return -1;
+    }
+    line->words[line->nwords++] = word;
+    return 0;
+}
+
+static int add_assignment(cmdline_t *line, char *word) {
+    if (reserve((void **) &line->assigns, &line->assigns_capacity, line->nassigns,
+                sizeof(char *)) == -1) {
+        return -1;
+    }
+    line->assigns[line->nassigns++] = word;
+    return 0;
+}
+
+/*
+ * Add a word that has unquoted pattern characters: the paths it matches, or
+ * the word itself if there are none
+ */
+static int add_pattern(cmdline_t *line, char *word) {
+    // Escape the quoted characters so that they only match themselves
+    size_t len = 0, start = 0;
+    for (unsigned i = 0; i < line->nliterals; i++) {
+        size_t at = line->literals[i];
+        if (scratch_append(line, &len, word + start, at - start) == -1 ||
+            scratch_append(line, &len, "\\", 1) == -1) {
+            return -1;
+        }
+        start = at;
+    }
+    if (scratch_append(line, &len, word + start, strlen(word + start) + 1) == -1) {
+        return -1;
+    }
+    if (line->skip || !wildcard_is_pattern(line->scratch)) {
+        return add_word(line, word);    // Such as a lone '['
+    }
+    strvec_clear(&line->matches);
+    int n = wildcard_expand(line->scratch, &line->matches);
+    if (n == -1) {
+        return -1;
+    } else if (n == 0) {
+        return add_word(line, word);
+    }
+    for (unsigned i = 0; i < line->matches.length; i++) {
+        if (add_word(line, line->matches.data[i]) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int add_redirection(cmdline_t *line, redir_kind_t kind, int fd, const char *target,
+                           int dup_fd) {
+    if (reserve((void **) &line->redirs, &line->redirs_capacity, line->nredirs,
+                sizeof(redirection_t)) == -1) {
+        return -1;
+    }
+    redirection_t *r = &line->redirs[line->nredirs++];
+    r->kind = kind;
+    r->fd = fd;
+    r->target = target;
+    r->dup_fd = dup_fd;
+    r->heredoc = 0;
+    r->expand = 0;
+    return 0;
+}
+
+/*
+ * Parse the file or descriptor that follows a redirection operator
+ */
+static int parse_redirection(cmdline_t *line, lexer_t *lx, const token_t *op, token_t *tok) {
+    if (next_token(lx, tok) == -1) {
+        return -1;
+    }
+    if (tok->kind == TOK_PROCSUB && op->redir == REDIR_READ) {
+        return add_redirection(line, REDIR_PROCSUB, op->fd, tok->word, -1);    // < <(cmd)
+    }
+    if (tok->kind != TOK_WORD) {
+        return syntax_error(tok);
+    }
+    if (tok->nfields > 0 && (op->redir != REDIR_STRING || op->heredoc)) {
+        fprintf(stderr, "swish: ambiguous redirect\n");
+        return -1;
+    }
+    if (op->redir == REDIR_STRING && op->heredoc) {
+        // The delimiter for now; the text replaces it once its lines have been read
+        if (add_redirection(line, REDIR_STRING, op->fd, tok->word, -1) == -1) {
+            return -1;
+        }
+        line->redirs[line->nredirs - 1].heredoc = op->heredoc;
+        // The lines of a pipeline that will not run are not expanded either
+        line->redirs[line->nredirs - 1].expand = !tok->quoted && !line->skip;
+        line->nheredocs++;
+        return 0;
+    }
+    if (op->redir == REDIR_STRING) {
+        // A here-string is read with a newline after it, as one word
+        size_t len = 0;
+        char *text;
+        for (unsigned i = 0; i < tok->nfields; i++) {
+            const char *field = line->fields.data[i];
+            if (scratch_append(line, &len, field, strlen(field)) == -1 ||
+                scratch_append(line, &len, " ", 1) == -1) {
+                return -1;
+            }
+        }
+        if (scratch_append(line, &len, tok->word, strlen(tok->word)) == -1 ||
+            scratch_append(line, &len, "\n", 1) == -1 ||
+            (text = arena_copy(line, line->scratch, len)) == NULL) {
+            return -1;
+        }
+        return add_redirection(line, REDIR_STRING, op->fd, text, -1);
+    }
+    if (op->redir == REDIR_DUP) {
+        if (!all_digits(tok->word) || strtol(tok->word, NULL, 10) > MAX_REDIR_FD) {
+            fprintf(stderr, "swish: %s: bad file descriptor\n", tok->word);
+            return -1;
+        }
+        return add_redirection(line, REDIR_DUP, op->fd, NULL, (int) strtol(tok->word, NULL, 10));
+    }
+    if (op->fd == -1) {
+        // &> file is the same as > file 2>&1
+        if (add_redirection(line, op->redir, 1, tok->word, -1) == -1) {
+            return -1;
+        }
+        return add_redirection(line, REDIR_DUP, 2, NULL, 1);
+    }
+    return add_redirection(line, op->redir, op->fd, tok->word, -1);
+}
+
+/*
+ * Parse one simple command, leaving the token after it in 'tok'
+ */
+static int parse_command(cmdline_t *line, lexer_t *lx, token_t *tok) {
+    if (reserve((void **) &line->commands, &line->commands_capacity, line->ncommands,
+                sizeof(command_t)) == -1) {
+        return -1;
+    }
+    command_t *cmd = &line->commands[line->ncommands++];
+    cmd->first_word = line->nwords;
+    cmd->first_redir = line->nredirs;
+    cmd->first_assign = line->nassigns;
+    unsigned nprocsubs = 0;
+    while (tok->kind == TOK_WORD || tok->kind == TOK_REDIR || tok->kind == TOK_PROCSUB) {
+        if (tok->kind == TOK_WORD && tok->assignment && line->nwords == cmd->first_word) {
+            // NAME=value before the command name
+            if (add_assignment(line, tok->word) == -1) {
+                return -1;
+            }
+        } else if (tok->kind == TOK_WORD && tok->nfields > 0) {
+            // The output of a substitution, split into words
+            for (unsigned i = 0; i < tok->nfields; i++) {
+                if (add_word(line, line->fields.data[i]) == -1) {
+                    return -1;
+                }
+            }
+            if ((tok->glob ? add_pattern(line, tok->word) : add_word(line, tok->word)) == -1) {
+                return -1;
+            }
+        } else if (tok->kind == TOK_WORD && tok->glob) {
+            if (add_pattern(line, tok->word) == -1) {
+                return -1;
+            }
+        } else if (tok->kind == TOK_WORD) {
+            if (add_word(line, tok->word) == -1) {
+                return -1;
+            }
+        } else if (tok->kind == TOK_PROCSUB) {
+            // The command gets the name of the pipe that the substitution writes to
+            if (nprocsubs == MAX_PROCSUBS) {
+                fprintf(stderr, "swish: too many process substitutions\n");
+                return -1;
+            }
+            int fd = PROCSUB_FD - (int) nprocsubs++;
+            char name[32];
+            char *word;
+            int len = snprintf(name, sizeof(name), "/dev/fd/%d", fd);
+            if ((word = arena_copy(line, name, len)) == NULL || add_word(line, word) == -1 ||
+                add_redirection(line, REDIR_PROCSUB, fd, tok->word, -1) == -1) {
+                return -1;
+            }
+        } else {
+            token_t op = *tok;
+            if (parse_redirection(line, lx, &op, tok) == -1) {
+                return -1;
+            }
+        }
+        if (next_token(lx, tok) == -1) {
+            return -1;
+        }
+    }
+    cmd->argc = line->nwords - cmd->first_word;
+    cmd->nredirs = line->nredirs - cmd->first_redir;
+    cmd->nassigns = line->nassigns - cmd->first_assign;
+    if (cmd->argc == 0 && cmd->nredirs == 0 && cmd->nassigns == 0) {
+        return syntax_error(tok);
+    }
+    return add_word(line, NULL);
+}
+
+/*
+ * Parse one pipeline with its trailing '&' and the operator linking it to
+ * the next one, leaving the token after all of that in 'tok'
+ */
+static int parse_pipeline(cmdline_t *line, lexer_t *lx, token_t *tok) {
+    if (reserve((void **) &line->pipelines, &line->pipelines_capacity, line->npipelines,
+                sizeof(pipeline_t)) == -1) {
+        return -1;
+    }
+    pipeline_t *pl = &line->pipelines[line->npipelines++];
+    memset(pl, 0, sizeof(pipeline_t));
+    pl->first_command = line->ncommands;
+    if (tok->kind == TOK_WORD && !tok->quoted && strcmp(tok->word, "time") == 0) {
+        pl->timed = 1;
+        if (next_token(lx, tok) == -1) {
+            return -1;
+        }
+    }
+    while (1) {
+        if (parse_command(line, lx, tok) == -1) {
+            return -1;
+        }
+        pl->ncommands++;
+        if (tok->kind != TOK_PIPE) {
+            break;
+        }
+        if (next_token(lx, tok) == -1) {
+            return -1;
+        }
+    }
+
+    token_kind_t op = tok->kind;
+    if (op == TOK_AMP) {
+        pl->background = 1;
+    } else if (op != TOK_SEMI && op != TOK_AND && op != TOK_OR && op != TOK_END) {
+        return syntax_error(tok);
+    }
+    // The next pipeline is not lexed yet, since expanding its words may
+    // depend on this one having run
+    while (is_blank(peek(lx, 0))) {
+        advance(lx, 1);
+    }
+    int at_end = peek(lx, 0) == '\0' || peek(lx, 0) == '#';
+    if (op == TOK_AND || op == TOK_OR) {
+        pl->link = op == TOK_AND ? LINK_AND : LINK_OR;
+        if (at_end) {
+            token_t end = {.kind = TOK_END, .text = "newline"};
+            return syntax_error(&end);    // Something must follow && and ||
+        }
+    } else {
+        pl->link = at_end ? LINK_END : LINK_SEQ;
+    }
+    return 0;
+}
+
+/*
+ * Discard everything parsed into the line before
+ */
+static void reset(cmdline_t *line) {
+    line->npipelines = 0;
+    line->ncommands = 0;
+    line->nwords = 0;
+    line->nredirs = 0;
+    line->nassigns = 0;
+    line->nheredocs = 0;
+    strvec_arena_reset(&line->arena);
+}
+
+/*
+ * Point the pipelines and commands into the line's storage once it is complete
+ */
+static void finish(cmdline_t *line) {
+    // The arrays may have moved while growing; only now can they be pointed into
+    for (unsigned c = 0; c < line->ncommands; c++) {
+        command_t *cmd = &line->commands[c];
+        cmd->argv = line->words + cmd->first_word;
+        cmd->redirs = line->redirs + cmd->first_redir;
+        cmd->assigns = line->assigns + cmd->first_assign;
+    }
+    for (unsigned p = 0; p < line->npipelines; p++) {
+        line->pipelines[p].commands = line->commands + line->pipelines[p].first_command;
+    }
+}
+
+int cmdline_parse(cmdline_t *line, char *text) {
+    lexer_t lx = {.p = text, .held = '\0', .line = line};
+    reset(line);
+    line->next = NULL;
+    token_t tok;
+    while (1) {
+        if (next_token(&lx, &tok) == -1) {
+            line->npipelines = 0;
+            return -1;
+        }
+        if (tok.kind == TOK_END) {
+            break;
+        }
+        if (parse_pipeline(line, &lx, &tok) == -1) {
+            line->npipelines = 0;
+            return -1;
+        }
+    }
+    finish(line);
+    return 0;
+}
+
+void cmdline_start(cmdline_t *line, char *text) {
+    line->next = text;
+    line->held = '\0';
+}
+
+int cmdline_check(cmdline_t *line, const char *text) {
+    size_t len = strlen(text);
+    if (len + 1 > line->copy_capacity) {
+        char *new_copy = realloc(line->copy, len + 1);
+        if (new_copy == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        line->copy = new_copy;
+        line->copy_capacity = len + 1;
+    }
+    memcpy(line->copy, text, len + 1);    // Words are unquoted in place
+    cmdline_start(line, line->copy);
+    int ret;
+    while ((ret = cmdline_parse_next(line, 1)) == 1) {
+    }
+    reset(line);
+    return ret;
+}
+
+int cmdline_parse_next(cmdline_t *line, int skip) {
+    lexer_t lx = {.p = line->next, .held = line->held, .line = line};
+    reset(line);
+    line->skip = skip;
+    token_t tok;
+    int ret = next_token(&lx, &tok);
+    if (ret == 0 && tok.kind != TOK_END) {
+        ret = parse_pipeline(line, &lx, &tok) == -1 ? -1 : 1;
+    }
+    line->skip = 0;
+    if (ret == -1) {
+        // Nothing more of the line is run
+        line->npipelines = 0;
+        line->next = "";
+        line->held = '\0';
+        return -1;
+    }
+    line->next = lx.p;
+    line->held = lx.held;
+    finish(line);
+    return ret;
+}
+
+/*
+ * Copy a string that may live in the line buffer into the arena
+ */
+static int detach(cmdline_t *line, const char **s) {
+    if (*s == NULL) {
+        return 0;
+    }
+    const char *copy = arena_copy(line, *s, strlen(*s));
+    if (copy == NULL) {
+        return -1;
+    }
+    *s = copy;
+    return 0;
+}
+
+/*
+ * Copy the part of a line that cmdline_parse_next() has not reached yet out
+ * of the line buffer
+ */
+static int keep_rest(cmdline_t *line) {
+    if (line->next == NULL) {
+        return 0;
+    }
+    // The character at 'next' may have been overwritten with the '\0' that
+    // ended the last word
+    int held = line->held != '\0';
+    const char *p = line->next;
+    size_t len = held + strlen(p + held);
+    int inside = p >= line->rest && p < line->rest + line->rest_capacity;
+    if (!inside && len + 1 > line->rest_capacity) {
+        char *new_rest = realloc(line->rest, len + 1);
+        if (new_rest == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        line->rest = new_rest;
+        line->rest_capacity = len + 1;
+    }
+    memmove(line->rest + held, p + held, len - held + 1);
+    if (held) {
+        line->rest[0] = line->held;
+    }
+    line->next = line->rest;
+    line->held = '\0';
+    return 0;
+}
+
+/*
+ * Expand a line of a here-document as if it were inside "...", in place
+ * where it does not grow
+ * Returns the expanded line, in the line or the scratch buffer, or NULL on
+ * error; *len is set to its length
+ */
+static const char *expand_doc_line(cmdline_t *line, char *text, size_t *len) {
+    word_t word = {.start = text, .w = text, .len = 0, .moved = 0, .kept = 0, .split = 0};
+    int expanded = 0, glob = 0;
+    line->nliterals = 0;
+    char *r = text;
+    while (*r != '\0') {
+        if (*r == '$') {
+            if ((r = expand(line, &word, r, 1, &expanded, &glob)) == NULL) {
+                return NULL;
+            }
+            continue;
+        }
+        if (*r == '\\' && r[1] != '\0' && strchr("$`\\", r[1]) != NULL) {
+            r++;
+        }
+        if (put(line, &word, r++, 1) == -1) {
+            return NULL;
+        }
+    }
+    *len = word.moved ? word.len : (size_t) (word.w - word.start);
+    return word.moved ? line->scratch : word.start;
+}
+
+int cmdline_read_heredocs(cmdline_t *line, line_reader_t *input, const char *prompt) {
+    // Reading the next line may move the buffer the words were unquoted in
+    for (unsigned i = 0; i < line->nwords; i++) {
+        if (detach(line, (const char **) &line->words[i]) == -1) {
+            return -1;
+        }
+    }
+    for (unsigned i = 0; i < line->nredirs; i++) {
+        if (detach(line, &line->redirs[i].target) == -1) {
+            return -1;
+        }
+    }
+    for (unsigned i = 0; i < line->nassigns; i++) {
+        if (detach(line, (const char **) &line->assigns[i]) == -1) {
+            return -1;
+        }
+    }
+    // ...and so may the rest of the line, once the words in it are copied
+    if (keep_rest(line) == -1) {
+        return -1;
+    }
+
+    for (unsigned i = 0; i < line->nredirs; i++) {
+        redirection_t *r = &line->redirs[i];
+        if (!r->heredoc) {
+            continue;
+        }
+        size_t len = 0;
+        while (1) {
+            if (prompt != NULL) {
+                fputs(prompt, stdout);
+                fflush(stdout);
+            }
+            char *text = line_reader_next(input, NULL);
+            if (text == NULL) {
+                fprintf(stderr,
+                        "swish: warning: here-document delimited by end-of-file (wanted `%s')\n",
+                        r->target);
+                break;
+            }
+            if (r->heredoc == 2) {
+                text += strspn(text, "\t");
+            }
+            if (strcmp(text, r->target) == 0) {
+                break;
+            }
+            size_t text_len = strlen(text);
+            const char *expanded = r->expand ? expand_doc_line(line, text, &text_len) : text;
+            if (expanded == NULL ||
+                buffer_append(&line->doc, &line->doc_capacity, &len, expanded, text_len) == -1 ||
+                buffer_append(&line->doc, &line->doc_capacity, &len, "\n", 1) == -1) {
+                return -1;
+            }
+        }
+        if ((r->target = arena_copy(line, len == 0 ? "" : line->doc, len)) == NULL) {
+            return -1;
+        }
+        r->heredoc = 0;
+        line->nheredocs--;
+    }
+    return 0;
+}
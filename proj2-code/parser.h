@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "capture.h"
+#include "line_reader.h"
+#include "string_vector.h"
+
+/*
+ * The parser turns one command line into a small syntax tree in a single
+ * pass over its characters. The lexer splits the line into words and
+ * operators; words are unquoted in place inside the line buffer, so no
+ * string is copied, and the tree refers to them directly.
+ *
+ * Quoting follows the shell: '...' keeps everything literally, "..." keeps
+ * everything except \" \\ \$ and \`, and an unquoted backslash keeps the
+ * next character. A '#' at the start of a word begins a comment.
+ *
+ * $NAME and ${NAME} are replaced by the value of the variable NAME (see
+ * env.h), unquoted or inside "...", while the line is parsed; only words
+ * that contain one are copied. The value is not split into several words,
+ * but an unquoted expansion that leaves a word empty removes the word.
+ * Words of the form NAME=value before the command name are assignments.
+ *
+ * $(command) runs the command as soon as it is reached (see capture.h) and
+ * is replaced by its output, without trailing newlines. Unquoted, the output
+ * is split at spaces, tabs and newlines into separate words, except in a
+ * word of the form NAME=value; inside "..." it stays one word. The output
+ * is not expanded any further, and never as a pattern.
+ *
+ * A word with an unquoted *, ? or [...] is a pattern, replaced by the
+ * sorted paths that it matches (see wildcard.h), or kept as it is if none
+ * match. Quoted or escaped characters, and those in "$NAME", match only
+ * themselves. Assignments and the words after redirections are not
+ * expanded.
+ *
+ * Operators:
+ *   |                    Connect the stages of a pipeline
+ *   &                    Run the pipeline in the background (end of line only)
+ *   ;                    Run the pipeline before it, then the one after it
+ *   &&  ||               Run the pipeline after it only if the one before it
+ *                        succeeded (&&) or failed (||)
+ *   [n]< file            Read descriptor n (default 0) from file
+ *   [n]> file            Write descriptor n (default 1) to file, truncating it
+ *   [n]>> file           Append descriptor n (default 1) to file
+ *   [n]>&m  [n]<&m       Make descriptor n a copy of descriptor m
+ *   &> file  &>> file    Send both stdout and stderr to file (>file 2>&1)
+ *   [n]<<< word          Read descriptor n (default 0) from word and a newline
+ *   [n]<< DELIM          Read descriptor n (default 0) from the lines that
+ *   [n]<<- DELIM         follow the command line, up to a line that is DELIM;
+ *                        <<- also strips leading tabs from each line
+ *   <(pipeline)          A word naming a pipe (/dev/fd/63, /dev/fd/62, ...)
+ *                        from which the pipeline's output can be read
+ * Redirections may appear anywhere in a command and apply from left to
+ * right, except that a descriptor sent only to files with > and >>, more
+ * than once, writes to all of them (see fanout.h). 'time' at the start of a
+ * pipeline times the whole pipeline.
+ *
+ * $? is the exit status of the last pipeline that ran. Since words are
+ * expanded as they are lexed, a line with several pipelines is parsed one
+ * pipeline at a time with cmdline_parse_next(), each running before the
+ * next one is lexed. As in other shells, a line with a syntax error anywhere
+ * does not run at all: cmdline_check() finds it beforehand, on a copy of
+ * the line, without expanding anything.
+ *
+ * Here-strings and here-documents are handed to the command in a memfd, and
+ * process substitutions through a pipe, so neither touches the filesystem.
+ * When no part of DELIM is quoted, each line of a here-document is expanded
+ * as if it were inside "...": $NAME, ${NAME}, $? and $(command) are replaced
+ * and \$, \` and \\ are escapes, while quotes are kept as they are.
+ */
+
+typedef enum {
+    REDIR_READ,      // [n]< file
+    REDIR_WRITE,     // [n]> file
+    REDIR_APPEND,    // [n]>> file
+    REDIR_DUP,       // [n]>&m or [n]<&m
+    REDIR_STRING,    // [n]<<< word or [n]<< DELIM; the target is the text to read
+    REDIR_PROCSUB,   // <(pipeline); the target is the pipeline's text
+} redir_kind_t;
+
+typedef struct {
+    redir_kind_t kind;
+    int fd;                // Descriptor that is redirected
+    const char *target;    // File to open, text to read, or NULL for REDIR_DUP
+    int dup_fd;            // Descriptor to copy for REDIR_DUP
+    int heredoc;           // REDIR_STRING from << (1) or <<- (2), whose text is still to be read
+    int expand;            // A here-document whose DELIM was not quoted, so its lines are expanded
+} redirection_t;
+
+// One simple command: a program (or builtin) with its arguments
+typedef struct {
+    char **argv;    // NULL-terminated; argv[0] is NULL for a command made of redirections only
+    unsigned argc;
+    redirection_t *redirs;    // In the order they appear, which is the order they apply in
+    unsigned nredirs;
+    char **assigns;           // "NAME=value" words before the command name
+    unsigned nassigns;
+    // Offsets into the line's storage while the line is being parsed
+    unsigned first_word;
+    unsigned first_redir;
+    unsigned first_assign;
+} command_t;
+
+// How a pipeline is connected to the one after it
+typedef enum {
+    LINK_END,    // Last pipeline of the line
+    LINK_SEQ,    // ;
+    LINK_AND,    // &&
+    LINK_OR,     // ||
+} link_t;
+
+typedef struct {
+    command_t *commands;    // The stages, in order
+    unsigned ncommands;
+    int background;    // Ended with '&'
+    int timed;         // Started with the 'time' keyword
+    link_t link;
+    unsigned first_command;    // Offset into the line's storage while parsing
+} pipeline_t;
+
+// A parsed command line. Its arrays are kept from one line to the next, so
+// once they have grown to fit a typical line, parsing allocates nothing.
+typedef struct {
+    pipeline_t *pipelines;
+    unsigned npipelines;
+    // Storage shared by all pipelines of the line
+    command_t *commands;
+    unsigned ncommands, commands_capacity;
+    char **words;
+    unsigned nwords, words_capacity;
+    redirection_t *redirs;
+    unsigned nredirs, redirs_capacity;
+    char **assigns;
+    unsigned nassigns, assigns_capacity;
+    unsigned pipelines_capacity;
+    unsigned nheredocs;       // Here-documents whose lines have not been read yet
+    strvec_arena_t arena;     // Strings built while parsing, reset for every line
+    char *scratch;            // Buffer words and strings are put together in
+    size_t scratch_capacity;
+    char *doc;                // Buffer a here-document is collected in
+    size_t doc_capacity;
+    unsigned *literals;       // Offsets of the quoted *, ?, [ and \\ of the word being lexed
+    unsigned nliterals, literals_capacity;
+    strvec_t matches;         // Paths a pattern expanded to, in the arena
+    strvec_t fields;          // Words split off the start of the word being lexed
+    capture_t output;         // Output of the last $(...), reused for the next one
+    int skip;                 // The pipeline being parsed will not run; $(...) are not run
+    // Where cmdline_parse_next() continues, and the character the '\0' there replaced
+    char *next;
+    char held;
+    char *rest;               // The rest of the line, once here-documents were read after it
+    size_t rest_capacity;
+    char *copy;               // The copy of a line that cmdline_check() parses
+    size_t copy_capacity;
+} cmdline_t;
+
+/*
+ * Initialize an empty command line
+ * line: Pointer to the command line to initialize
+ */
+void cmdline_init(cmdline_t *line);
+
+/*
+ * Parse a command line
+ * The words of the line are unquoted inside 'text', which must stay
+ * unchanged for as long as the parsed line is used
+ * line: Command line to fill in; anything parsed into it before is discarded
+ * text: The line to parse, without its trailing newline
+ * Returns 0 on success (a blank line has no pipelines) or -1 if the line has
+ * a syntax error, which has already been reported on stderr
+ */
+int cmdline_parse(cmdline_t *line, char *text);
+
+/*
+ * Start parsing a command line one pipeline at a time
+ * line: Command line to parse into
+ * text: The line to parse, without its trailing newline, which must stay
+ *       unchanged for as long as the line is being parsed
+ */
+void cmdline_start(cmdline_t *line, char *text);
+
+/*
+ * Check the syntax of a whole command line before any of it runs
+ * The line is parsed as pipelines that will not run are, so nothing in it
+ * is run or matched against files, and 'text' is left as it is
+ * line: Command line whose storage is used; call cmdline_start() afterwards
+ * text: The line to check, without its trailing newline
+ * Returns 0 if the line can be parsed, or -1 if it has a syntax error, which
+ * has already been reported on stderr
+ */
+int cmdline_check(cmdline_t *line, const char *text);
+
+/*
+ * Parse the next pipeline of the line given to cmdline_start()
+ * line: Command line to fill in with just that pipeline
+ * skip: Nonzero if the pipeline will not be run (as after && with a
+ *       failure), so that its command substitutions are not run either
+ * Returns 1 if a pipeline was parsed, 0 at the end of the line, or -1 if
+ * there is a syntax error, which has already been reported on stderr
+ */
+int cmdline_parse_next(cmdline_t *line, int skip);
+
+/*
+ * Read the lines of the here-documents of a parsed command line
+ * The words of the line, and the part of it cmdline_parse_next() has yet to
+ * parse, are first copied out of 'text', so the line reader that returned it
+ * may be used again
+ * line: A command line parsed with line->nheredocs > 0
+ * input: The reader that the command line came from
+ * prompt: Printed before reading each line, or NULL for no prompt
+ * Returns 0 on success or -1 on error
+ */
+int cmdline_read_heredocs(cmdline_t *line, line_reader_t *input, const char *prompt);
+
+/*
+ * Free the memory held by a command line
+ * line: Pointer to the command line to free
+ */
+void cmdline_free(cmdline_t *line);
+
+#endif    // PARSER_H
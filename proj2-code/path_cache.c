@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "path_cache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INITIAL_SIZE 64    // Must be a power of two
+
+typedef struct {
+    char *name;    // NULL for an empty slot
+    char *path;
+    unsigned hits;
+} path_entry_t;
+
+// Open-addressing table with linear probing. Removal shifts later entries of
+// the same probe run back into the hole, so no tombstones are needed.
+static path_entry_t *table = NULL;
+static unsigned capacity = 0;
+static unsigned count = 0;
+static char *resolved_path_var = NULL;    // Value of PATH the entries were resolved with
+
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 2166136261u;    // FNV-1a
+    while (*s != '\0') {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static path_entry_t *find_slot(path_entry_t *slots, unsigned size, const char *name) {
+    unsigned i = hash_name(name) & (size - 1);
+    while (slots[i].name != NULL && strcmp(slots[i].name, name) != 0) {
+        i = (i + 1) & (size - 1);
+    }
+    return &slots[i];
+}
+
+static int grow(void) {
+    unsigned new_capacity = capacity == 0 ? INITIAL_SIZE : 2 * capacity;
+    path_entry_t *new_table = calloc(new_capacity, sizeof(path_entry_t));
+    if (new_table == NULL) {
+        return -1;
+    }
+    for (unsigned i = 0; i < capacity; i++) {
+        if (table[i].name != NULL) {
+            *find_slot(new_table, new_capacity, table[i].name) = table[i];
+        }
+    }
+    free(table);
+    table = new_table;
+    capacity = new_capacity;
+    return 0;
+}
+
+static void remove_slot(path_entry_t *slot) {
+    free(slot->name);
+    free(slot->path);
+    slot->name = NULL;
+    count--;
+
+    // Re-insert the rest of the probe run so that lookups never stop early
+    unsigned i = (unsigned) (slot - table);
+    unsigned j = (i + 1) & (capacity - 1);
+    while (table[j].name != NULL) {
+        path_entry_t moved = table[j];
+        table[j].name = NULL;
+        *find_slot(table, capacity, moved.name) = moved;
+        j = (j + 1) & (capacity - 1);
+    }
+}
+
+/*
+ * Take the value of PATH that entries are resolved with, once after every
+ * flush of the table
+ */
+static void check_path_var(void) {
+    if (resolved_path_var != NULL) {
+        return;
+    }
+    const char *path_var = getenv("PATH");
+    resolved_path_var = strdup(path_var == NULL ? "" : path_var);
+}
+
+/*
+ * Walk the directories of PATH looking for an executable regular file
+ * Returns a newly allocated path or NULL if none was found
+ */
+static char *search_path(const char *name) {
+    const char *dir = resolved_path_var;
+    size_t name_len = strlen(name);
+    while (dir != NULL) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end == NULL ? strlen(dir) : (size_t) (end - dir);
+        char *candidate = malloc(dir_len + name_len + 3);
+        if (candidate == NULL) {
+            return NULL;
+        }
+        if (dir_len == 0) {
+            strcpy(candidate, ".");    // An empty entry means the current directory
+        } else {
+            memcpy(candidate, dir, dir_len);
+            candidate[dir_len] = '\0';
+        }
+        strcat(candidate, "/");
+        strcat(candidate, name);
+
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            return candidate;
+        }
+        free(candidate);
+        dir = end == NULL ? NULL : end + 1;
+    }
+    return NULL;
+}
+
+const char *path_cache_lookup(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    check_path_var();
+    if (capacity != 0) {
+        path_entry_t *slot = find_slot(table, capacity, name);
+        if (slot->name != NULL) {
+            slot->hits++;
+            return slot->path;
+        }
+    }
+
+    char *path = search_path(name);
+    if (path == NULL) {
+        return NULL;
+    }
+    if (path_cache_set(name, path) == -1) {
+        free(path);
+        return NULL;
+    }
+    free(path);
+    path_entry_t *slot = find_slot(table, capacity, name);
+    slot->hits = 1;
+    return slot->path;
+}
+
+int path_cache_set(const char *name, const char *path) {
+    check_path_var();
+    if ((count + 1) * 4 > capacity * 3 && grow() == -1) {    // Keep load factor below 3/4
+        return -1;
+    }
+    char *path_copy = strdup(path);
+    if (path_copy == NULL) {
+        return -1;
+    }
+    path_entry_t *slot = find_slot(table, capacity, name);
+    if (slot->name == NULL) {
+        if ((slot->name = strdup(name)) == NULL) {
+            free(path_copy);
+            return -1;
+        }
+        count++;
+    } else {
+        free(slot->path);
+    }
+    slot->path = path_copy;
+    slot->hits = 0;
+    return 0;
+}
+
+int path_cache_forget(const char *name) {
+    if (capacity == 0) {
+        return -1;
+    }
+    path_entry_t *slot = find_slot(table, capacity, name);
+    if (slot->name == NULL) {
+        return -1;
+    }
+    remove_slot(slot);
+    return 0;
+}
+
+void path_cache_clear(void) {
+    for (unsigned i = 0; i < capacity; i++) {
+        if (table[i].name != NULL) {
+            free(table[i].name);
+            free(table[i].path);
+            table[i].name = NULL;
+        }
+    }
+    count = 0;
+    free(resolved_path_var);
+    resolved_path_var = NULL;
+}
+
+void path_cache_print(void) {
+    if (count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (unsigned i = 0; i < capacity; i++) {
+        if (table[i].name != NULL) {
+            printf("%4u\t%s\n", table[i].hits, table[i].path);
+        }
+    }
+}
+
+void path_cache_free(void) {
+    path_cache_clear();
+    free(table);
+    table = NULL;
+    capacity = 0;
+}
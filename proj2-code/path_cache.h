@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+/*
+ * The path cache remembers where each command name was found in $PATH so that
+ * the shell can exec the absolute path directly instead of letting execvp()
+ * try every directory in turn. The shell flushes it whenever it changes PATH
+ * (see env.h), and the next lookup after a flush takes the new value.
+ */
+
+/*
+ * Resolve a command name to the path that should be executed
+ * Names containing a '/' are returned unchanged and never cached
+ * name: Command name, e.g. "ls"
+ * Returns the cached or newly found path (owned by the cache, valid until
+ * the entry is next modified) or NULL if the command is not found in $PATH
+ */
+const char *path_cache_lookup(const char *name);
+
+/*
+ * Add or replace an entry with an explicitly given path
+ * name: Command name
+ * path: Path to run for that command
+ * Returns 0 on success or -1 on error
+ */
+int path_cache_set(const char *name, const char *path);
+
+/*
+ * Drop the entry for a single command name, e.g. after its path has vanished
+ * name: Command name
+ * Returns 0 if an entry was removed or -1 if there was none
+ */
+int path_cache_forget(const char *name);
+
+/*
+ * Remove every entry from the cache, and look at PATH again on the next lookup
+ */
+void path_cache_clear(void);
+
+/*
+ * Print all entries with their hit counts, in the same layout as bash's 'hash'
+ */
+void path_cache_print(void);
+
+/*
+ * Release all memory held by the cache
+ */
+void path_cache_free(void);
+
+#endif    // PATH_CACHE_H
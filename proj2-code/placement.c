@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "placement.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MAX_NODES 1024    // Bits in the node mask passed to set_mempolicy()
+#define LONG_BITS (8 * sizeof(unsigned long))
+
+static int reserved = 0;    // Whether $SWISH_SHELL_CPUS took effect
+static cpu_set_t shell_cpus, job_cpus;
+
+void placement_init(placement_t *p) {
+    memset(p, 0, sizeof(placement_t));
+    p->policy = -1;
+    p->node = -1;
+}
+
+int placement_is_set(const placement_t *p) {
+    return p->has_cpus || p->has_nice || p->policy != -1 || p->node != -1;
+}
+
+static long parse_number(const char *s, long min, long max, const char **end) {
+    char *stop;
+    errno = 0;
+    long n = strtol(s, &stop, 10);
+    *end = stop;
+    return stop == s || errno != 0 || n < min || n > max ? LONG_MIN : n;
+}
+
+int placement_parse_cpus(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (1) {
+        // Each item is "N" or "N-M"
+        const char *end;
+        long low = parse_number(p, 0, CPU_SETSIZE - 1, &end);
+        long high = low;
+        if (low != LONG_MIN && *end == '-') {
+            high = parse_number(end + 1, low, CPU_SETSIZE - 1, &end);
+        }
+        if (low == LONG_MIN || high == LONG_MIN || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        for (long cpu = low; cpu <= high; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (*end == '\0') {
+            break;
+        }
+        p = end + 1;
+    }
+    return CPU_COUNT(set) == 0 ? -1 : 0;
+}
+
+/**
+ * node_cpus - Reads the CPUs of a NUMA node from sysfs.
+ *
+ * Returns 0 on success, or -1 if there is no such node.
+ */
+static int node_cpus(int node, cpu_set_t *set) {
+    char path[64], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "re");
+    if (f == NULL) {
+        return -1;
+    }
+    int ok = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if (!ok) {
+        return -1;
+    }
+    list[strcspn(list, "\n")] = '\0';
+    // A node with memory but no CPUs has an empty list
+    if (list[0] == '\0') {
+        CPU_ZERO(set);
+        return 0;
+    }
+    return placement_parse_cpus(list, set);
+}
+
+int placement_parse_option(placement_t *p, const char *option, const char *value) {
+    if (strcmp(option, "--cpus") != 0 && strcmp(option, "--nice") != 0 &&
+        strcmp(option, "--sched") != 0 && strcmp(option, "--node") != 0) {
+        return 0;
+    }
+    if (value == NULL) {
+        return 0;    // Reported as a usage error by the caller
+    }
+    const char *end;
+    if (strcmp(option, "--cpus") == 0) {
+        if (placement_parse_cpus(value, &p->cpus) == -1) {
+            fprintf(stderr, "run: --cpus: invalid CPU list '%s'\n", value);
+            return -1;
+        }
+        p->has_cpus = 1;
+    } else if (strcmp(option, "--nice") == 0) {
+        long n = parse_number(value, -20, 19, &end);
+        if (n == LONG_MIN || *end != '\0') {
+            fprintf(stderr, "run: --nice: invalid value '%s'\n", value);
+            return -1;
+        }
+        p->nice = (int) n;
+        p->has_nice = 1;
+    } else if (strcmp(option, "--sched") == 0) {
+        if (strcmp(value, "batch") == 0) {
+            p->policy = SCHED_BATCH;
+        } else if (strcmp(value, "idle") == 0) {
+            p->policy = SCHED_IDLE;
+        } else if (strcmp(value, "other") == 0) {
+            p->policy = SCHED_OTHER;
+        } else {
+            fprintf(stderr, "run: --sched: unknown policy '%s' (batch, idle or other)\n", value);
+            return -1;
+        }
+    } else {
+        long n = parse_number(value, 0, MAX_NODES - 1, &end);
+        if (n == LONG_MIN || *end != '\0' || node_cpus((int) n, &p->node_cpus) == -1) {
+            fprintf(stderr, "run: --node: no NUMA node '%s'\n", value);
+            return -1;
+        }
+        p->node = (int) n;
+    }
+    return 1;
+}
+
+int placement_apply(const placement_t *p) {
+    if (p->node != -1) {
+        unsigned long mask[MAX_NODES / LONG_BITS] = {0};
+        mask[p->node / LONG_BITS] = 1UL << (p->node % LONG_BITS);
+        // The kernel only looks at the first maxnode - 1 bits
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, MAX_NODES + 1) == -1) {
+            fprintf(stderr, "run: set_mempolicy: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    const cpu_set_t *cpus = NULL;
+    if (p->has_cpus) {
+        cpus = &p->cpus;
+    } else if (p->node != -1 && CPU_COUNT(&p->node_cpus) > 0) {
+        cpus = &p->node_cpus;
+    }
+    if (cpus != NULL && sched_setaffinity(0, sizeof(cpu_set_t), cpus) == -1) {
+        fprintf(stderr, "run: sched_setaffinity: %s\n", strerror(errno));
+        return -1;
+    }
+    if (p->policy != -1) {
+        struct sched_param param = {.sched_priority = 0};
+        if (sched_setscheduler(0, p->policy, &param) == -1) {
+            fprintf(stderr, "run: sched_setscheduler: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (p->has_nice && setpriority(PRIO_PROCESS, 0, p->nice) == -1) {
+        fprintf(stderr, "run: setpriority: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int placement_reserve_shell(const char *list) {
+    cpu_set_t wanted, allowed;
+    if (placement_parse_cpus(list, &wanted) == -1) {
+        fprintf(stderr, "swish: SWISH_SHELL_CPUS: invalid CPU list '%s'\n", list);
+        return -1;
+    }
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    CPU_AND(&shell_cpus, &wanted, &allowed);
+    if (CPU_COUNT(&shell_cpus) == 0) {
+        fprintf(stderr, "swish: SWISH_SHELL_CPUS: the shell may not run on '%s'\n", list);
+        return -1;
+    }
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &shell_cpus) == -1) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    CPU_XOR(&job_cpus, &allowed, &shell_cpus);
+    if (CPU_COUNT(&job_cpus) == 0) {
+        // Nothing is left over; jobs share the shell's CPUs
+        job_cpus = shell_cpus;
+    }
+    reserved = 1;
+    return 0;
+}
+
+unsigned placement_job_cpus(int *cpus) {
+    cpu_set_t set;
+    if (reserved) {
+        set = job_cpus;
+    } else if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == -1) {
+        return 0;
+    }
+    unsigned n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus[n++] = cpu;
+        }
+    }
+    return n;
+}
+
+int placement_enter_job_cpus(void) {
+    // Affinity is inherited across both fork() and exec, and the shell is
+    // allowed to widen its own again afterwards
+    return reserved && sched_setaffinity(0, sizeof(cpu_set_t), &job_cpus) == 0;
+}
+
+void placement_leave_job_cpus(int entered) {
+    if (entered) {
+        sched_setaffinity(0, sizeof(cpu_set_t), &shell_cpus);
+    }
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sched.h>
+
+/*
+ * Where and how the processes of a job are scheduled. Besides the cgroup
+ * limits of cgroup.h, 'run' takes placement options:
+ *   --cpus LIST      Run on the CPUs in LIST, such as "0-3,6"
+ *   --nice N         Run at niceness N (-20 to 19; lowering it needs privilege)
+ *   --sched POLICY   Run under SCHED_BATCH ("batch"), SCHED_IDLE ("idle") or
+ *                    the default policy ("other")
+ *   --node N         Prefer memory on NUMA node N and, without --cpus, run on
+ *                    the CPUs of that node
+ * Like joining a cgroup, placement is applied by each process of the job
+ * before it calls exec, so whatever the job starts inherits it.
+ *
+ * When $SWISH_SHELL_CPUS holds a CPU list, the shell pins itself to those
+ * CPUs at startup and jobs run on the rest of the CPUs it was allowed, so an
+ * interactive shell stays responsive while jobs keep every other core busy.
+ * 'parallel --spread' pins each concurrent command to a CPU of its own,
+ * taken round-robin from the CPUs jobs may use.
+ */
+
+typedef struct {
+    int has_cpus;
+    cpu_set_t cpus;         // Affinity, if has_cpus
+    int has_nice;
+    int nice;               // Niceness, if has_nice
+    int policy;             // SCHED_OTHER, SCHED_BATCH or SCHED_IDLE, or -1 to inherit
+    int node;               // Preferred NUMA node, or -1 for none
+    cpu_set_t node_cpus;    // CPUs of that node, used without has_cpus
+} placement_t;
+
+/*
+ * Initialize a placement that changes nothing
+ */
+void placement_init(placement_t *p);
+
+/*
+ * Returns nonzero if a placement changes anything
+ */
+int placement_is_set(const placement_t *p);
+
+/*
+ * Parse one option of 'run' if it is a placement option
+ * p: The placement to update
+ * option: The option, such as "--cpus"
+ * value: The word after the option, or NULL if there is none
+ * Returns 1 if the option and its value were taken, 0 if it is not a
+ * placement option, or -1 if the value is malformed, which has been reported
+ */
+int placement_parse_option(placement_t *p, const char *option, const char *value);
+
+/*
+ * Parse a CPU list such as "0-3,6" into a set
+ * Returns 0 on success or -1 if the list is malformed or empty
+ */
+int placement_parse_cpus(const char *list, cpu_set_t *set);
+
+/*
+ * Apply a placement to the calling process; meant for a child between fork
+ * and exec
+ * Returns 0 on success or -1 on error, which has been reported
+ */
+int placement_apply(const placement_t *p);
+
+/*
+ * Pin the shell to the CPUs in 'list' and let jobs use the others
+ * Returns 0 on success or -1 on error, which has been reported
+ */
+int placement_reserve_shell(const char *list);
+
+/*
+ * List the CPUs that jobs run on by default
+ * cpus: Filled with CPU numbers in increasing order; room for CPU_SETSIZE
+ * Returns how many there are
+ */
+unsigned placement_job_cpus(int *cpus);
+
+/*
+ * Switch the shell to the CPUs of jobs while it starts one, so that the
+ * child inherits them whichever way it is started; a no-op unless CPUs are
+ * reserved for the shell
+ * Returns nonzero if placement_leave_job_cpus() has to switch back
+ */
+int placement_enter_job_cpus(void);
+
+/*
+ * Switch the shell back to its reserved CPUs after placement_enter_job_cpus()
+ */
+void placement_leave_job_cpus(int entered);
+
+#endif    // PLACEMENT_H
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "reaper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "job_list.h"
+
+static int self_pipe[2] = {-1, -1};
+
+static void sigchld_handler(int sig) {
+    int saved_errno = errno;
+    char byte = 0;
+    // The pipe is non-blocking; if it is already full a wakeup is pending anyway
+    ssize_t ignored = write(self_pipe[1], &byte, 1);
+    (void) ignored;
+    errno = saved_errno;
+}
+
+int reaper_init(void) {
+    if (pipe2(self_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    struct sigaction sac;
+    sac.sa_handler = sigchld_handler;
+    if (sigemptyset(&sac.sa_mask) == -1) {
+        perror("sigemptyset");
+        return -1;
+    }
+    // SA_RESTART keeps reads of the next command from failing with EINTR
+    sac.sa_flags = SA_RESTART;
+    if (sigaction(SIGCHLD, &sac, NULL) == -1) {
+        perror("sigaction");
+        return -1;
+    }
+    return 0;
+}
+
+int reaper_fd(void) {
+    return self_pipe[0];
+}
+
+void reaper_drain(void) {
+    char drain[64];
+    while (self_pipe[0] != -1 && read(self_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+}
+
+/*
+ * Describe how a job ended (or that it stopped) the way bash's notices do
+ */
+static void describe_job(const job_t *job, char *buf, size_t len) {
+    if (job_count_procs(job, PROC_DONE) != job->nprocs) {
+        snprintf(buf, len, "Stopped");
+        return;
+    }
+    // Like a pipeline's exit status, the notice reflects the last process
+    int status = job->procs[job->nstages - 1].wait_status;
+    if (WIFSIGNALED(status)) {
+        snprintf(buf, len, "%s", strsignal(WTERMSIG(status)));
+    } else if (WEXITSTATUS(status) != 0) {
+        snprintf(buf, len, "Exit %d", WEXITSTATUS(status));
+    } else {
+        snprintf(buf, len, "Done");
+    }
+}
+
+void reaper_print_notice(const job_t *job, unsigned pos) {
+    char desc[64];
+    describe_job(job, desc, sizeof(desc));
+    printf("[%u]  %-24s%s\n", pos, desc, job->name);
+}
+
+void reaper_reap(job_list_t *jobs, int notify) {
+    reaper_drain();
+
+    // Only the processes of jobs are collected; other children of the shell
+    // (fanout helpers, process substitutions) are reaped by their owners
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    for (unsigned j = 0; j < jobs->length; j++) {
+        job_t *job = job_list_get(jobs, j);
+        for (unsigned i = 0; i < job->nprocs; i++) {
+            while (job->procs[i].state != PROC_DONE &&
+                   (pid = wait4(job->procs[i].pid, &status, WNOHANG | WUNTRACED | WCONTINUED,
+                                &usage)) > 0) {
+                job_update_proc(job, pid, status, &usage);
+            }
+        }
+    }
+
+    // Apply the collected events; 'pos' is the index each job had before any
+    // finished job was removed, so notices match what 'jobs' last showed.
+    unsigned idx = 0, pos = 0;
+    while (idx < jobs->length) {
+        job_t *job = job_list_get(jobs, idx);
+        int finished = job_count_procs(job, PROC_DONE) == job->nprocs;
+        int stopped = !finished && job_count_procs(job, PROC_RUNNING) == 0;
+        int report = 0;
+
+        if (job->status == BACKGROUND && (finished || stopped)) {
+            report = 1;
+        } else if (job->status == STOPPED && job_count_procs(job, PROC_STOPPED) == 0) {
+            job_set_status(job, BACKGROUND);    // Continued by a signal from outside the shell
+            if (finished) {
+                report = 1;
+            }
+        }
+        if (report && notify) {
+            reaper_print_notice(job, pos);
+        }
+        if (report && finished) {
+            job_list_remove(jobs, idx);
+        } else {
+            if (report) {
+                job_set_status(job, STOPPED);
+            }
+            idx++;
+        }
+        pos++;
+    }
+    if (notify) {
+        fflush(stdout);
+    }
+}
+
+void reaper_free(void) {
+    signal(SIGCHLD, SIG_DFL);
+    if (self_pipe[0] != -1) {
+        close(self_pipe[0]);
+        close(self_pipe[1]);
+        self_pipe[0] = self_pipe[1] = -1;
+    }
+}
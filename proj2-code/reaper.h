@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef REAPER_H
+#define REAPER_H
+
+#include "job_list.h"
+
+/*
+ * The reaper collects exit, stop and continue events of background jobs as
+ * they happen instead of waiting for 'wait-for' or 'wait-all'. A SIGCHLD
+ * handler writes to a self-pipe; the shell drains it between prompts with
+ * reaper_reap(), which updates the job list.
+ */
+
+/*
+ * Install the SIGCHLD handler and create the self-pipe
+ * Returns 0 on success or -1 on error
+ */
+int reaper_init(void);
+
+/*
+ * Returns the read end of the self-pipe, which becomes readable whenever a
+ * child changes state; -1 if reaper_init() has not been called
+ */
+int reaper_fd(void);
+
+/*
+ * Collect every pending state change of the jobs' processes without blocking
+ * Background jobs whose processes have all exited are removed from the list,
+ * jobs whose processes have all stopped are marked STOPPED, and stopped jobs
+ * continued by someone else go back to BACKGROUND
+ * jobs: The list of current jobs for the shell
+ * notify: 1 to print a line for every job that finished or stopped
+ */
+void reaper_reap(job_list_t *jobs, int notify);
+
+/*
+ * Empty the self-pipe after waiting for it to become readable
+ */
+void reaper_drain(void);
+
+/*
+ * Print the line that tells the user that a job finished or stopped, e.g.
+ * "[2]  Done                    sleep"
+ * job: The job to describe
+ * pos: The job's index as 'jobs' showed it
+ */
+void reaper_print_notice(const job_t *job, unsigned pos);
+
+/*
+ * Close the self-pipe and restore the default SIGCHLD disposition
+ */
+void reaper_free(void);
+
+#endif    // REAPER_H
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "swish_funcs.h"
+
+#define NUM_BUCKETS 65    // Bucket 0 holds 0ns, bucket b holds [2^(b-1), 2^b) ns
+#define DEFAULT_DUMP_INTERVAL 10
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[NUM_BUCKETS];
+} histogram_t;
+
+static const struct {
+    const char *label;    // For 'stats'
+    const char *metric;   // For the Prometheus format
+} counter_names[NUM_STAT_COUNTERS] = {
+    [STAT_LINES_PARSED] = {"lines parsed", "swish_lines_parsed_total"},
+    [STAT_PARSE_ERRORS] = {"parse errors", "swish_parse_errors_total"},
+    [STAT_BUILTINS_RUN] = {"builtins run", "swish_builtins_total"},
+    [STAT_LAUNCHES] = {"commands launched", "swish_launches_total"},
+    [STAT_LAUNCH_FAILURES] = {"launch failures", "swish_launch_failures_total"},
+};
+
+static const struct {
+    const char *label;
+    const char *metric;
+} histogram_names[NUM_STAT_HISTOGRAMS] = {
+    [STAT_PARSE_TIME] = {"parse", "swish_parse_seconds"},
+    [STAT_LAUNCH_TIME] = {"launch", "swish_launch_seconds"},
+    [STAT_WAIT_TIME] = {"wait", "swish_wait_seconds"},
+    [STAT_TCSETPGRP_TIME] = {"tcsetpgrp", "swish_tcsetpgrp_seconds"},
+};
+
+static uint64_t counters[NUM_STAT_COUNTERS];
+static histogram_t histograms[NUM_STAT_HISTOGRAMS];
+
+static char *dump_path = NULL;
+static unsigned dump_interval = DEFAULT_DUMP_INTERVAL;
+static uint64_t last_dump = 0;
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void stats_count(stat_counter_t counter) {
+    counters[counter]++;
+}
+
+void stats_record(stat_histogram_t histogram, uint64_t start) {
+    uint64_t ns = stats_now() - start;
+    histogram_t *h = &histograms[histogram];
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+    h->buckets[ns == 0 ? 0 : 64 - __builtin_clzll(ns)]++;
+}
+
+/**
+ * format_duration - Writes a number of nanoseconds with a unit that keeps it
+ * short, e.g. "850ns", "12.5us" or "1.20s".
+ */
+static void format_duration(char *buf, size_t size, double ns) {
+    if (ns < 1e3) {
+        snprintf(buf, size, "%.0fns", ns);
+    } else if (ns < 1e6) {
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    } else if (ns < 1e9) {
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    }
+}
+
+static void print_human(FILE *out) {
+    for (int c = 0; c < NUM_STAT_COUNTERS; c++) {
+        fprintf(out, "%-20s%llu\n", counter_names[c].label, (unsigned long long) counters[c]);
+    }
+    for (int i = 0; i < NUM_STAT_HISTOGRAMS; i++) {
+        const histogram_t *h = &histograms[i];
+        char mean[32], max[32];
+        format_duration(mean, sizeof(mean), h->count == 0 ? 0 : (double) h->sum_ns / h->count);
+        format_duration(max, sizeof(max), h->max_ns);
+        fprintf(out, "%-12scount %-8llu mean %-9s max %s\n", histogram_names[i].label,
+                (unsigned long long) h->count, mean, max);
+        for (int b = 0; b < NUM_BUCKETS; b++) {
+            if (h->buckets[b] == 0) {
+                continue;
+            }
+            char low[32], high[32];
+            format_duration(low, sizeof(low), b == 0 ? 0 : (double) (1ULL << (b - 1)));
+            format_duration(high, sizeof(high), b == 0 ? 1 : 2 * (double) (1ULL << (b - 1)));
+            fprintf(out, "  [%s, %s)%*s%llu\n", low, high,
+                    (int) (18 - strlen(low) - strlen(high)), "",
+                    (unsigned long long) h->buckets[b]);
+        }
+    }
+}
+
+static void print_prometheus(FILE *out) {
+    for (int c = 0; c < NUM_STAT_COUNTERS; c++) {
+        fprintf(out, "# TYPE %s counter\n%s %llu\n", counter_names[c].metric,
+                counter_names[c].metric, (unsigned long long) counters[c]);
+    }
+    for (int i = 0; i < NUM_STAT_HISTOGRAMS; i++) {
+        const histogram_t *h = &histograms[i];
+        const char *metric = histogram_names[i].metric;
+        fprintf(out, "# TYPE %s histogram\n", metric);
+        // Buckets are cumulative; the ones past the longest latency add nothing
+        int last = 0;
+        for (int b = 0; b < NUM_BUCKETS; b++) {
+            if (h->buckets[b] != 0) {
+                last = b;
+            }
+        }
+        uint64_t cumulative = 0;
+        for (int b = 0; b <= last && h->count > 0; b++) {
+            cumulative += h->buckets[b];
+            double le = b == 0 ? 1e-9 : (double) (1ULL << (b - 1)) * 2e-9;
+            fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", metric, le,
+                    (unsigned long long) cumulative);
+        }
+        fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", metric, (unsigned long long) h->count);
+        fprintf(out, "%s_sum %.9f\n", metric, h->sum_ns / 1e9);
+        fprintf(out, "%s_count %llu\n", metric, (unsigned long long) h->count);
+    }
+}
+
+void stats_set_dump(const char *path, unsigned interval) {
+    free(dump_path);
+    dump_path = strdup(path);
+    dump_interval = interval;
+    last_dump = stats_now();
+}
+
+void stats_maybe_dump(int force) {
+    if (dump_path == NULL) {
+        return;
+    }
+    uint64_t now = stats_now();
+    if (!force && now - last_dump < (uint64_t) dump_interval * 1000000000u) {
+        return;
+    }
+    last_dump = now;
+
+    // Written next to the file and renamed over it
+    char *tmp_path;
+    if (asprintf(&tmp_path, "%s.tmp", dump_path) == -1) {
+        return;
+    }
+    FILE *out = fopen(tmp_path, "we");
+    if (out == NULL) {
+        perror(tmp_path);
+        free(tmp_path);
+        return;
+    }
+    print_prometheus(out);
+    if (fclose(out) != 0 || rename(tmp_path, dump_path) == -1) {
+        perror(dump_path);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+/**
+ * builtin_stats - Prints the counters and histograms, in the Prometheus
+ * format with "-p"; "-r" resets them.
+ */
+static int builtin_stats(strvec_t *args, job_list_t *jobs) {
+    const char *arg = strvec_get(args, 1);
+    if (args->length > 2 || (arg != NULL && strcmp(arg, "-p") != 0 && strcmp(arg, "-r") != 0)) {
+        fprintf(stderr, "stats: usage: stats [-p | -r]\n");
+        return 2;
+    }
+    if (arg != NULL && strcmp(arg, "-r") == 0) {
+        memset(counters, 0, sizeof(counters));
+        memset(histograms, 0, sizeof(histograms));
+    } else if (arg != NULL) {
+        print_prometheus(stdout);
+    } else {
+        print_human(stdout);
+    }
+    return 0;
+}
+
+void stats_register(void) {
+    builtin_register("stats", builtin_stats, 0);
+}
+
+void stats_free(void) {
+    free(dump_path);
+    dump_path = NULL;
+}
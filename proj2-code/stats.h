@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Counters and latency histograms for the shell's own work: parsing,
+ * launching commands, waiting for them and handing over the terminal.
+ * Recording costs one clock_gettime() (a vDSO call, no system call) and a
+ * few additions into fixed arrays; nothing is allocated. Histograms have
+ * one bucket per power of two nanoseconds, so every latency from 1ns to
+ * centuries fits in 64 buckets with at most a factor of two of error.
+ *
+ * The 'stats' builtin prints them:
+ *   stats       Counters and the nonempty buckets of every histogram
+ *   stats -p    The same in the Prometheus text format
+ *   stats -r    Reset everything to zero
+ * When $SWISH_STATS_FILE is set, the Prometheus form is also written to
+ * that file every $SWISH_STATS_INTERVAL seconds (default 10), checked
+ * between command lines, and when the shell exits. The file is replaced
+ * with rename(), so a scraper never reads half of it.
+ */
+
+typedef enum {
+    STAT_LINES_PARSED,
+    STAT_PARSE_ERRORS,
+    STAT_BUILTINS_RUN,
+    STAT_LAUNCHES,           // External processes started
+    STAT_LAUNCH_FAILURES,    // Commands that could not be started; with fork, a failed exec
+                             // is only seen as the exit status 127
+    NUM_STAT_COUNTERS,
+} stat_counter_t;
+
+typedef enum {
+    STAT_PARSE_TIME,        // Parsing one command line
+    STAT_LAUNCH_TIME,       // Starting one external command (fork or posix_spawn)
+    STAT_WAIT_TIME,         // Blocked waiting for foreground or background jobs
+    STAT_TCSETPGRP_TIME,    // Handing the terminal to a job or back to the shell
+    NUM_STAT_HISTOGRAMS,
+} stat_histogram_t;
+
+/*
+ * Returns the current time in nanoseconds, to pass to stats_record() later
+ */
+uint64_t stats_now(void);
+
+/*
+ * Add one to a counter
+ * counter: The counter to increment
+ */
+void stats_count(stat_counter_t counter);
+
+/*
+ * Record the time elapsed since 'start' in a histogram
+ * histogram: The histogram to add to
+ * start: A time returned by stats_now()
+ */
+void stats_record(stat_histogram_t histogram, uint64_t start);
+
+/*
+ * Write the statistics to a file every 'interval' seconds
+ * path: File to write, replaced on every dump
+ * interval: Seconds between dumps
+ */
+void stats_set_dump(const char *path, unsigned interval);
+
+/*
+ * Write the dump file if the interval has passed since the last dump
+ * (or unconditionally when 'force' is nonzero)
+ */
+void stats_maybe_dump(int force);
+
+/*
+ * Add the 'stats' builtin to the builtin table
+ */
+void stats_register(void);
+
+/*
+ * Free the memory held for the dump file
+ */
+void stats_free(void);
+
+#endif    // STATS_H
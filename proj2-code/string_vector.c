@@ -7,10 +7,70 @@
 #include <string.h>
 
 #define INITIAL_SIZE 4
+#define ARENA_BLOCK_SIZE 4096
+
+void strvec_arena_init(strvec_arena_t *arena) {
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+char *strvec_arena_strndup(strvec_arena_t *arena, const char *s, unsigned len) {
+    // Move on to the next kept block (or add one) until the string fits
+    strvec_block_t *block = arena->current;
+    while (block == NULL || block->size - block->used < len + 1) {
+        strvec_block_t *next = block == NULL ? arena->head : block->next;
+        if (next == NULL) {
+            unsigned size = ARENA_BLOCK_SIZE;
+            if (block != NULL && 2 * block->size > size) {
+                size = 2 * block->size;
+            }
+            if (size < len + 1) {
+                size = len + 1;
+            }
+            if ((next = malloc(sizeof(strvec_block_t) + size)) == NULL) {
+                return NULL;
+            }
+            next->next = NULL;
+            next->size = size;
+            if (block == NULL) {
+                arena->head = next;
+            } else {
+                block->next = next;
+            }
+        }
+        next->used = 0;
+        block = next;
+    }
+    arena->current = block;
+
+    char *copy = block->data + block->used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+    return copy;
+}
+
+void strvec_arena_reset(strvec_arena_t *arena) {
+    arena->current = arena->head;
+    if (arena->head != NULL) {
+        arena->head->used = 0;
+    }
+}
+
+void strvec_arena_free(strvec_arena_t *arena) {
+    strvec_block_t *block = arena->head;
+    while (block != NULL) {
+        strvec_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    strvec_arena_init(arena);
+}
 
 int strvec_init(strvec_t *vec) {
     vec->length = 0;
     vec->capacity = INITIAL_SIZE;
+    vec->arena = NULL;
     vec->data = malloc(INITIAL_SIZE * sizeof(char *));
     if (vec->data == NULL) {
         return -1;
@@ -19,7 +79,20 @@ int strvec_init(strvec_t *vec) {
     return 0;
 }
 
+int strvec_init_arena(strvec_t *vec, strvec_arena_t *arena) {
+    if (strvec_init(vec) != 0) {
+        return -1;
+    }
+    vec->arena = arena;
+    return 0;
+}
+
 void strvec_clear(strvec_t *vec) {
+    if (vec->arena != NULL) {
+        // The strings belong to the arena and the array is kept for reuse
+        vec->length = 0;
+        return;
+    }
     if (vec->capacity == 0) {
         return;
     }
@@ -32,12 +105,29 @@ void strvec_clear(strvec_t *vec) {
     vec->capacity = 0;
 }
 
-int strvec_add(strvec_t *vec, const char *s) {
+void strvec_free(strvec_t *vec) {
+    if (vec->arena == NULL) {
+        strvec_clear(vec);
+        return;
+    }
+    free(vec->data);
+    vec->data = NULL;
+    vec->length = 0;
+    vec->capacity = 0;
+    vec->arena = NULL;
+}
+
+/*
+ * Make room for one more element, (re)initializing the vector if needed
+ */
+static int strvec_reserve(strvec_t *vec) {
     // If vector was previously cleared, need to reinitialize
     if (vec->capacity == 0) {
+        strvec_arena_t *arena = vec->arena;
         if (strvec_init(vec) != 0) {
             return -1;
         }
+        vec->arena = arena;
     }
 
     if (vec->length == vec->capacity) {
@@ -50,15 +140,39 @@ int strvec_add(strvec_t *vec, const char *s) {
         }
         vec->capacity = vec->capacity * 2;
     }
+    return 0;
+}
 
-    if ((vec->data[vec->length] = malloc((strlen(s) + 1) * sizeof(char))) == NULL) {
+int strvec_add(strvec_t *vec, const char *s) {
+    if (strvec_reserve(vec) != 0) {
         return -1;
     }
-    strcpy(vec->data[vec->length], s);
+
+    if (vec->arena != NULL) {
+        if ((vec->data[vec->length] = strvec_arena_strndup(vec->arena, s, strlen(s))) == NULL) {
+            return -1;
+        }
+    } else {
+        if ((vec->data[vec->length] = malloc((strlen(s) + 1) * sizeof(char))) == NULL) {
+            return -1;
+        }
+        strcpy(vec->data[vec->length], s);
+    }
     vec->length++;
     return 0;
 }
 
+int strvec_add_ref(strvec_t *vec, char *s) {
+    if (vec->arena == NULL) {
+        return strvec_add(vec, s);
+    }
+    if (strvec_reserve(vec) != 0) {
+        return -1;
+    }
+    vec->data[vec->length++] = s;
+    return 0;
+}
+
 char *strvec_get(const strvec_t *vec, unsigned i) {
     if (i >= vec->length) {
         return NULL;
@@ -81,8 +195,10 @@ void strvec_take(strvec_t *vec, unsigned n) {
         return;
     }
 
-    for (int i = n; i < vec->length; i++) {
-        free(vec->data[i]);
+    if (vec->arena == NULL) {
+        for (int i = n; i < vec->length; i++) {
+            free(vec->data[i]);
+        }
     }
     vec->length = n;
 }
@@ -4,12 +4,57 @@
 #ifndef STRING_VECTOR_H
 #define STRING_VECTOR_H
 
+/*
+ * A bump allocator for strings that all share one lifetime, such as the
+ * tokens of a single command line. Blocks are kept when the arena is reset,
+ * so once it has grown to fit a typical line no further allocations occur.
+ */
+typedef struct strvec_block {
+    struct strvec_block *next;
+    unsigned int size;
+    unsigned int used;
+    char data[];
+} strvec_block_t;
+
+typedef struct {
+    strvec_block_t *head;       // First block; all blocks stay allocated until freed
+    strvec_block_t *current;    // Block that allocations are currently served from
+} strvec_arena_t;
+
 typedef struct {
     unsigned int length;
     unsigned int capacity;
     char **data;
+    strvec_arena_t *arena;    // NULL if every string is a separate heap allocation
 } strvec_t;
 
+/*
+ * Initializes a new, empty string arena
+ * arena: Pointer to the arena to initialize
+ */
+void strvec_arena_init(strvec_arena_t *arena);
+
+/*
+ * Copy a string into an arena
+ * arena: Pointer to the arena to allocate from
+ * s: The string to copy
+ * len: Number of characters of s to copy; a terminating '\0' is added
+ * Returns the copy, which lives until the arena is reset, or NULL on error
+ */
+char *strvec_arena_strndup(strvec_arena_t *arena, const char *s, unsigned len);
+
+/*
+ * Discards every string allocated from an arena while keeping its memory
+ * arena: Pointer to the arena to reset
+ */
+void strvec_arena_reset(strvec_arena_t *arena);
+
+/*
+ * Frees all memory held by an arena
+ * arena: Pointer to the arena to free
+ */
+void strvec_arena_free(strvec_arena_t *arena);
+
 /*
  * Initializes a new, empty string vector
  * vec: Pointer to the vector to initialize
@@ -17,14 +62,33 @@ typedef struct {
  */
 int strvec_init(strvec_t *vec);
 
+/*
+ * Initializes a new, empty string vector whose strings come from an arena
+ * strvec_add() copies strings into the arena, strvec_add_ref() stores them
+ * without copying, and strvec_clear() only empties the vector, keeping its
+ * array for the next use. Several vectors may share the same arena.
+ * vec: Pointer to the vector to initialize
+ * arena: Arena to copy strings into
+ * Returns 0 on success, -1 on error
+ */
+int strvec_init_arena(strvec_t *vec, strvec_arena_t *arena);
+
 /*
  * Removes all entries from a string vector
  * The underlying memory for the vector is also freed
  * vec: Pointer to the vector to clear
  * Note: You MUST re-initialize this vector with strvec_init() if you want to use it again
+ * For a vector created with strvec_init_arena(), nothing is freed and it can be
+ * reused immediately; its strings stay valid until the arena is reset
  */
 void strvec_clear(strvec_t *vec);
 
+/*
+ * Frees the memory of a string vector in either mode
+ * vec: Pointer to the vector to free
+ */
+void strvec_free(strvec_t *vec);
+
 /*
  * Add a new string to a string vector
  * vec: Pointer to the vector to add to
@@ -34,6 +98,16 @@ void strvec_clear(strvec_t *vec);
  */
 int strvec_add(strvec_t *vec, const char *s);
 
+/*
+ * Add a string to a string vector without copying it
+ * Only arena vectors store the pointer itself; other vectors make a copy
+ * vec: Pointer to the vector to add to
+ * s: The string to add, which must outlive the vector's current contents
+ *    (e.g., a token inside the line buffer being parsed)
+ * Returns 0 on success, -1 on error
+ */
+int strvec_add_ref(strvec_t *vec, char *s);
+
 /*
  * Retrieve an element from a string vector
  * vec: Pointer to the vector to retrieve from
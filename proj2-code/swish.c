@@ -1,18 +1,35 @@
 #define _GNU_SOURCE
 
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "capture.h"
+#include "env.h"
+#include "fork_server.h"
+#include "history.h"
 #include "job_list.h"
-#include "string_vector.h"
+#include "job_shm.h"
+#include "launch.h"
+#include "line_reader.h"
+#include "parser.h"
+#include "path_cache.h"
+#include "placement.h"
+#include "reaper.h"
+#include "stats.h"
 #include "swish_funcs.h"
+#include "wildcard.h"
 
-#define CMD_LEN 512
 #define PROMPT "@> "
+#define HEREDOC_PROMPT "> "
+#define HISTORY_FILE ".swish_history"    // In $HOME, unless $SWISH_HISTFILE names another
+#define HISTORY_SIZE 1000                // Entries kept, unless $SWISH_HISTSIZE says otherwise
 
 int main(int argc, char **argv) {
     // --- Setup signal handling for background operation ---
@@ -30,198 +47,242 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // --- Initialize the tokens vector and job list ---
-    strvec_t tokens;
-    if (strvec_init(&tokens) != 0) {    // Check for initialization failure if applicable
-        fprintf(stderr, "Failed to initialize tokens vector\n");
-        return -1;
+    // --- Collect child state changes through a SIGCHLD self-pipe ---
+    if (reaper_init() == -1) {
+        return 1;
+    }
+
+    // --- Allow a pidfd for every process in the job list ---
+    // Thousands of background jobs need more descriptors than the usual soft
+    // limit of 1024, so the limit is raised as far as the hard limit allows.
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
+    // --- Take over the environment ---
+    // From here on the shell keeps the variables itself, and 'environ' points
+    // at the envp it passes to every command.
+    if (env_init() == -1) {
+        return 1;
+    }
+
+    // --- Keep the shell on CPUs of its own if asked to ---
+    // SWISH_SHELL_CPUS=0 leaves every other CPU to jobs.
+    const char *shell_cpus = getenv("SWISH_SHELL_CPUS");
+    if (shell_cpus != NULL) {
+        placement_reserve_shell(shell_cpus);
+    }
+
+    // --- Select how external commands are started ---
+    // SWISH_LAUNCH=fork falls back to the classic fork() + execvp() path, and
+    // SWISH_LAUNCH=server starts them from a fork server forked right here,
+    // while the shell is still small.
+    const char *launch_name = getenv("SWISH_LAUNCH");
+    if (launch_name != NULL && launch_set_backend_by_name(launch_name) == -1) {
+        fprintf(stderr, "Unknown SWISH_LAUNCH backend '%s', using spawn\n", launch_name);
+    }
+    if (launch_get_backend() == LAUNCH_SERVER && fork_server_start() == -1) {
+        fprintf(stderr, "Could not start the fork server, using spawn\n");
+        launch_set_backend(LAUNCH_SPAWN);
+    }
+
+    // --- Dump the shell's statistics for monitoring if asked to ---
+    const char *stats_file = getenv("SWISH_STATS_FILE");
+    if (stats_file != NULL) {
+        const char *interval = getenv("SWISH_STATS_INTERVAL");
+        int seconds = interval == NULL ? 0 : atoi(interval);
+        stats_set_dump(stats_file, seconds > 0 ? seconds : 10);
     }
+
+    // --- Publish the job table in shared memory if asked to ---
+    // Supervisors map $SWISH_JOB_TABLE and read it without asking the shell.
+    const char *job_table = getenv("SWISH_JOB_TABLE");
+    if (job_table != NULL && job_table[0] != '\0') {
+        job_shm_open(job_table);
+    }
+
+    // --- Initialize the parsed command line and job list ---
+    // Words are unquoted in place inside the command buffer, and the syntax
+    // tree's arrays are reused for every line, so a line needs no heap
+    // allocations once they have grown to fit.
+    cmdline_t line;
+    cmdline_init(&line);
     job_list_t jobs;
     job_list_init(&jobs);    // Initialize the job list to track background/stopped jobs
+    capture_init(&jobs);     // Builtins in $(...) see the same jobs
 
-    char cmd[CMD_LEN];    // Buffer to hold user command input
+    // --- Choose where commands come from ---
+    // 'swish -c CMD' runs CMD, 'swish SCRIPT' runs the lines of SCRIPT, and
+    // otherwise commands are read from stdin. Unless stdin is a terminal
+    // being read interactively, the shell runs in batch mode: no prompts, no
+    // terminal control, and fully buffered output.
+    int input_fd = STDIN_FILENO;
+    const char *command_string = NULL;
+    if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+        command_string = argv[2];
+    } else if (argc == 2 && strcmp(argv[1], "-c") != 0) {
+        if ((input_fd = open(argv[1], O_RDONLY | O_CLOEXEC)) == -1) {
+            perror(argv[1]);
+            return 127;
+        }
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [-c command | script]\n", argv[0]);
+        return 2;
+    }
+    shell_options.interactive = command_string == NULL && input_fd == STDIN_FILENO &&
+                                isatty(STDIN_FILENO);
+    // The last command of 'swish -c' or of a script is exec'd in place
+    int tail_exec = command_string != NULL || input_fd != STDIN_FILENO;
+    if (!shell_options.interactive) {
+        setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+    }
 
-    // --- Main command loop ---
-    printf("%s", PROMPT);    // Print initial prompt
-    while (fgets(cmd, CMD_LEN, stdin) != NULL) {
-        // Remove the trailing newline character from the input
-        int i = 0;
-        while (cmd[i] != '\n') {
-            i++;
+    // --- Interactive shells keep a command history ---
+    if (shell_options.interactive) {
+        const char *hist_file = getenv("SWISH_HISTFILE");
+        const char *home = getenv("HOME");
+        const char *hist_size = getenv("SWISH_HISTSIZE");
+        char *default_file = NULL;
+        if (hist_file == NULL && home != NULL &&
+            asprintf(&default_file, "%s/%s", home, HISTORY_FILE) != -1) {
+            hist_file = default_file;
         }
-        cmd[i] = '\0';
-
-        // Tokenize the command line input (split by spaces)
-        if (tokenize(cmd, &tokens) != 0) {
-            printf("Failed to parse command\n");
-            strvec_clear(&tokens);
-            job_list_free(&jobs);
-            return 1;
+        char *end;
+        unsigned long size = hist_size == NULL ? HISTORY_SIZE : strtoul(hist_size, &end, 10);
+        if (hist_size != NULL && (end == hist_size || *end != '\0')) {
+            size = HISTORY_SIZE;
         }
-        // If no tokens were generated (empty command), simply reprompt.
-        if (tokens.length == 0) {
-            printf("%s", PROMPT);
-            continue;
+        if (hist_file != NULL) {
+            history_init(hist_file, size);
         }
-        // Retrieve the first token (command name) from the token vector.
-        const char *first_token = strvec_get(&tokens, 0);
-
-        // --- Built-in command: pwd ---
-        if (strcmp(first_token, "pwd") == 0) {
-            // Print the current working directory using getcwd()
-            char *buffer;
-            buffer = (char *) malloc(CMD_LEN);
-            if (buffer == NULL) {
-                perror("unable to allocate memory.");
-                return -1;
-            }
-            if (getcwd(buffer, CMD_LEN) == NULL) {
-                perror("getcwd");
-                free(buffer);
-                return -1;
+        free(default_file);
+    }
+
+    // Lines of any length are read into one reusable buffer
+    line_reader_t input;
+    int init_result = command_string != NULL ? line_reader_init_string(&input, command_string)
+                                             : line_reader_init(&input, input_fd);
+    if (init_result != 0) {
+        fprintf(stderr, "Failed to initialize input buffer\n");
+        return -1;
+    }
+    char *cmd;    // Current command line, without its trailing newline
+    // Lines of here-documents are prompted for like in other shells
+    const char *heredoc_prompt = shell_options.interactive ? HEREDOC_PROMPT : NULL;
+
+    // --- Main command loop ---
+    if (shell_options.interactive) {
+        printf("%s", PROMPT);    // Print initial prompt
+        fflush(stdout);
+    }
+    while ((cmd = line_reader_next(&input, NULL)) != NULL) {
+        // Recall a command from the history (!N, !prefix) and record the line
+        // before parsing unquotes it in place
+        int builtin = BUILTIN_NONE;
+        if (shell_options.interactive) {
+            cmd = history_expand(cmd);
+            if (cmd != NULL) {
+                history_add(cmd);
             }
-            printf("%s\n", buffer);
-            free(buffer);
         }
-        // --- Built-in command: cd ---
-        else if (strcmp(first_token, "cd") == 0) {
-            // Change directory: if a second token is provided, use it;
-            // otherwise, change to the home directory specified by the HOME environment variable.
-            const char *second_token = strvec_get(&tokens, 1);
-            const char *home = getenv("HOME");
-            if (second_token) {
-                if (chdir(second_token) != 0) {
-                    perror("chdir");
-                    if (home == NULL) {
-                        fprintf(stderr, "cd: HOME environment variable not set properly\n");
-                    } else if (chdir(home) != 0) {
-                        perror("chdir");
-                    }
+
+        // Parse and run the pipelines of the line one at a time, in a single
+        // pass over it: each one is expanded only once the one before it has
+        // run. After && or ||, a pipeline whose outcome is already decided is
+        // parsed, and its here-documents read, but it does not run.
+        if (cmd == NULL) {
+            last_status = 1;    // No command matched the history reference
+        } else if (cmdline_check(&line, cmd) == -1) {
+            last_status = 2;    // Syntax error, as in other shells; nothing runs
+            stats_count(STAT_PARSE_ERRORS);
+        } else {
+            cmdline_start(&line, cmd);
+            link_t link = LINK_SEQ;
+            int parsed;
+            while (builtin != BUILTIN_EXIT) {
+                int skip = (link == LINK_AND && last_status != 0) ||
+                           (link == LINK_OR && last_status == 0);
+                uint64_t parse_start = stats_now();
+                parsed = cmdline_parse_next(&line, skip);
+                stats_record(STAT_PARSE_TIME, parse_start);
+                if (parsed == -1) {
+                    last_status = 2;    // Syntax error, as in other shells
+                    break;
+                } else if (parsed == 0) {
+                    break;
                 }
-            } else {
-                if (home == NULL) {
-                    fprintf(stderr, "cd: HOME environment variable not set properly\n");
-                } else if (chdir(home) != 0) {
-                    perror("chdir");
+                const pipeline_t *pipeline = &line.pipelines[0];
+                link = pipeline->link;
+                if (line.nheredocs > 0 &&
+                    cmdline_read_heredocs(&line, &input, heredoc_prompt) == -1) {
+                    last_status = 1;
+                    break;
                 }
-            }
-        }
-        // --- Built-in command: exit ---
-        else if (strcmp(first_token, "exit") == 0) {
-            // Clear the tokens vector and exit the loop.
-            strvec_clear(&tokens);
-            break;
-        }
-        // --- Built-in command: jobs ---
-        else if (strcmp(first_token, "jobs") == 0) {
-            // Print all jobs in the job list along with their status (background or stopped)
-            int i = 0;
-            job_t *current = jobs.head;
-            while (current != NULL) {
-                char *status_desc;
-                if (current->status == BACKGROUND) {
-                    status_desc = "background";
-                } else {
-                    status_desc = "stopped";
+                if (skip) {
+                    continue;
                 }
-                printf("%d: %s (%s)\n", i, current->name, status_desc);
-                i++;
-                current = current->next;
-            }
-        }
-        // --- Built-in command: fg ---
-        else if (strcmp(first_token, "fg") == 0) {
-            // Resume a stopped job in the foreground.
-            if (resume_job(&tokens, &jobs, 1) == -1) {
-                printf("Failed to resume job in foreground\n");
-            }
-        }
-        // --- Built-in command: bg ---
-        else if (strcmp(first_token, "bg") == 0) {
-            // Resume a stopped job in the background.
-            if (resume_job(&tokens, &jobs, 0) == -1) {
-                printf("Failed to resume job in background\n");
-            }
-        }
-        // --- Built-in command: wait-for ---
-        else if (strcmp(first_token, "wait-for") == 0) {
-            // Wait for a specific background job to terminate or stop.
-            if (await_background_job(&tokens, &jobs) == -1) {
-                printf("Failed to wait for background job\n");
-            }
-        }
-        // --- Built-in command: wait-all ---
-        else if (strcmp(first_token, "wait-all") == 0) {
-            // Wait for all background jobs to terminate or stop, then clean them up.
-            if (await_all_background_jobs(&jobs) == -1) {
-                printf("Failed to wait for all background jobs\n");
-            }
-        }
-        // --- Non-built-in command: execute external command ---
-        else {
-            // Check if the last token is "&", which indicates background execution.
-            int background = 0;
-            if (tokens.length > 0 && strcmp(tokens.data[tokens.length - 1], "&") == 0) {
-                background = 1;
-                // Remove the "&" token from the tokens vector using strvec_take.
-                strvec_take(&tokens, tokens.length - 1);
-            }
-
-            int status;
-            // Fork a child process to execute the external command.
-            pid_t cpid = fork();
-            if (cpid < 0) {
-                perror("fork failed.");
-                return 1;
-            } else if (cpid == 0) {
-                // In the child process, call run_command() to execute the command.
-                if (run_command(&tokens) == -1) {
-                    exit(1);
+                // --- Built-in commands run inside the shell itself ---
+                // The stages of a pipeline are handled by run_pipeline() instead,
+                // and so are timed and background commands, which may need the
+                // real program.
+                builtin = BUILTIN_NONE;
+                if (pipeline->ncommands == 1 && !pipeline->background && !pipeline->timed) {
+                    builtin = run_builtin(&pipeline->commands[0], &jobs);
                 }
-                exit(0);
-            } else {
-                // In the parent process, handle background and foreground jobs differently.
-                if (background) {
-                    // For background jobs, do not wait; just add the job to the jobs list.
-                    // (Note: Depending on design, consider duplicating tokens.data[0] if
-                    // necessary.)
-                    job_list_add(&jobs, cpid, tokens.data[0], BACKGROUND);
-                } else {
-                    // For foreground jobs, move the child to the foreground,
-                    // wait for it to complete or stop, and then restore the shell to the
-                    // foreground.
-                    pid_t shell_pid = getpid();
-                    if (setpgid(cpid, cpid) == -1) {
-                        perror("setpgid failed");
-                        return -1;
-                    }
-                    if (tcsetpgrp(STDIN_FILENO, cpid) == -1) {
-                        perror("tcsetpgrp failed");
-                        return -1;
-                    }
-                    pid_t terminated_pid = waitpid(cpid, &status, WUNTRACED);
-                    if (terminated_pid < 0) {
-                        perror("waitpid() failed");
-                        return -1;
-                    }
-                    if (tcsetpgrp(STDIN_FILENO, shell_pid) == -1) {
-                        perror("Restoring parent process group failed");
-                        return -1;
-                    }
-                    // If the process was stopped, add it to the job list as a stopped job.
-                    if (WIFSTOPPED(status)) {
-                        job_list_add(&jobs, cpid, tokens.data[0], status);
-                    }
+                // --- The last command of a script replaces the shell ---
+                // With nothing left to do but exit with its status, the
+                // shell need not start it and wait for it.
+                if (builtin == BUILTIN_NONE && tail_exec && link == LINK_END &&
+                    jobs.length == 0 && line_reader_at_end(&input) &&
+                    exec_pipeline(pipeline) == 0) {
+                    builtin = BUILTIN_EXIT;    // It could not be executed
+                    break;
+                }
+                // --- Non-built-in command: execute external command(s) ---
+                if (builtin == BUILTIN_NONE) {
+                    // Start every stage with the selected launch backend. Foreground
+                    // jobs are waited for; background and stopped ones stay in the job list.
+                    run_pipeline(pipeline, &jobs);
                 }
             }
+            stats_count(parsed == -1 ? STAT_PARSE_ERRORS : STAT_LINES_PARSED);
+        }
+        launch_reap_substitutions();
+        stats_maybe_dump(0);
+        if (builtin == BUILTIN_EXIT) {
+            break;
+        }
+        // Background jobs past their 'timeout' deadline are signalled here
+        // as well as by every wait.
+        job_list_check_timeouts(&jobs);
+        // Reap background jobs that finished or stopped, so that none is
+        // left a zombie, and report them (set -b); then print the prompt for
+        // the next command.
+        reaper_reap(&jobs, shell_options.notify);
+        if (shell_options.interactive) {
+            printf("%s", PROMPT);
+            fflush(stdout);
         }
-        // Print the prompt for the next command.
-        printf("%s", PROMPT);
-        // Clear the tokens vector for the next iteration.
-        strvec_clear(&tokens);
     }
 
-    // Free the job list resources.
+    // Free the command line, job list and path cache resources.
+    cmdline_free(&line);
+    line_reader_free(&input);
+    history_free();
+    stats_maybe_dump(1);
+    stats_free();
     job_list_free(&jobs);
-    return 0;
+    job_shm_close();
+    path_cache_free();
+    env_free();
+    wildcard_free();
+    fork_server_stop();
+    reaper_free();
+    if (input_fd != STDIN_FILENO) {
+        close(input_fd);
+    }
+    // Like other shells, exit with the status of the last command run
+    return last_status;
 }
@@ -3,132 +3,246 @@
 #include "swish_funcs.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "benchmark.h"
+#include "cgroup.h"
+#include "env.h"
+#include "fanout.h"
+#include "fork_server.h"
+#include "history.h"
 #include "job_list.h"
+#include "job_shm.h"
+#include "job_wait.h"
+#include "launch.h"
+#include "parallel.h"
+#include "parser.h"
+#include "path_cache.h"
+#include "placement.h"
+#include "stats.h"
 #include "string_vector.h"
+#include "utilities.h"
 
 #define MAX_ARGS 10
 
 /**
- * tokenize - Breaks input string 's' into tokens (words separated by spaces)
- * and adds each token to the string vector 'tokens'.
+ * open_string - Puts the text of a here-string or here-document in a memfd,
+ * so that neither a temporary file nor a pipe (which could fill up before
+ * the command starts reading) is needed.
  *
- * Returns 0 on success, or -1 if input is invalid or adding a token fails.
+ * Returns the descriptor, positioned at the start of the text, or -1 on error.
  */
-int tokenize(char *s, strvec_t *tokens) {
-    if (!s || !tokens) {
+static int open_string(const char *text) {
+    int fd = memfd_create("swish-heredoc", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
         return -1;
     }
-
-    // Use strtok to split the input string by a single space.
-    char *token = strtok(s, " ");
-    while (token != NULL) {
-        // Add the token to the vector; return -1 on error.
-        if (strvec_add(tokens, token) == -1) {
-            perror("Error: strvec_add");
+    size_t len = strlen(text);
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, text + done, len - done);
+        if (n == -1 && errno != EINTR) {
+            perror("write");
+            close(fd);
             return -1;
         }
-        token = strtok(NULL, " ");
+        done += n > 0 ? n : 0;
     }
-    return 0;
+    lseek(fd, 0, SEEK_SET);
+    return fd;
 }
 
 /**
- * run_command - Executes the command represented by the tokens vector.
- * This function handles input/output redirection, restores default signal
- * handlers, sets the process group, builds the argument array for execvp(),
- * and then calls execvp() to run the external command.
- *
- * Returns 0 if execvp() succeeds (which it never does on success) or -1 if an error occurs.
+ * writes_file - Tells whether a redirection sends a descriptor to a file.
  */
-int run_command(strvec_t *tokens) {
-    // Ensure there is at least one token (the command name).
-    if (tokens->length == 0) {
-        fprintf(stderr, "Error: No command to execute.\n");
-        return -1;
-    }
-
-    // Prepare an argument array (overestimate size is fine).
-    char *args[tokens->length + 1];
-    int in_index = -1, out_index = -1, append_index = -1;
-
-    // Locate redirection operators within tokens.
-    in_index = strvec_find(tokens, "<");
-    out_index = strvec_find(tokens, ">");
-    append_index = strvec_find(tokens, ">>");
+static int writes_file(const redirection_t *r) {
+    return r->kind == REDIR_WRITE || r->kind == REDIR_APPEND;
+}
 
-    // --- Handle Input Redirection ---
-    if (in_index != -1) {
-        if (in_index + 1 >= tokens->length) {
-            perror("Error: No input file specified.\n");
-            return -1;
+/**
+ * fan_out - Sends a descriptor that is redirected to several files, and to
+ * nothing else, to all of them through a fanout helper. Every one of those
+ * redirections gets a copy of the helper's pipe in place of its file, so
+ * installing them from left to right leaves the pipe on the descriptor.
+ *
+ * Returns 0 on success, or -1 if the helper could not be started.
+ */
+static int fan_out(const command_t *cmd, int *fds, int highest) {
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        int target = cmd->redirs[i].fd;
+        unsigned nfiles = 0;
+        for (unsigned j = 0; j < cmd->nredirs; j++) {
+            if (cmd->redirs[j].fd != target) {
+                continue;
+            } else if (!writes_file(&cmd->redirs[j]) || j < i) {
+                nfiles = 0;    // Handled already, or not only files
+                break;
+            }
+            nfiles++;
         }
-        int fd = open(tokens->data[in_index + 1], O_RDONLY);
-        if (fd < 0) {
-            perror("Failed to open input file");
-            return -1;
+        if (nfiles < 2) {
+            continue;
         }
-        if (dup2(fd, STDIN_FILENO) < 0) {
-            perror("dup2 failed for input redirection");
-            close(fd);
+        int sinks[nfiles];
+        unsigned n = 0;
+        for (unsigned j = i; j < cmd->nredirs; j++) {
+            if (cmd->redirs[j].fd == target) {
+                sinks[n++] = fds[j];
+            }
+        }
+        int pipe_fd = fanout_start(sinks, nfiles);
+        if (pipe_fd != -1 && pipe_fd <= highest) {
+            int moved = fcntl(pipe_fd, F_DUPFD_CLOEXEC, highest + 1);
+            if (moved == -1) {
+                perror("fcntl");
+            }
+            close(pipe_fd);
+            pipe_fd = moved;
+        }
+        if (pipe_fd == -1) {
             return -1;
         }
-        close(fd);
+        for (unsigned j = i; j < cmd->nredirs; j++) {
+            if (cmd->redirs[j].fd != target) {
+                continue;
+            }
+            close(fds[j]);
+            fds[j] = --n > 0 ? fcntl(pipe_fd, F_DUPFD_CLOEXEC, highest + 1) : pipe_fd;
+            if (fds[j] == -1) {
+                perror("fcntl");
+                close(pipe_fd);
+                return -1;
+            }
+        }
     }
+    return 0;
+}
 
-    // --- Handle Output Redirection ---
-    if (out_index != -1 || append_index != -1) {
-        int fd_out;
-        if (out_index != -1) {
+/**
+ * open_redirections - Opens the files named by a command's redirections, in
+ * the order they appear, and starts its process substitutions. A
+ * redirection that copies a descriptor opens nothing and gets -1. When one
+ * descriptor is sent to several files, each of them gets everything that is
+ * written to it (see fanout.h).
+ *
+ * Returns 0 on success, or -1 if a file could not be opened (nothing is left open).
+ */
+int open_redirections(const command_t *cmd, int *fds) {
+    // A file must not be opened on a descriptor that a redirection targets,
+    // or installing that redirection would replace it
+    int highest = STDERR_FILENO;
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        if (cmd->redirs[i].fd > highest) {
+            highest = cmd->redirs[i].fd;
+        }
+    }
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        const redirection_t *r = &cmd->redirs[i];
+        fds[i] = -1;
+        if (r->kind == REDIR_DUP) {
+            continue;
+        }
+        int flags = O_RDONLY;
+        if (r->kind == REDIR_WRITE) {
             // '>' operator: open file for writing, create if it doesn't exist, and truncate.
-            if (out_index + 1 >= tokens->length) {
-                perror("Error: No output file specified.\n");
-                return -1;
-            }
-            fd_out =
-                open(tokens->data[out_index + 1], O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-        } else {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        } else if (r->kind == REDIR_APPEND) {
             // ">>" operator: open file for writing, create if it doesn't exist, and append.
-            if (append_index + 1 >= tokens->length) {
-                perror("Error: No output file specified.\n");
-                return -1;
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+        }
+        int fd;
+        if (r->kind == REDIR_STRING) {
+            fd = open_string(r->target);
+        } else if (r->kind == REDIR_PROCSUB) {
+            fd = launch_substitution(r->target);
+        } else if ((fd = open(r->target, flags | O_CLOEXEC, S_IRUSR | S_IWUSR)) == -1) {
+            perror(r->kind == REDIR_READ ? "Failed to open input file"
+                                         : "Failed to open output file");
+        }
+        if (fd >= 0 && highest > STDERR_FILENO && fd <= highest) {
+            int moved = fcntl(fd, F_DUPFD_CLOEXEC, highest + 1);
+            if (moved == -1) {
+                perror("fcntl");
             }
-            fd_out = open(tokens->data[append_index + 1], O_WRONLY | O_CREAT | O_APPEND,
-                          S_IRUSR | S_IWUSR);
+            close(fd);
+            fd = moved;
         }
-        if (fd_out < 0) {
-            perror("Failed to open output file");
+        if (fd < 0) {
+            close_redirections(cmd, fds, i);
             return -1;
         }
-        if (dup2(fd_out, STDOUT_FILENO) < 0) {
-            perror("dup2 failed for output redirection");
-            close(fd_out);
-            return -1;
+        fds[i] = fd;
+    }
+    if (fan_out(cmd, fds, highest) == -1) {
+        close_redirections(cmd, fds, cmd->nredirs);
+        return -1;
+    }
+    return 0;
+}
+
+void close_redirections(const command_t *cmd, int *fds, unsigned n) {
+    for (unsigned i = 0; i < n; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+            fds[i] = -1;
         }
-        close(fd_out);
     }
+}
 
-    // --- Build Argument List for execvp() ---
-    // Skip any tokens that are redirection operators and their arguments.
-    int j = 0;
-    for (int i = 0; i < tokens->length; i++) {
-        if ((in_index != -1 && (i == in_index || i == in_index + 1)) ||
-            (out_index != -1 && (i == out_index || i == out_index + 1)) ||
-            (append_index != -1 && (i == append_index || i == append_index + 1))) {
-            continue;
+/**
+ * run_command - Executes a command of the parsed command line.
+ * This function handles input/output redirection, restores default signal
+ * handlers, sets the process group, and then calls execvp() to run the
+ * external command.
+ *
+ * Returns 0 if execvp() succeeds (which it never does on success) or -1 if an error occurs.
+ */
+int run_command(const command_t *cmd) {
+    return run_command_in_group(cmd, NULL, 0);
+}
+
+/**
+ * run_command_in_group - Same as run_command(), but joins the process group
+ * 'pgid' instead of creating a new one when pgid is nonzero. Later stages of a
+ * pipeline use this to join the group led by the first stage. The fork
+ * backend opens the redirections in the shell and passes them in 'opened', so
+ * that process substitutions are children of the shell.
+ */
+int run_command_in_group(const command_t *cmd, const int *opened, pid_t pgid) {
+    // Ensure there is a command name.
+    if (cmd->argc == 0) {
+        fprintf(stderr, "Error: No command to execute.\n");
+        return -1;
+    }
+
+    // --- Apply the redirections from left to right ---
+    int fds[cmd->nredirs + 1];
+    if (opened != NULL) {
+        memcpy(fds, opened, cmd->nredirs * sizeof(int));
+    } else if (open_redirections(cmd, fds) == -1) {
+        return -1;
+    }
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        int source = fds[i] != -1 ? fds[i] : cmd->redirs[i].dup_fd;
+        if (dup2(source, cmd->redirs[i].fd) < 0) {
+            perror("dup2 failed for redirection");
+            close_redirections(cmd, fds, cmd->nredirs);
+            return -1;
         }
-        args[j++] = tokens->data[i];
     }
-    args[j] = NULL;    // Null-terminate the array.
+    close_redirections(cmd, fds, cmd->nredirs);
 
     // --- Restore Default Signal Handlers for SIGTTIN and SIGTTOU ---
     struct sigaction dft_sig_action;
@@ -145,22 +259,155 @@ int run_command(strvec_t *tokens) {
     }
 
     // --- Set Process Group ---
-    // Make the child process its own process group leader.
+    // Make the child process its own process group leader, or join the group
+    // of the pipeline it belongs to.
     pid_t pid = getpid();
-    if (setpgid(pid, pid) == -1) {
+    if (setpgid(pid, pgid == 0 ? pid : pgid) == -1) {
         perror("setpgid");
         return -1;
     }
 
     // --- Execute the Command ---
-    if (execvp(args[0], args) < 0) {
+    // Use the hashed location when there is one. If that file has vanished,
+    // fall back to a full PATH search. The command's own assignments are
+    // added to the environment of this copy of the shell only.
+    if (cmd->nassigns > 0) {
+        environ = env_envp_with(cmd->assigns, cmd->nassigns);
+    }
+    const char *path = path_cache_lookup(cmd->argv[0]);
+    if (path != NULL && path != cmd->argv[0]) {
+        execv(path, cmd->argv);
+    }
+    if (execvp(cmd->argv[0], cmd->argv) < 0) {
+        int exec_errno = errno;
         perror("exec");
-        _exit(1);    // Use _exit() in the child to avoid flushing parent's buffers.
+        // Use _exit() in the child to avoid flushing parent's buffers.
+        _exit(exec_errno == ENOENT ? 127 : 126);
     }
 
     return 0;    // Not reached if execvp() succeeds.
 }
 
+/**
+ * wait_job - Blocks until none of a job's processes are running any more,
+ * either because they have exited or because they have stopped. Every state
+ * change is recorded in the job, so a job whose processes stop one at a time
+ * (e.g., a pipeline receiving SIGTSTP) is not reported as stopped until all
+ * of them have. A job with a 'timeout' deadline, or a wait with a limit of
+ * its own, is waited for by polling the timers together with SIGCHLD.
+ *
+ * Returns 0 on success, 1 if 'wait_timer' expired first, or -1 if wait4()
+ * fails.
+ */
+static int wait_job(job_t *job, int wait_timer) {
+    uint64_t start = stats_now();
+    if (job->timer_fd != -1 || wait_timer != -1) {
+        int ret = job_wait_timed(job, wait_timer);
+        stats_record(STAT_WAIT_TIME, start);
+        return ret;
+    }
+    while (job_count_procs(job, PROC_RUNNING) > 0) {
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-job->pid, &status, WUNTRACED, &usage);
+        if (pid < 0) {
+            perror("wait4");
+            return -1;
+        }
+        job_update_proc(job, pid, status, &usage);
+    }
+    stats_record(STAT_WAIT_TIME, start);
+    return 0;
+}
+
+/**
+ * give_terminal - Makes 'pgid' the foreground process group of the terminal,
+ * timing how long that takes.
+ *
+ * Returns 0 on success, or -1 if tcsetpgrp() fails.
+ */
+static int give_terminal(pid_t pgid) {
+    uint64_t start = stats_now();
+    int ret = tcsetpgrp(STDIN_FILENO, pgid);
+    stats_record(STAT_TCSETPGRP_TIME, start);
+    return ret;
+}
+
+/**
+ * job_is_done - Returns nonzero once every process of the job has exited.
+ */
+static int job_is_done(const job_t *job) {
+    return job_count_procs(job, PROC_DONE) == job->nprocs;
+}
+
+// Usage of the most recent job that finished in the foreground, for 'time'
+static job_usage_t last_foreground_usage;
+static int have_foreground_usage = 0;
+
+/**
+ * usage_seconds - Converts a job's usage into seconds of wall-clock, user and
+ * system time. A job that is still running is measured up to now.
+ */
+static void usage_seconds(const job_usage_t *usage, double *real, double *user, double *sys) {
+    struct timespec end = usage->end;
+    if (end.tv_sec == 0 && end.tv_nsec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    *real = (end.tv_sec - usage->start.tv_sec) + (end.tv_nsec - usage->start.tv_nsec) / 1e9;
+    *user = usage->utime.tv_sec + usage->utime.tv_usec / 1e6;
+    *sys = usage->stime.tv_sec + usage->stime.tv_usec / 1e6;
+}
+
+/**
+ * foreground_job - Gives the terminal to a job, optionally continues it,
+ * waits for it to exit or stop and then takes the terminal back. A job that
+ * exits is removed from the job list; one that stops is marked STOPPED.
+ *
+ * Returns 0 on success, or -1 if an error occurs.
+ */
+static int foreground_job(job_list_t *jobs, unsigned job_index, int send_cont) {
+    job_t *job = job_list_get(jobs, job_index);
+    // Save the shell's process group ID.
+    pid_t shell_pgid = getpgid(0);
+    // Bring the job's process group to the foreground. Without a terminal
+    // (batch mode) there is nothing to hand over.
+    if (shell_options.interactive && give_terminal(job->pid) == -1) {
+        perror("tcsetpgrp");
+        if (send_cont) {
+            return -1;
+        }
+    }
+    job_set_status(job, FOREGROUND);
+    if (send_cont) {
+        // Send SIGCONT to the entire process group of the job.
+        if (job_signal(job, SIGCONT) == -1) {
+            perror("pidfd_send_signal");
+            return -1;
+        }
+        job_mark_running(job);
+    }
+    // Wait for the job to either terminate or stop.
+    int ret = wait_job(job, -1);
+    if (ret == 0) {
+        last_status = job_exit_status(job);
+        if (job_is_done(job)) {
+            last_foreground_usage = job->usage;
+            have_foreground_usage = 1;
+            // If the job terminated, remove it from the job list.
+            job_list_remove(jobs, job_index);
+        } else {
+            // If the job stopped, update its status to a STOPPED constant.
+            job_set_status(job, STOPPED);
+        }
+    }
+    // Restore the shell's process group to the foreground.
+    if (shell_options.interactive && give_terminal(shell_pgid) == -1) {
+        perror("tcsetpgrp");
+        return -1;
+    }
+    return ret;
+}
+
 /**
  * resume_job - Resume a job that has been stopped.
  * If is_foreground is nonzero, resume the job in the foreground (and wait for it).
@@ -186,57 +433,173 @@ int resume_job(strvec_t *tokens, job_list_t *jobs, int is_foreground) {
         fprintf(stderr, "Job index out of bounds\n");
         return -1;
     }
-    // Save the shell's process group ID.
-    pid_t shell_pgid = getpgid(0);
+    // Its process group ID may only be used while one of its processes has
+    // not been reaped; until then no new process can be given that ID.
+    if (job_is_done(job)) {
+        fprintf(stderr, "Job has already finished\n");
+        job_list_remove(jobs, job_index);
+        return -1;
+    }
     if (is_foreground) {
-        // Bring the job's process group to the foreground.
-        if (tcsetpgrp(STDIN_FILENO, job->pid) == -1) {
-            perror("tcsetpgrp");
-            return -1;
-        }
+        return foreground_job(jobs, job_index, 1);
     }
     // Send SIGCONT to the entire process group of the job.
-    if (kill(-job->pid, SIGCONT) == -1) {
-        perror("kill");
+    if (job_signal(job, SIGCONT) == -1) {
+        perror("pidfd_send_signal");
         return -1;
     }
-    if (is_foreground) {
-        int status;
-        // Wait for the job to either terminate or stop.
-        if (waitpid(job->pid, &status, WUNTRACED) < 0) {
-            perror("waitpid");
-            return -1;
+    // For background resumption, simply mark the job as BACKGROUND.
+    job_mark_running(job);
+    job_set_status(job, BACKGROUND);
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    int number;
+} signal_names[] = {
+    {"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+    {"TERM", SIGTERM}, {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+};
+
+/**
+ * parse_signal - Converts a signal given by number or by name, with or without
+ * the "SIG" prefix (e.g., "9", "KILL" or "SIGKILL").
+ *
+ * Returns the signal number, or -1 if it is not valid.
+ */
+static int parse_signal(const char *spec) {
+    char *end;
+    long number = strtol(spec, &end, 10);
+    if (end != spec && *end == '\0') {
+        return number >= 0 && number < NSIG ? (int) number : -1;
+    }
+    if (strncmp(spec, "SIG", 3) == 0) {
+        spec += 3;
+    }
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++) {
+        if (strcmp(spec, signal_names[i].name) == 0) {
+            return signal_names[i].number;
         }
-        // If the job terminated, remove it from the job list.
-        if (WIFEXITED(status) || WIFSIGNALED(status)) {
-            job_list_remove(jobs, job_index);
-        } else if (WIFSTOPPED(status)) {
-            // If the job stopped, update its status to a STOPPED constant.
-            job->status = STOPPED;
+    }
+    return -1;
+}
+
+/**
+ * builtin_kill - Sends a signal (SIGTERM unless given as '-s SIGNAL' or
+ * '-SIGNAL') to jobs named as '%N', N being the index that 'jobs' shows, and
+ * to processes named by pid. Jobs are signalled through their pidfds, so a
+ * job whose processes have been reaped can never hit a process that reused
+ * one of their pids. Like in bash, a stopped job that is sent SIGTERM or
+ * SIGHUP is continued so that it can act on the signal.
+ *
+ * Returns 0 if every target was signalled, 1 if any could not be, or 2 on a
+ * usage error.
+ */
+static int builtin_kill(strvec_t *tokens, job_list_t *jobs) {
+    int sig = SIGTERM;
+    unsigned first = 1;
+    const char *option = strvec_get(tokens, 1);
+    if (option != NULL && strcmp(option, "-s") == 0) {
+        const char *name = strvec_get(tokens, 2);
+        if (name == NULL || (sig = parse_signal(name)) == -1) {
+            fprintf(stderr, "kill: %s: invalid signal specification\n", name == NULL ? "" : name);
+            return 2;
+        }
+        first = 3;
+    } else if (option != NULL && option[0] == '-') {
+        if ((sig = parse_signal(option + 1)) == -1) {
+            fprintf(stderr, "kill: %s: invalid signal specification\n", option + 1);
+            return 2;
+        }
+        first = 2;
+    }
+    if (first >= tokens->length) {
+        fprintf(stderr, "Usage: kill [-s signal | -signal] %%job | pid...\n");
+        return 2;
+    }
+
+    int status = 0;
+    for (unsigned i = first; i < tokens->length; i++) {
+        const char *target = tokens->data[i];
+        char *end;
+        if (target[0] == '%') {
+            long job_index = strtol(target + 1, &end, 10);
+            job_t *job = end == target + 1 || *end != '\0' || job_index < 0
+                             ? NULL
+                             : job_list_get(jobs, (unsigned) job_index);
+            if (job == NULL) {
+                fprintf(stderr, "kill: %s: no such job\n", target);
+                status = 1;
+            } else if (job_signal(job, sig) == -1 ||
+                       (job->status == STOPPED && (sig == SIGTERM || sig == SIGHUP) &&
+                        job_signal(job, SIGCONT) == -1)) {
+                fprintf(stderr, "kill: %s: %s\n", target, strerror(errno));
+                status = 1;
+            }
+            continue;
+        }
+        long pid = strtol(target, &end, 10);
+        if (end == target || *end != '\0') {
+            fprintf(stderr, "kill: %s: arguments must be process or job IDs\n", target);
+            status = 1;
+        } else if (kill((pid_t) pid, sig) == -1) {
+            fprintf(stderr, "kill: (%ld) - %s\n", pid, strerror(errno));
+            status = 1;
         }
-        // Restore the shell's process group to the foreground.
-        if (tcsetpgrp(STDIN_FILENO, shell_pgid) == -1) {
-            perror("tcsetpgrp");
+    }
+    return status;
+}
+
+/**
+ * parse_duration - Converts a duration such as "10", "0.5s", "2m", "1h" or
+ * "1d" (seconds unless a unit is given), as timeout(1) accepts them.
+ *
+ * Returns 0 on success, or -1 if it is malformed.
+ */
+static int parse_duration(const char *s, struct timespec *duration) {
+    static const double unit_seconds[] = {1, 60, 60 * 60, 24 * 60 * 60};
+    const char *units = "smhd";
+    char *end;
+    errno = 0;
+    double seconds = strtod(s, &end);
+    if (end == s || errno != 0 || !(seconds >= 0)) {
+        return -1;
+    }
+    if (*end != '\0') {
+        const char *unit = strchr(units, *end);
+        if (unit == NULL || end[1] != '\0') {
             return -1;
         }
-    } else {
-        // For background resumption, simply mark the job as BACKGROUND.
-        job->status = BACKGROUND;
+        seconds *= unit_seconds[unit - units];
+    }
+    if (seconds > 1e9) {
+        return -1;
     }
+    duration->tv_sec = (time_t) seconds;
+    duration->tv_nsec = (long) ((seconds - duration->tv_sec) * 1e9);
     return 0;
 }
 
 /**
  * await_background_job - Wait for a specific background job to terminate or stop.
  *
- * tokens: token vector containing the command (e.g., "wait-for 0").
+ * tokens: token vector containing the command (e.g., "wait-for 0"), which
+ *         may end in "--timeout DURATION".
  * jobs: the job list structure.
  *
- * Returns 0 on success, or -1 if an error occurs.
+ * Returns 0 on success, 1 if the timeout expired first (the job is left
+ * running), or -1 if an error occurs.
  */
 int await_background_job(strvec_t *tokens, job_list_t *jobs) {
-    if (tokens->length < 2) {
-        fprintf(stderr, "Usage: wait-for <job_number>\n");
+    struct timespec limit;
+    if (tokens->length < 2 ||
+        (tokens->length > 2 && (strcmp(tokens->data[2], "--timeout") != 0 ||
+                                tokens->length != 4 ||
+                                parse_duration(tokens->data[3], &limit) == -1))) {
+        fprintf(stderr, "Usage: wait-for <job_number> [--timeout DURATION]\n");
         return -1;
     }
     int job_index;
@@ -254,47 +617,1229 @@ int await_background_job(strvec_t *tokens, job_list_t *jobs) {
         fprintf(stderr, "Job index is for stopped process not background process\n");
         return -1;
     }
-    int status;
-    // Wait for the job's process to change state.
-    if (waitpid(job->pid, &status, WUNTRACED) < 0) {
-        perror("waitpid");
+    // Wait for the job's processes to change state.
+    int wait_timer = -1;
+    if (tokens->length == 4 && (wait_timer = job_timer_create(&limit)) == -1) {
         return -1;
     }
+    int ret = wait_job(job, wait_timer);
+    if (wait_timer != -1) {
+        close(wait_timer);
+    }
+    if (ret != 0) {
+        return ret;
+    }
     // If the job terminated, remove it from the job list.
-    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+    if (job_is_done(job)) {
         job_list_remove(jobs, job_index);
+    } else {
+        job_set_status(job, STOPPED);
     }
     return 0;
 }
 
 /**
  * await_all_background_jobs - Wait for all background jobs to either terminate or stop.
- * First, iterate through the job list and update the status of each background job.
- * Then, remove all jobs that remain in the BACKGROUND state (indicating termination).
+ * Jobs are handled in the order they complete rather than in list order, so
+ * with 'set -b' each one is reported as soon as it is done; the ones that
+ * terminated are removed from the job list and the stopped ones are marked STOPPED.
  *
  * Returns 0 on success, or -1 if an error occurs.
  */
 int await_all_background_jobs(job_list_t *jobs) {
-    // First pass: Update statuses for each background job.
-    job_t *current = jobs->head;
-    while (current != NULL) {
+    return job_wait_background(jobs, 0, shell_options.notify, NULL) == -1 ? -1 : 0;
+}
+
+/**
+ * await_any_background_job - Wait until one background job terminates or
+ * stops and report it. The status is that job's, or 127 if there were no
+ * background jobs to wait for.
+ *
+ * Returns the status, or -1 if an error occurs.
+ */
+int await_any_background_job(job_list_t *jobs) {
+    int status = 127;
+    int n = job_wait_background(jobs, 1, 1, &status);
+    if (n == -1) {
+        return -1;
+    }
+    if (n == 0) {
+        fprintf(stderr, "wait-any: no background jobs\n");
+    }
+    return status;
+}
+
+/**
+ * print_jobs - Print all jobs in the job list along with their status
+ * (background or stopped). With 'jobs -v' each line also shows the job's
+ * elapsed time and the CPU time and peak memory of its exited processes.
+ */
+static int print_jobs(strvec_t *tokens, job_list_t *jobs) {
+    int verbose = 0;
+    const char *option = strvec_get(tokens, 1);
+    if (option != NULL) {
+        if (strcmp(option, "-v") != 0 || tokens->length > 2) {
+            fprintf(stderr, "jobs: usage: jobs [-v]\n");
+            return -1;
+        }
+        verbose = 1;
+    }
+    for (unsigned i = 0; i < jobs->length; i++) {
+        job_t *current = job_list_get(jobs, i);
+        char *status_desc;
         if (current->status == BACKGROUND) {
-            int status;
-            // Wait for the background job; WUNTRACED ensures we can detect if it stops.
-            if (waitpid(current->pid, &status, WUNTRACED) < 0) {
-                perror("waitpid");
-                return -1;
-            }
-            if (WIFSTOPPED(status)) {
-                // If the job stops, update its status to a STOPPED constant.
-                current->status = STOPPED;
+            status_desc = "background";
+        } else {
+            status_desc = "stopped";
+        }
+        if (!verbose) {
+            printf("%u: %s (%s)\n", i, current->name, status_desc);
+            continue;
+        }
+        double real, user, sys;
+        usage_seconds(&current->usage, &real, &user, &sys);
+        printf("%u: %s (%s) real %.3fs user %.3fs sys %.3fs maxrss %ld KiB\n", i, current->name,
+               status_desc, real, user, sys, current->usage.maxrss);
+        if (current->cgroup != NULL) {
+            cgroup_print_usage(current->cgroup);
+        }
+    }
+    return 0;
+}
+
+/**
+ * print_duration - Prints one line of the 'time' report in bash's format.
+ */
+static void print_duration(const char *label, double seconds) {
+    int minutes = (int) (seconds / 60);
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - 60 * minutes);
+}
+
+static int run_stages(const pipeline_t *pipeline, job_list_t *jobs);
+
+/**
+ * time_pipeline - Implements the 'time' keyword. The pipeline (which may be
+ * a builtin) runs in the foreground, and then its wall-clock time, CPU time
+ * and peak memory are reported on stderr. These come from the same wait4()
+ * accounting that 'jobs -v' shows; a command that ran entirely inside the
+ * shell only has a wall-clock time.
+ *
+ * Returns 0 on success, or -1 if the pipeline is a background job or fails.
+ */
+static int time_pipeline(const pipeline_t *pipeline, job_list_t *jobs) {
+    if (pipeline->background) {
+        fprintf(stderr, "time: cannot time a background job\n");
+        last_status = 1;
+        return -1;
+    }
+
+    job_usage_t usage;
+    memset(&usage, 0, sizeof(job_usage_t));
+    clock_gettime(CLOCK_MONOTONIC, &usage.start);
+    have_foreground_usage = 0;
+    int ret = run_stages(pipeline, jobs);
+    if (have_foreground_usage) {
+        usage = last_foreground_usage;
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &usage.end);
+    }
+
+    double real, user, sys;
+    usage_seconds(&usage, &real, &user, &sys);
+    fflush(stdout);
+    print_duration("real", real);
+    print_duration("user", user);
+    print_duration("sys", sys);
+    fprintf(stderr, "maxrss\t%ld KiB\n", usage.maxrss);
+    return ret;
+}
+
+/**
+ * change_directory - Change directory: if a second token is provided, use it;
+ * otherwise, change to the home directory specified by the HOME environment variable.
+ */
+static int change_directory(strvec_t *tokens) {
+    const char *second_token = strvec_get(tokens, 1);
+    const char *home = getenv("HOME");
+    if (second_token) {
+        if (chdir(second_token) != 0) {
+            perror("chdir");
+            if (home == NULL) {
+                fprintf(stderr, "cd: HOME environment variable not set properly\n");
+            } else if (chdir(home) != 0) {
+                perror("chdir");
             }
-            // For terminated jobs (WIFEXITED/WIFSIGNALED), leave the status as BACKGROUND.
+            return -1;
+        }
+    } else {
+        if (home == NULL) {
+            fprintf(stderr, "cd: HOME environment variable not set properly\n");
+            return -1;
+        } else if (chdir(home) != 0) {
+            perror("chdir");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+shell_options_t shell_options = {
+    .interactive = 1,
+    .notify = 0,
+};
+
+int last_status = 0;
+
+/**
+ * set_builtin - Implements 'set'. With no arguments the current options are
+ * listed; "-b"/"+b" (or "-o notify"/"+o notify") turn the reports
+ * of background jobs reaped between prompts on or off.
+ *
+ * Returns 0 on success, or -1 if an option is not recognized.
+ */
+int set_builtin(strvec_t *tokens) {
+    if (tokens->length == 1) {
+        printf("notify\t%s\n", shell_options.notify ? "on" : "off");
+        return 0;
+    }
+    for (int i = 1; i < tokens->length; i++) {
+        const char *arg = tokens->data[i];
+        const char *name = arg + 1;
+        if ((arg[0] == '-' || arg[0] == '+') && strcmp(name, "o") == 0) {
+            name = strvec_get(tokens, ++i);
+        } else if (strcmp(name, "b") == 0) {
+            name = "notify";
+        }
+        if ((arg[0] != '-' && arg[0] != '+') || name == NULL || strcmp(name, "notify") != 0) {
+            fprintf(stderr, "set: %s: invalid option\n", arg);
+            return -1;
+        }
+        shell_options.notify = arg[0] == '-';
+    }
+    return 0;
+}
+
+// --- Builtin table ---
+
+#define BUILTIN_SLOTS 64    // Must be a power of two
+
+typedef struct {
+    const char *name;    // NULL for an empty slot
+    builtin_func_t func;
+    int flags;
+} builtin_entry_t;
+
+// Open-addressing hash table of the registered builtins
+static builtin_entry_t builtin_table[BUILTIN_SLOTS];
+static unsigned builtin_count = 0;
+static int builtins_registered = 0;
+static int exit_requested = 0;    // Set by 'exit' while it runs
+
+static unsigned builtin_name_hash(const char *name) {
+    uint32_t h = 2166136261u;    // FNV-1a
+    for (; *name != '\0'; name++) {
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    }
+    return h & (BUILTIN_SLOTS - 1);
+}
+
+static builtin_entry_t *builtin_slot(const char *name) {
+    unsigned i = builtin_name_hash(name);
+    while (builtin_table[i].name != NULL && strcmp(builtin_table[i].name, name) != 0) {
+        i = (i + 1) & (BUILTIN_SLOTS - 1);
+    }
+    return &builtin_table[i];
+}
+
+int builtin_register(const char *name, builtin_func_t func, int flags) {
+    builtin_entry_t *entry = builtin_slot(name);
+    if (entry->name == NULL) {
+        // Keep the table at most half full so that probes stay short
+        if (2 * (builtin_count + 1) > BUILTIN_SLOTS) {
+            fprintf(stderr, "builtin_register: too many builtins\n");
+            return -1;
         }
-        current = current->next;
+        builtin_count++;
+    }
+    entry->name = name;
+    entry->func = func;
+    entry->flags = flags;
+    return 0;
+}
+
+/**
+ * builtin_pwd - Prints the current working directory.
+ */
+static int builtin_pwd(strvec_t *args, job_list_t *jobs) {
+    char *buffer = getcwd(NULL, 0);
+    if (buffer == NULL) {
+        perror("getcwd");
+        return 1;
     }
-    // Second pass: Remove all jobs that are still marked as BACKGROUND.
-    // These represent jobs that have terminated.
-    job_list_remove_by_status(jobs, BACKGROUND);
+    printf("%s\n", buffer);
+    free(buffer);
     return 0;
 }
+
+static int builtin_cd(strvec_t *args, job_list_t *jobs) {
+    return change_directory(args) == 0 ? 0 : 1;
+}
+
+/**
+ * builtin_exit - Asks the shell to exit with the given status, or with that
+ * of the last command.
+ */
+static int builtin_exit(strvec_t *args, job_list_t *jobs) {
+    exit_requested = 1;
+    return args->length > 1 ? atoi(args->data[1]) & 0xff : last_status;
+}
+
+/**
+ * exec_program - Replaces the shell with a program whose descriptors are
+ * already in place. Its TTY signals get back the default dispositions that
+ * the shell ignores, it runs on the CPUs of jobs, and whatever the shell
+ * still had to write (buffered output, the statistics file) is written
+ * first. The fork server is stopped rather than left to the program to reap.
+ * The job table's file is deleted, and created again if the exec fails.
+ *
+ * Returns only if the program could not be executed, which has been
+ * reported, with its status: 127 if it was not found, 126 otherwise.
+ */
+static int exec_program(char **argv, char **envp) {
+    fflush(stdout);
+    stats_maybe_dump(1);
+    job_shm_unlink();    // The program is not the shell, and has no jobs to publish
+    if (launch_get_backend() == LAUNCH_SERVER) {
+        fork_server_stop();
+        launch_set_backend(LAUNCH_SPAWN);    // In case the exec fails
+    }
+    struct sigaction action, saved_ttin, saved_ttou;
+    action.sa_handler = SIG_DFL;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    sigaction(SIGTTIN, &action, &saved_ttin);
+    sigaction(SIGTTOU, &action, &saved_ttou);
+    int entered = placement_enter_job_cpus();
+
+    const char *path = path_cache_lookup(argv[0]);
+    if (path != NULL && path != argv[0]) {
+        execve(path, argv, envp);
+    }
+    execvpe(argv[0], argv, envp);
+    int exec_errno = errno;
+    perror("exec");
+    job_shm_relink();
+    placement_leave_job_cpus(entered);
+    sigaction(SIGTTIN, &saved_ttin, NULL);
+    sigaction(SIGTTOU, &saved_ttou, NULL);
+    return exec_errno == ENOENT ? 127 : 126;
+}
+
+/**
+ * builtin_exec - With a command, replaces the shell with it, taking along the
+ * redirections that run_builtin() has applied and the assignments. Without
+ * one, the redirections stay in place for the rest of the shell's life. As
+ * in other shells, a non-interactive shell exits if the command cannot be
+ * executed.
+ */
+static int builtin_exec(strvec_t *args, job_list_t *jobs) {
+    if (args->length == 1) {
+        return 0;
+    }
+    int status = exec_program(args->data + 1, env_envp());
+    exit_requested = !shell_options.interactive;
+    return status;
+}
+
+static int builtin_jobs(strvec_t *args, job_list_t *jobs) {
+    return print_jobs(args, jobs) == 0 ? 0 : 1;
+}
+
+/**
+ * builtin_fg - Resumes a stopped job in the foreground; on success the status
+ * is the job's own.
+ */
+static int builtin_fg(strvec_t *args, job_list_t *jobs) {
+    if (resume_job(args, jobs, 1) == -1) {
+        printf("Failed to resume job in foreground\n");
+        return 1;
+    }
+    return last_status;
+}
+
+static int builtin_bg(strvec_t *args, job_list_t *jobs) {
+    if (resume_job(args, jobs, 0) == -1) {
+        printf("Failed to resume job in background\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int builtin_wait_for(strvec_t *args, job_list_t *jobs) {
+    int ret = await_background_job(args, jobs);
+    if (ret == -1) {
+        printf("Failed to wait for background job\n");
+        return 1;
+    }
+    return ret == 1 ? TIMEOUT_STATUS : 0;
+}
+
+static int builtin_wait_any(strvec_t *args, job_list_t *jobs) {
+    int status = await_any_background_job(jobs);
+    if (status == -1) {
+        printf("Failed to wait for a background job\n");
+        return 1;
+    }
+    return status;
+}
+
+static int builtin_wait_all(strvec_t *args, job_list_t *jobs) {
+    if (await_all_background_jobs(jobs) == -1) {
+        printf("Failed to wait for all background jobs\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int builtin_hash(strvec_t *args, job_list_t *jobs) {
+    return hash_builtin(args) == 0 ? 0 : 1;
+}
+
+static int builtin_set(strvec_t *args, job_list_t *jobs) {
+    return set_builtin(args) == 0 ? 0 : 1;
+}
+
+/**
+ * builtin_parallel - Like GNU parallel, the status is the number of failed
+ * commands (at most 101), or 255 if parallel itself failed.
+ */
+static int builtin_parallel(strvec_t *args, job_list_t *jobs) {
+    int failed = parallel_builtin(args, jobs);
+    return failed < 0 ? 255 : failed > 101 ? 101 : failed;
+}
+
+/**
+ * register_builtins - Fills the builtin table on first use.
+ */
+static void register_builtins(void) {
+    if (builtins_registered) {
+        return;
+    }
+    builtins_registered = 1;
+    builtin_register("pwd", builtin_pwd, BUILTIN_PURE);
+    builtin_register("cd", builtin_cd, BUILTIN_SHELL_STATE);
+    builtin_register("exit", builtin_exit, BUILTIN_SHELL_STATE);
+    builtin_register("exec", builtin_exec, BUILTIN_ALONE | BUILTIN_SHELL_STATE);
+    builtin_register("jobs", builtin_jobs, BUILTIN_PURE);
+    builtin_register("fg", builtin_fg, 0);
+    builtin_register("bg", builtin_bg, 0);
+    builtin_register("kill", builtin_kill, 0);
+    builtin_register("wait-for", builtin_wait_for, 0);
+    builtin_register("wait-any", builtin_wait_any, 0);
+    builtin_register("wait-all", builtin_wait_all, 0);
+    builtin_register("hash", builtin_hash, 0);
+    builtin_register("set", builtin_set, 0);
+    builtin_register("parallel", builtin_parallel, 0);
+    history_register();
+    env_register();
+    stats_register();
+    utilities_register();
+}
+
+/**
+ * find_builtin - Looks up a registered builtin in constant expected time.
+ */
+static const builtin_entry_t *find_builtin(const char *name) {
+    register_builtins();
+    const builtin_entry_t *entry = builtin_slot(name);
+    return entry->name == NULL ? NULL : entry;
+}
+
+int is_builtin(const char *name) {
+    return find_builtin(name) != NULL;
+}
+
+int builtin_flags(const char *name) {
+    const builtin_entry_t *builtin = find_builtin(name);
+    return builtin == NULL ? -1 : builtin->flags;
+}
+
+#define FD_WAS_CLOSED (-2)    // swap_fd() result for a target that was not open
+
+/**
+ * swap_fd - Points 'target' at 'fd' for the duration of a builtin, returning
+ * a copy of the original to restore it from, FD_WAS_CLOSED if the target was
+ * not open, or -1 on error.
+ */
+static int swap_fd(int fd, int target) {
+    int saved = fcntl(target, F_DUPFD_CLOEXEC, 10);
+    if (saved == -1 && errno == EBADF) {
+        saved = FD_WAS_CLOSED;
+    }
+    if (saved == -1 || dup2(fd, target) == -1) {
+        perror("dup2");
+        if (saved >= 0) {
+            close(saved);
+        }
+        return -1;
+    }
+    return saved;
+}
+
+static void restore_fd(int saved, int target) {
+    if (saved == FD_WAS_CLOSED) {
+        close(target);
+    } else if (saved != -1) {
+        dup2(saved, target);
+        close(saved);
+    }
+}
+
+/**
+ * gives_way - Decides whether a utility builtin should leave a command to the
+ * program of the same name: in the background, and whenever it would read
+ * standard input from a pipe (the shell runs its builtin stages one after
+ * the other) or from the terminal (where the program can be stopped as a job).
+ */
+static int gives_way(const builtin_entry_t *builtin, const command_t *cmd, int reads_pipe,
+                     int background) {
+    if ((builtin->flags & BUILTIN_UTILITY) && background) {
+        return 1;
+    }
+    if (!(builtin->flags & BUILTIN_READS_INPUT)) {
+        return 0;
+    }
+    // Such a builtin reads stdin when it has no operands or one of them is "-"
+    int redirected = 0, dash = 0;
+    for (unsigned i = 1; i < cmd->argc; i++) {
+        dash |= strcmp(cmd->argv[i], "-") == 0;
+    }
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        redirected |= cmd->redirs[i].fd == STDIN_FILENO;
+    }
+    if (cmd->argc > 1 && !dash) {
+        return 0;
+    }
+    return reads_pipe || (!redirected && isatty(STDIN_FILENO));
+}
+
+/**
+ * apply_redirections - Points the shell's own descriptors at a builtin's
+ * redirections, from left to right, saving each original in 'saved' so that
+ * restore_redirections() can put it back.
+ *
+ * Returns 0 on success, or -1 if a descriptor could not be redirected.
+ */
+static int apply_redirections(const command_t *cmd, const int *fds, int *saved) {
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        saved[i] = -1;
+    }
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        const redirection_t *r = &cmd->redirs[i];
+        if ((saved[i] = swap_fd(fds[i] != -1 ? fds[i] : r->dup_fd, r->fd)) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void restore_redirections(const command_t *cmd, int *saved) {
+    for (unsigned i = cmd->nredirs; i-- > 0;) {
+        restore_fd(saved[i], cmd->redirs[i].fd);
+    }
+}
+
+/**
+ * keep_redirections - Leaves a builtin's redirections in place for good,
+ * dropping the originals that apply_redirections() saved.
+ */
+static void keep_redirections(const command_t *cmd, int *saved) {
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        if (saved[i] >= 0) {
+            close(saved[i]);
+        }
+    }
+}
+
+/**
+ * run_builtin - Runs a command inside the shell process if it names a
+ * builtin, and records its status in last_status (0 on success).
+ * Redirections are applied by pointing the shell's own descriptors at the
+ * files until the builtin returns. A command made only of redirections
+ * runs here too: like in other shells, it just opens (and creates) the files.
+ *
+ * Returns BUILTIN_NONE if it is not a builtin, BUILTIN_EXIT for 'exit', and
+ * BUILTIN_DONE once any other builtin has run.
+ */
+int run_builtin(const command_t *cmd, job_list_t *jobs) {
+    const builtin_entry_t *builtin = cmd->argc == 0 ? NULL : find_builtin(cmd->argv[0]);
+    if (cmd->argc > 0 && (builtin == NULL || gives_way(builtin, cmd, 0, 0))) {
+        return BUILTIN_NONE;
+    }
+    exit_requested = 0;
+    if (builtin != NULL) {
+        stats_count(STAT_BUILTINS_RUN);
+    }
+    int fds[cmd->nredirs + 1], saved[cmd->nredirs + 1];
+    if (open_redirections(cmd, fds) == -1) {
+        fanout_wait();
+        last_status = 1;
+        return BUILTIN_DONE;
+    }
+    if (builtin == NULL) {
+        // Assignments on their own set shell variables
+        close_redirections(cmd, fds, cmd->nredirs);
+        fanout_wait();
+        last_status = env_assign(cmd->assigns, cmd->nassigns) == -1 ? 1 : 0;
+        return BUILTIN_DONE;
+    }
+    strvec_t args = {
+        .length = cmd->argc,
+        .capacity = cmd->argc,
+        .data = cmd->argv,
+        .arena = NULL,
+    };
+
+    fflush(stdout);
+    int ok = apply_redirections(cmd, fds, saved) == 0;
+    close_redirections(cmd, fds, cmd->nredirs);
+    unsigned mark = env_begin_temporary(cmd->assigns, cmd->nassigns);
+    last_status = ok ? builtin->func(&args, jobs) : 1;
+    env_end_temporary(mark);
+    fflush(stdout);
+    if (builtin->flags & BUILTIN_ALONE) {
+        keep_redirections(cmd, saved);
+    } else {
+        restore_redirections(cmd, saved);
+    }
+    fanout_wait();    // The output is all in the files once the helpers exit
+    return exit_requested ? BUILTIN_EXIT : BUILTIN_DONE;
+}
+
+/**
+ * runs_in_shell - Decides whether a stage of a pipeline is run by a builtin
+ * inside the shell.
+ */
+static int runs_in_shell(const command_t *stage, int reads_pipe, int background) {
+    if (stage->argc == 0) {
+        return 1;    // Redirections only
+    }
+    const builtin_entry_t *builtin = find_builtin(stage->argv[0]);
+    return builtin != NULL && !gives_way(builtin, stage, reads_pipe, background);
+}
+
+/**
+ * run_builtin_stage - Runs a builtin that is one stage of a pipeline inside
+ * the shell, with its standard output temporarily pointed at the pipe to the
+ * next stage. Builtin stages are never given the pipe from the previous one.
+ */
+static void run_builtin_stage(const command_t *stage, job_list_t *jobs, int out_fd) {
+    if (stage->argc > 0 && (builtin_flags(stage->argv[0]) & BUILTIN_ALONE)) {
+        fprintf(stderr, "%s: only runs as a command of its own\n", stage->argv[0]);
+        last_status = 1;
+        return;
+    }
+    if (out_fd == -1) {
+        run_builtin(stage, jobs);
+        return;
+    }
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    if (saved_stdout == -1 || dup2(out_fd, STDOUT_FILENO) == -1) {
+        perror("dup2");
+        if (saved_stdout != -1) {
+            close(saved_stdout);
+        }
+        return;
+    }
+    // A downstream stage that exits early must not take the shell down with SIGPIPE
+    struct sigaction ignore, saved_pipe;
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    ignore.sa_flags = 0;
+    sigaction(SIGPIPE, &ignore, &saved_pipe);
+
+    run_builtin(stage, jobs);
+    fflush(stdout);
+
+    sigaction(SIGPIPE, &saved_pipe, NULL);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+/**
+ * fork_builtin_stage - Runs a builtin that changes the shell (such as 'cd')
+ * as one stage of a longer pipeline in a child, which joins process group
+ * 'pgid' (or leads a new one if it is 0) and takes the pipe ends in_fd and
+ * out_fd, so the shell itself is left as it was. In the child, 'exec' just
+ * runs its command.
+ *
+ * Returns the child's pid, or -1 if fork() fails.
+ */
+static pid_t fork_builtin_stage(const command_t *stage, job_list_t *jobs, pid_t pgid, int in_fd,
+                                int out_fd) {
+    fflush(stdout);
+    pid_t cpid = fork();
+    if (cpid < 0) {
+        perror("fork failed.");
+        errno = 0;
+        return -1;
+    } else if (cpid == 0) {
+        setpgid(0, pgid);
+        if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+            (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1)) {
+            perror("dup2");
+            _exit(1);
+        }
+        if (builtin_flags(stage->argv[0]) & BUILTIN_ALONE) {
+            command_t command = *stage;
+            command.argv++;
+            command.argc--;
+            if (command.argc > 0) {
+                run_command_in_group(&command, NULL, pgid);
+                _exit(1);    // Only reached if run_command() failed before exec
+            }
+            run_builtin(&command, jobs);    // Redirections only
+        } else {
+            run_builtin(stage, jobs);
+        }
+        fflush(stdout);
+        _exit(last_status);
+    }
+    if (setpgid(cpid, pgid == 0 ? cpid : pgid) == -1 && errno != EACCES) {
+        perror("setpgid");
+    }
+    return cpid;
+}
+
+/**
+ * release_cgroup - Removes a cgroup that no job ended up running in.
+ */
+static void release_cgroup(char *cgroup) {
+    if (cgroup != NULL) {
+        rmdir(cgroup);
+        free(cgroup);
+    }
+}
+
+// The deadline that 'timeout' gives the job start_stages() starts next
+static struct {
+    int set;
+    struct timespec after;
+    struct timespec grace;
+} next_timeout;
+
+/**
+ * start_stages - Runs the stages of a pipeline. All external stages are
+ * started at once in one process group, connected by pipes, and tracked as a
+ * single job; builtin stages run inside the shell once the external stages
+ * are up, except for those that change the shell, which join the job as
+ * children of their own. A foreground pipeline is waited for here, while a background one
+ * is left in the job list. With a cgroup or a placement, every stage is an
+ * external process that joins the cgroup and applies the placement, and the
+ * job owns the cgroup from then on.
+ *
+ * Returns 0 on success, or -1 if an error occurs.
+ */
+static int start_stages(const pipeline_t *pipeline, job_list_t *jobs, char *cgroup,
+                        const placement_t *placement) {
+    int procs_fd = -1;
+    if (cgroup != NULL) {
+        if ((procs_fd = cgroup_open_procs(cgroup)) == -1) {
+            release_cgroup(cgroup);
+            last_status = 1;
+            return -1;
+        }
+        launch_set_cgroup(procs_fd);
+    }
+    launch_set_placement(placement);
+    const command_t *stages = pipeline->commands;
+    unsigned nstages = pipeline->ncommands;
+    int background = pipeline->background;
+    launch_set_terminal(shell_options.interactive && !background ? STDIN_FILENO : -1);
+    // Each external stage may start fanout helpers, which join the job after
+    // every stage; a helper needs at least two redirections
+    unsigned max_helpers = 0;
+    for (unsigned s = 0; s < nstages; s++) {
+        max_helpers += stages[s].nredirs / 2;
+    }
+    pid_t pids[nstages], helpers[max_helpers + 1];
+    unsigned npids = 0, nhelpers = 0;
+    const char *name = NULL;    // Job name: the first external stage's program
+    int stage_in[nstages], stage_out[nstages], in_shell[nstages];
+    int prev_read = -1;
+    int ret = 0;
+    for (unsigned s = 0; s < nstages; s++) {
+        stage_in[s] = prev_read;
+        stage_out[s] = -1;
+        prev_read = -1;
+        if (s + 1 < nstages) {
+            int pipe_fds[2];
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+                perror("pipe");
+                if (stage_in[s] != -1) {
+                    close(stage_in[s]);
+                }
+                nstages = s;
+                ret = -1;
+                break;
+            }
+            stage_out[s] = pipe_fds[1];
+            prev_read = pipe_fds[0];
+        }
+        int in_child = nstages > 1 && stages[s].argc > 0 && is_builtin(stages[s].argv[0]) &&
+                       (builtin_flags(stages[s].argv[0]) & BUILTIN_SHELL_STATE);
+        in_shell[s] = !in_child && cgroup == NULL && placement == NULL && !next_timeout.set &&
+                      runs_in_shell(&stages[s], stage_in[s] != -1, background);
+        if (in_shell[s]) {
+            continue;    // Run below, once every external stage is up
+        }
+        pid_t pgid = npids == 0 ? 0 : pids[0];
+        pid_t pid = in_child ? fork_builtin_stage(&stages[s], jobs, pgid, stage_in[s], stage_out[s])
+                             : launch_command(&stages[s], pgid, stage_in[s], stage_out[s]);
+        if (pid != -1) {
+            if (npids == 0) {
+                name = stages[s].argv[0];
+            }
+            pids[npids++] = pid;
+            unsigned taken = fanout_take(helpers + nhelpers, max_helpers - nhelpers);
+            for (unsigned h = nhelpers; h < nhelpers + taken; h++) {
+                setpgid(helpers[h], pids[0]);
+            }
+            nhelpers += taken;
+        } else if (s + 1 == nstages) {
+            // As in other shells: 127 if the program was not found, 126 if it
+            // could not be executed, 1 if setting up the command failed
+            last_status = errno == ENOENT ? 127 : errno != 0 ? 126 : 1;
+        }
+        if (stage_in[s] != -1) {
+            close(stage_in[s]);
+        }
+        if (stage_out[s] != -1) {
+            close(stage_out[s]);
+        }
+        stage_in[s] = stage_out[s] = -1;
+        fanout_wait();    // Only left if the stage did not start
+    }
+    launch_set_placement(NULL);
+    launch_set_terminal(-1);
+    if (procs_fd != -1) {
+        launch_set_cgroup(-1);
+        close(procs_fd);
+    }
+
+    // Builtins do not read standard input. Closing every read end first means
+    // a builtin writing to another one gets EPIPE instead of filling a pipe
+    // that nothing will ever drain.
+    for (unsigned s = 0; s < nstages; s++) {
+        if (stage_in[s] != -1) {
+            close(stage_in[s]);
+        }
+    }
+    for (unsigned s = 0; s < nstages; s++) {
+        if (in_shell[s]) {
+            run_builtin_stage(&stages[s], jobs, stage_out[s]);
+            if (stage_out[s] != -1) {
+                close(stage_out[s]);
+            }
+        }
+    }
+
+    if (npids == 0) {
+        release_cgroup(cgroup);
+        return ret;
+    }
+    pid_t procs[npids + nhelpers];
+    memcpy(procs, pids, npids * sizeof(pid_t));
+    memcpy(procs + npids, helpers, nhelpers * sizeof(pid_t));
+    if (job_list_add_group(jobs, procs, npids + nhelpers, name,
+                           background ? BACKGROUND : FOREGROUND) == -1) {
+        fprintf(stderr, "Failed to add job to job list\n");
+        if (shell_options.interactive && !background) {
+            give_terminal(getpgrp());    // The first stage took it
+        }
+        release_cgroup(cgroup);
+        return -1;
+    }
+    job_t *job = job_list_get(jobs, jobs->length - 1);
+    job->nstages = npids;
+    job->cgroup = cgroup;
+    if (next_timeout.set) {
+        // Without a timer the job just runs without a deadline
+        job_set_timeout(job, &next_timeout.after, &next_timeout.grace);
+    }
+    if (background) {
+        last_status = 0;
+    } else if (foreground_job(jobs, jobs->length - 1, 0) == -1) {
+        return -1;
+    }
+    return ret;
+}
+
+#define RUN_USAGE                                                                       \
+    "run: usage: run [--cpu PERCENT] [--mem SIZE] [--io WEIGHT] [--cpus LIST] [--nice N]\n" \
+    "                [--sched POLICY] [--node N] command [args...]\n"
+
+/**
+ * parse_run_options - Parses the options of 'run', each of which is either a
+ * cgroup limit or a placement.
+ *
+ * Returns the number of words taken by "run" and its options, or -1 if they
+ * are malformed or no command follows them, which has been reported.
+ */
+static int parse_run_options(char **argv, cgroup_limits_t *limits, placement_t *placement) {
+    memset(limits, 0, sizeof(cgroup_limits_t));
+    placement_init(placement);
+    int i = 1;
+    for (; argv[i] != NULL && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        int taken = cgroup_parse_option(limits, argv[i], argv[i + 1]);
+        if (taken == 0) {
+            taken = placement_parse_option(placement, argv[i], argv[i + 1]);
+        }
+        if (taken == -1) {
+            return -1;
+        } else if (taken == 0) {
+            if (argv[i + 1] != NULL) {
+                fprintf(stderr, "run: %s: invalid option\n", argv[i]);
+            }
+            fprintf(stderr, RUN_USAGE);
+            return -1;
+        }
+        i++;
+    }
+    if (argv[i] == NULL) {
+        fprintf(stderr, RUN_USAGE);
+        return -1;
+    }
+    return i;
+}
+
+/**
+ * run_with_options - Runs a pipeline that starts with 'run' with the limits
+ * and placement given by its options. The job gets a cgroup of its own when
+ * a limit is given, or when no option is, so that its usage is accounted
+ * for. Builtins other than the utilities cannot be limited, since they run
+ * inside the shell.
+ *
+ * Returns 0 on success, or -1 if an error occurs.
+ */
+static int run_with_options(const pipeline_t *pipeline, job_list_t *jobs) {
+    cgroup_limits_t limits;
+    placement_t placement;
+    const command_t *first = &pipeline->commands[0];
+    int skip = parse_run_options(first->argv, &limits, &placement);
+    if (skip == -1) {
+        last_status = 2;
+        return -1;
+    }
+    command_t stages[pipeline->ncommands];
+    memcpy(stages, pipeline->commands, pipeline->ncommands * sizeof(command_t));
+    stages[0].argv += skip;
+    stages[0].argc -= skip;
+    for (unsigned s = 0; s < pipeline->ncommands; s++) {
+        const builtin_entry_t *builtin =
+            stages[s].argc == 0 ? NULL : find_builtin(stages[s].argv[0]);
+        if (builtin != NULL && !(builtin->flags & BUILTIN_UTILITY)) {
+            fprintf(stderr, "run: %s: cannot limit a shell builtin\n", stages[s].argv[0]);
+            last_status = 1;
+            return -1;
+        }
+    }
+    pipeline_t limited = *pipeline;
+    limited.commands = stages;
+
+    int placed = placement_is_set(&placement);
+    char *cgroup = NULL;
+    if ((cgroup_limits_set(&limits) || !placed) && (cgroup = cgroup_create(&limits)) == NULL) {
+        last_status = 1;
+        return -1;
+    }
+    return start_stages(&limited, jobs, cgroup, placed ? &placement : NULL);
+}
+
+#define TIMEOUT_USAGE "timeout: usage: timeout [-k DURATION] DURATION command [args...]\n"
+#define TIMEOUT_GRACE 5    // Seconds from SIGTERM to SIGKILL, unless -k gives another time
+
+/**
+ * parse_timeout_options - Parses "timeout [-k DURATION] DURATION".
+ *
+ * Returns the number of words they take, or -1 if they are malformed or no
+ * command follows them, which has been reported.
+ */
+static int parse_timeout_options(char **argv, struct timespec *after, struct timespec *grace) {
+    *grace = (struct timespec){.tv_sec = TIMEOUT_GRACE};
+    const char *bad = NULL;    // A malformed duration
+    int i = 1;
+    if (argv[i] != NULL && strcmp(argv[i], "-k") == 0) {
+        if (argv[i + 1] == NULL || parse_duration(argv[i + 1], grace) == -1) {
+            bad = argv[i + 1];
+            goto usage;
+        }
+        i += 2;
+    }
+    if (argv[i] == NULL || argv[i + 1] == NULL) {
+        goto usage;
+    } else if (parse_duration(argv[i], after) == -1) {
+        bad = argv[i];
+        goto usage;
+    }
+    return i + 1;
+
+usage:
+    if (bad != NULL) {
+        fprintf(stderr, "timeout: %s: invalid duration\n", bad);
+    }
+    fprintf(stderr, TIMEOUT_USAGE);
+    return -1;
+}
+
+/**
+ * run_with_timeout - Runs a pipeline that starts with 'timeout', which gives
+ * its job a deadline (see job_set_timeout()). The rest of the pipeline may
+ * itself start with 'run'. As with timeout(1), a duration of 0 means no
+ * deadline, and -k 0 means no SIGKILL after the SIGTERM.
+ *
+ * Returns 0 on success, or -1 if an error occurs.
+ */
+static int run_with_timeout(const pipeline_t *pipeline, job_list_t *jobs) {
+    struct timespec after, grace;
+    int skip = parse_timeout_options(pipeline->commands[0].argv, &after, &grace);
+    if (skip == -1) {
+        last_status = 2;
+        return -1;
+    }
+    command_t stages[pipeline->ncommands];
+    memcpy(stages, pipeline->commands, pipeline->ncommands * sizeof(command_t));
+    stages[0].argv += skip;
+    stages[0].argc -= skip;
+    for (unsigned s = 0; s < pipeline->ncommands; s++) {
+        const builtin_entry_t *builtin =
+            stages[s].argc == 0 ? NULL : find_builtin(stages[s].argv[0]);
+        if (builtin != NULL && !(builtin->flags & BUILTIN_UTILITY)) {
+            fprintf(stderr, "timeout: %s: cannot time out a shell builtin\n", stages[s].argv[0]);
+            last_status = 1;
+            return -1;
+        }
+    }
+    pipeline_t limited = *pipeline;
+    limited.commands = stages;
+
+    next_timeout.set = after.tv_sec != 0 || after.tv_nsec != 0;
+    next_timeout.after = after;
+    next_timeout.grace = grace;
+    int ret = run_stages(&limited, jobs);
+    next_timeout.set = 0;
+    return ret;
+}
+
+/**
+ * run_with_bench - Runs a pipeline that starts with 'bench' the given number
+ * of times and reports how long the runs took (see benchmark.h). The rest of
+ * the pipeline may itself start with 'run' or 'timeout'. Each run is timed
+ * like 'time' times a pipeline, but the wall-clock time starts before the
+ * pipeline is launched, so that launch backends can be compared.
+ *
+ * Returns 0 on success, or -1 if an error occurs or a run fails.
+ */
+static int run_with_bench(const pipeline_t *pipeline, job_list_t *jobs) {
+    bench_options_t options;
+    int skip = bench_parse_options(pipeline->commands[0].argv, &options);
+    if (skip == -1) {
+        last_status = 2;
+        return -1;
+    }
+    if (pipeline->background) {
+        fprintf(stderr, "bench: cannot benchmark a background job\n");
+        last_status = 1;
+        return -1;
+    }
+    launch_backend_t saved_backend = launch_get_backend();
+    if (options.backend != NULL && launch_set_backend_by_name(options.backend) == -1) {
+        fprintf(stderr, "bench: %s: unknown launch backend\n", options.backend);
+        last_status = 2;
+        return -1;
+    }
+    bench_sample_t *samples = malloc(options.runs * sizeof(bench_sample_t));
+    if (samples == NULL) {
+        perror("malloc");
+        launch_set_backend(saved_backend);
+        last_status = 1;
+        return -1;
+    }
+    command_t stages[pipeline->ncommands];
+    memcpy(stages, pipeline->commands, pipeline->ncommands * sizeof(command_t));
+    stages[0].argv += skip;
+    stages[0].argc -= skip;
+    pipeline_t measured = *pipeline;
+    measured.commands = stages;
+
+    int ret = 0;
+    unsigned nsamples = 0;
+    for (unsigned run = 0; run < options.warmup + options.runs; run++) {
+        struct timespec start, end;
+        have_foreground_usage = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = run_stages(&measured, jobs);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (ret == -1 || last_status != 0) {
+            fprintf(stderr, "bench: run %u failed with status %d\n", run + 1, last_status);
+            last_status = last_status == 0 ? 1 : last_status;
+            ret = -1;
+            break;
+        }
+        if (run < options.warmup) {
+            continue;
+        }
+        bench_sample_t *sample = &samples[nsamples++];
+        sample->user = sample->sys = 0;    // A builtin that ran in the shell
+        if (have_foreground_usage) {
+            double ignored;
+            usage_seconds(&last_foreground_usage, &ignored, &sample->user, &sample->sys);
+        }
+        sample->real = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    launch_set_backend(saved_backend);
+    if (ret == 0) {
+        fflush(stdout);
+        bench_report(samples, nsamples);
+    }
+    free(samples);
+    return ret;
+}
+
+/**
+ * run_stages - Runs the stages of a pipeline, with the limits and placement
+ * of 'run' or the deadline of 'timeout' if it starts with one of them, or
+ * repeatedly if it starts with 'bench'.
+ *
+ * Returns 0 on success, or -1 if an error occurs.
+ */
+static int run_stages(const pipeline_t *pipeline, job_list_t *jobs) {
+    const command_t *first = &pipeline->commands[0];
+    if (first->argc > 0 && strcmp(first->argv[0], "run") == 0) {
+        return run_with_options(pipeline, jobs);
+    }
+    if (first->argc > 0 && strcmp(first->argv[0], "timeout") == 0) {
+        return run_with_timeout(pipeline, jobs);
+    }
+    if (first->argc > 0 && strcmp(first->argv[0], "bench") == 0) {
+        return run_with_bench(pipeline, jobs);
+    }
+    return start_stages(pipeline, jobs, NULL, NULL);
+}
+
+/**
+ * run_pipeline - Runs one pipeline of a parsed command line, timing it if it
+ * started with 'time'.
+ *
+ * Returns 0 on success, or -1 if an error occurs.
+ */
+int run_pipeline(const pipeline_t *pipeline, job_list_t *jobs) {
+    if (pipeline->timed) {
+        return time_pipeline(pipeline, jobs);
+    }
+    return run_stages(pipeline, jobs);
+}
+
+/**
+ * exec_pipeline - Replaces the shell with the last command of a script
+ * instead of starting it and waiting only to exit with its status. That is
+ * left to run_pipeline() for anything the shell has to stay around for: a
+ * builtin, a prefix such as 'run', a background or timed job, and output
+ * fanned out to several files, whose helper has to finish writing before
+ * the script is over.
+ *
+ * Returns -1 if the pipeline has to be run normally, or 0 if the command
+ * could not be executed.
+ */
+int exec_pipeline(const pipeline_t *pipeline) {
+    const command_t *cmd = &pipeline->commands[0];
+    if (pipeline->ncommands != 1 || pipeline->background || pipeline->timed || cmd->argc == 0 ||
+        find_builtin(cmd->argv[0]) != NULL || strcmp(cmd->argv[0], "run") == 0 ||
+        strcmp(cmd->argv[0], "timeout") == 0 || strcmp(cmd->argv[0], "bench") == 0) {
+        return -1;
+    }
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        for (unsigned j = i + 1; j < cmd->nredirs; j++) {
+            if (cmd->redirs[i].fd == cmd->redirs[j].fd && writes_file(&cmd->redirs[i]) &&
+                writes_file(&cmd->redirs[j])) {
+                return -1;
+            }
+        }
+    }
+
+    int fds[cmd->nredirs + 1];
+    if (open_redirections(cmd, fds) == -1) {
+        last_status = 1;
+        return 0;
+    }
+    for (unsigned i = 0; i < cmd->nredirs; i++) {
+        int source = fds[i] != -1 ? fds[i] : cmd->redirs[i].dup_fd;
+        if (dup2(source, cmd->redirs[i].fd) == -1) {
+            perror("dup2 failed for redirection");
+            close_redirections(cmd, fds, cmd->nredirs);
+            last_status = 1;
+            return 0;
+        }
+    }
+    close_redirections(cmd, fds, cmd->nredirs);
+    char **envp = cmd->nassigns > 0 ? env_envp_with(cmd->assigns, cmd->nassigns) : env_envp();
+    last_status = exec_program(cmd->argv, envp);
+    return 0;
+}
+
+/**
+ * hash_builtin - Implements the 'hash' builtin on top of the path cache.
+ *   hash               List the cached commands with their hit counts
+ *   hash -r            Forget every cached location
+ *   hash -d name       Forget the location of 'name'
+ *   hash -p path name  Use 'path' whenever 'name' is run
+ *   hash name...       Look up each name now so later runs skip the PATH search
+ *
+ * Returns 0 on success, or -1 if an option is malformed or a name is not found.
+ */
+int hash_builtin(strvec_t *tokens) {
+    if (tokens->length == 1) {
+        path_cache_print();
+        return 0;
+    }
+    const char *flag = tokens->data[1];
+    if (strcmp(flag, "-r") == 0) {
+        path_cache_clear();
+        return 0;
+    } else if (strcmp(flag, "-d") == 0) {
+        if (tokens->length < 3) {
+            fprintf(stderr, "Usage: hash -d <name>\n");
+            return -1;
+        }
+        if (path_cache_forget(tokens->data[2]) == -1) {
+            fprintf(stderr, "hash: %s: not found\n", tokens->data[2]);
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(flag, "-p") == 0) {
+        if (tokens->length < 4 || strchr(tokens->data[3], '/') != NULL) {
+            fprintf(stderr, "Usage: hash -p <path> <name>\n");
+            return -1;
+        }
+        return path_cache_set(tokens->data[3], tokens->data[2]);
+    }
+
+    int ret = 0;
+    for (int i = 1; i < tokens->length; i++) {
+        // Like bash, seeding an entry searches PATH afresh and resets its hit count
+        path_cache_forget(tokens->data[i]);
+        const char *path = path_cache_lookup(tokens->data[i]);
+        if (path == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", tokens->data[i]);
+            ret = -1;
+        } else if (path != tokens->data[i]) {
+            path_cache_set(tokens->data[i], path);
+        }
+    }
+    return ret;
+}
@@ -5,28 +5,47 @@
 #define SWISH_FUNCS_H
 
 #include "job_list.h"
+#include "parser.h"
 #include "string_vector.h"
 
 /*
- * Task 0
- * Divide a string with substrings separated by a single space (" ")
- * into tokens. These tokens should be stored in the 'tokens' vector using
- * "strvec_add".
- * s: String to tokenize
- * vec: Pointer to vector in which to store tokens. Must be initialized
- *      before this function is called.
- * Returns 0 on success or -1 on error
+ * Open the files named by a command's redirections, in the order they apply
+ * Here-strings and here-documents are put in a memfd, and each process
+ * substitution is started with a pipe to read its output from
+ * cmd: The command whose redirections to open
+ * fds: Array with room for cmd->nredirs entries; entry i is set to the
+ *      descriptor opened for redirection i (close-on-exec), or -1 if that
+ *      redirection copies a descriptor instead of opening a file
+ * Returns 0 on success or -1 on error, in which case no descriptors are left open
+ */
+int open_redirections(const command_t *cmd, int *fds);
+
+/*
+ * Close descriptors opened by open_redirections()
+ * cmd: The command whose redirections were opened
+ * fds: The descriptors set by open_redirections(); closed entries become -1
+ * n: Number of entries of fds to close, from the start
  */
-int tokenize(char *s, strvec_t *tokens);
+void close_redirections(const command_t *cmd, int *fds, unsigned n);
 
 /*
  * Task 2: Run a user-specified command (including arguments)
  * This should be called within a CHILD process of the shell
- * tokens: Vector containing tokens input by user into shell
+ * cmd: A command of the parsed command line
  * Doesn't return on success (similar to exec) or returns -1 on error
  * Task 3: Improve this function to perform input/output redirection
  */
-int run_command(strvec_t *tokens);
+int run_command(const command_t *cmd);
+
+/*
+ * Same as run_command(), but joins an existing process group
+ * cmd: A command of the parsed command line
+ * opened: The command's redirections as opened by open_redirections() before
+ *         the fork, or NULL to open them here
+ * pgid: Process group to join, or 0 to become the leader of a new group
+ * Doesn't return on success (similar to exec) or returns -1 on error
+ */
+int run_command_in_group(const command_t *cmd, const int *opened, pid_t pgid);
 
 /*
  * Task 5: Resume a stopped (paused) process
@@ -43,8 +62,10 @@ int resume_job(strvec_t *tokens, job_list_t *jobs, int is_foreground);
  * Task 6: Block the calling shell process until a specific background job
  * stops running (either is stopped or exits).
  * If the job process exits, remove it from the jobs list.
- * tokens: Tokens from the command typed in by the user (e.g., "wait-for 2")
- * Returns 0 on success or -1 on error
+ * tokens: Tokens from the command typed in by the user (e.g., "wait-for 2"),
+ *         optionally followed by "--timeout DURATION"
+ * Returns 0 on success, 1 if the timeout expired first (the job keeps
+ * running), or -1 on error
  */
 int await_background_job(strvec_t *tokens, job_list_t *jobs);
 
@@ -59,4 +80,120 @@ int await_background_job(strvec_t *tokens, job_list_t *jobs);
  */
 int await_all_background_jobs(job_list_t *jobs);
 
+/*
+ * Block the calling shell process until any one background job stops running
+ * (either is stopped or exits), and print a line saying which one it was
+ * Remove the job from the jobs list if it exited
+ * jobs: Pointer to the list of current jobs for the shell
+ * Returns the job's exit status (127 if there was no background job) or -1
+ * on failure
+ */
+int await_any_background_job(job_list_t *jobs);
+
+// Options changed at runtime with the 'set' builtin
+typedef struct {
+    int interactive;    // Prompts and terminal control; 0 in batch mode
+    int notify;         // set -b: report background jobs reaped between prompts
+} shell_options_t;
+
+extern shell_options_t shell_options;
+
+// Status of the most recent foreground command or builtin, as reported by $?
+extern int last_status;
+
+/*
+ * Show or change shell options, e.g. "set -b" or "set +o notify"
+ * tokens: Tokens from the command typed in by the user
+ * Returns 0 on success or -1 on error
+ */
+int set_builtin(strvec_t *tokens);
+
+/*
+ * A command run inside the shell process
+ * args: The command's arguments, without any redirections (those have been
+ *       applied to stdin and stdout already), starting with its name
+ * jobs: The list of current jobs for the shell
+ * Returns the command's exit status, 0 on success
+ */
+typedef int (*builtin_func_t)(strvec_t *args, job_list_t *jobs);
+
+// Flags for builtin_register()
+#define BUILTIN_UTILITY 0x1        // Stands in for a program; the program runs in the background
+#define BUILTIN_READS_INPUT 0x2    // Reads stdin; the program runs when stdin would be a pipe
+#define BUILTIN_PURE 0x4           // Changes nothing in the shell, so $(...) runs it in the shell
+#define BUILTIN_ALONE 0x8          // Its redirections stay on the shell ('exec'), so it only runs as
+                                   // a command of its own
+#define BUILTIN_SHELL_STATE 0x10   // Changes the shell itself, so as one stage of a longer pipeline
+                                   // it runs in a child, like in other shells
+
+/*
+ * Add a builtin to the table used by run_builtin(), replacing any builtin of
+ * the same name
+ * name: The command name; the string must stay valid for the shell's lifetime
+ * func: The function implementing the command
+ * flags: A combination of the BUILTIN_* flags above, or 0
+ * Returns 0 on success or -1 if the table is full
+ */
+int builtin_register(const char *name, builtin_func_t func, int flags);
+
+#define BUILTIN_NONE 0    // Not a builtin; run it as an external command
+#define BUILTIN_DONE 1    // The builtin ran inside the shell
+#define BUILTIN_EXIT 2    // The 'exit' builtin asked the shell to terminate
+
+/*
+ * Check whether a command name refers to a builtin
+ * name: The command name (first token of a command)
+ * Returns 1 if it is a builtin, 0 otherwise
+ */
+int is_builtin(const char *name);
+
+/*
+ * Look up the flags a builtin was registered with
+ * name: The command name
+ * Returns its BUILTIN_* flags, or -1 if it is not a builtin
+ */
+int builtin_flags(const char *name);
+
+/*
+ * Run a builtin command inside the shell process, applying its redirections
+ * to the shell's own descriptors while it runs
+ * A command made only of redirections also runs here and just opens the files
+ * cmd: A command of the parsed command line (e.g., "cd /tmp")
+ * jobs: The list of current jobs for the shell
+ * Returns BUILTIN_NONE if cmd does not name a builtin, BUILTIN_EXIT if the
+ * shell should exit, or BUILTIN_DONE otherwise
+ */
+int run_builtin(const command_t *cmd, job_list_t *jobs);
+
+/*
+ * Run a pipeline of one or more stages separated by '|'
+ * All external stages are started at once in a single process group and
+ * tracked as one job; builtin stages run inside the shell. A pipeline that
+ * started with 'time' is timed, and one that ended with '&' is left running
+ * in the background.
+ * pipeline: A pipeline of the parsed command line
+ * jobs: The list of current jobs for the shell
+ * Returns 0 on success or -1 on error
+ */
+int run_pipeline(const pipeline_t *pipeline, job_list_t *jobs);
+
+/*
+ * Run the last pipeline of a non-interactive shell by replacing the shell
+ * with it, when it is a simple external command in the foreground; its
+ * redirections and assignments are applied to the shell itself first, so
+ * no process is forked for it and none is waited for
+ * pipeline: The last pipeline of the script or 'swish -c' command
+ * Returns -1 if the pipeline is not such a command, in which case it has to
+ * be run with run_pipeline(); otherwise only returns if the command could
+ * not be executed, with 0 and last_status set
+ */
+int exec_pipeline(const pipeline_t *pipeline);
+
+/*
+ * List, clear or pre-seed the cache of command locations found in $PATH
+ * tokens: Tokens from the command typed in by the user (e.g., "hash -r")
+ * Returns 0 on success or -1 on error
+ */
+int hash_builtin(strvec_t *tokens);
+
 #endif    // SWISH_FUNCS_H
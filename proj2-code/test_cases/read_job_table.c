@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Prints the jobs in a shell's shared-memory job table, the way a supervisor
+// would read them (see job_shm.h), except for the job running this program
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../job_shm.h"
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: <table_file>\n");
+        return 1;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(argv[1]);
+        return 1;
+    }
+    const job_shm_t *table = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (table->magic != JOB_SHM_MAGIC || table->version != JOB_SHM_VERSION) {
+        fprintf(stderr, "%s: not a job table\n", argv[1]);
+        return 1;
+    }
+
+    static job_shm_entry_t jobs[JOB_SHM_SLOTS];
+    unsigned n = job_shm_snapshot(table, jobs, JOB_SHM_SLOTS);
+    static const char *states[] = {"stopped", "background", "foreground", "done"};
+    unsigned others = 0;
+    for (unsigned i = 0; i < n; i++) {
+        others += jobs[i].pgid != getpgrp();
+    }
+    printf("%u jobs\n", others);
+    for (unsigned i = 0; i < n; i++) {
+        if (jobs[i].pgid == getpgrp()) {
+            continue;
+        }
+        printf("%u: %s (%s) %u/%u processes done", jobs[i].id, jobs[i].name,
+               states[jobs[i].state], jobs[i].ndone, jobs[i].nprocs);
+        if (jobs[i].exit_status != -1) {
+            printf(", status %d", jobs[i].exit_status);
+        }
+        printf("\n");
+    }
+    return 0;
+}
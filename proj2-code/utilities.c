@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "utilities.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "swish_funcs.h"
+
+#define COPY_CHUNK (1 << 20)    // Bytes per sendfile() or splice() call
+
+/**
+ * builtin_echo - Prints the arguments separated by spaces; "-n" as the first
+ * argument leaves out the trailing newline.
+ */
+static int builtin_echo(strvec_t *args, job_list_t *jobs) {
+    unsigned first = 1;
+    int newline = 1;
+    if (args->length > 1 && strcmp(args->data[1], "-n") == 0) {
+        newline = 0;
+        first = 2;
+    }
+    for (unsigned i = first; i < args->length; i++) {
+        if (i > first) {
+            putchar(' ');
+        }
+        fputs(args->data[i], stdout);
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 0;
+}
+
+static int builtin_true(strvec_t *args, job_list_t *jobs) {
+    return 0;
+}
+
+static int builtin_false(strvec_t *args, job_list_t *jobs) {
+    return 1;
+}
+
+/**
+ * print_escape - Prints the character for the backslash escape starting at
+ * 'p' (which points at the backslash) and returns a pointer to the last
+ * character of the escape.
+ */
+static const char *print_escape(const char *p) {
+    static const char escapes[] = "a\ab\bf\fn\nr\rt\tv\v\\\\\"\"";
+    const char *e;
+    if (p[1] == '\0') {
+        putchar('\\');
+        return p;
+    }
+    if (p[1] >= '0' && p[1] <= '7') {
+        // Octal escape: up to three digits, with an optional leading 0 as in \0NNN
+        const char *d = p + 1;
+        int max_digits = *d == '0' ? 4 : 3;
+        int value = 0;
+        for (int n = 0; n < max_digits && *d >= '0' && *d <= '7'; n++, d++) {
+            value = value * 8 + (*d - '0');
+        }
+        putchar(value & 0xff);
+        return d - 1;
+    }
+    for (e = escapes; *e != '\0'; e += 2) {
+        if (*e == p[1]) {
+            putchar(e[1]);
+            return p + 1;
+        }
+    }
+    // Unknown escapes are printed as they are
+    putchar('\\');
+    putchar(p[1]);
+    return p + 1;
+}
+
+/**
+ * parse_number - Converts a printf argument to a number. A leading quote
+ * gives the value of the following character, as in POSIX printf.
+ */
+static long long parse_number(const char *arg, int *status) {
+    if (arg == NULL) {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char) arg[1];
+    }
+    char *end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 0);
+    if (end == arg || *end != '\0' || errno != 0) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+/**
+ * builtin_printf - Formats and prints its arguments. The format is reused
+ * until every argument has been consumed; missing arguments count as empty
+ * strings or zero.
+ */
+static int builtin_printf(strvec_t *args, job_list_t *jobs) {
+    if (args->length < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    const char *format = args->data[1];
+    unsigned next = 2;
+    int status = 0;
+    do {
+        int consumed = 0;
+        for (const char *p = format; *p != '\0'; p++) {
+            if (*p == '\\') {
+                p = print_escape(p);
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p++;
+                continue;
+            }
+            // Copy the flags, width and precision of the conversion
+            char spec[32];
+            size_t n = 0;
+            spec[n++] = *p++;
+            while (*p != '\0' && strchr("-+ #0", *p) != NULL && n < 8) {
+                spec[n++] = *p++;
+            }
+            while (isdigit((unsigned char) *p) && n < 16) {
+                spec[n++] = *p++;
+            }
+            if (*p == '.') {
+                spec[n++] = *p++;
+                while (isdigit((unsigned char) *p) && n < 24) {
+                    spec[n++] = *p++;
+                }
+            }
+
+            const char *arg = NULL;
+            if (next < args->length) {
+                arg = args->data[next++];
+                consumed = 1;
+            }
+            switch (*p) {
+            case 's':
+                spec[n++] = 's';
+                spec[n] = '\0';
+                printf(spec, arg == NULL ? "" : arg);
+                break;
+            case 'b':
+                for (const char *b = arg == NULL ? "" : arg; *b != '\0'; b++) {
+                    if (*b == '\\') {
+                        b = print_escape(b);
+                    } else {
+                        putchar(*b);
+                    }
+                }
+                break;
+            case 'c':
+                spec[n++] = 'c';
+                spec[n] = '\0';
+                if (arg != NULL && arg[0] != '\0') {
+                    printf(spec, arg[0]);
+                }
+                break;
+            case 'd':
+            case 'i':
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = 'd';
+                spec[n] = '\0';
+                printf(spec, parse_number(arg, &status));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = *p;
+                spec[n] = '\0';
+                printf(spec, (unsigned long long) parse_number(arg, &status));
+                break;
+            default:
+                fprintf(stderr, "printf: %%%c: invalid directive\n", *p == '\0' ? ' ' : *p);
+                return 1;
+            }
+        }
+        if (!consumed) {
+            break;    // A format without conversions is printed only once
+        }
+    } while (next < args->length);
+    return status;
+}
+
+/**
+ * copy_fd - Copies everything from in_fd to out_fd. sendfile() is tried first
+ * (a regular file as the source), then splice() (a pipe on either side), and
+ * plain read() and write() when the kernel supports neither for these
+ * descriptors.
+ *
+ * Returns 0 on success or -1 on error, with errno set.
+ */
+static int copy_fd(int in_fd, int out_fd) {
+    enum { USE_SENDFILE, USE_SPLICE, USE_READ } mode = USE_SENDFILE;
+    static char buf[64 * 1024];
+    while (1) {
+        ssize_t n;
+        if (mode == USE_SENDFILE) {
+            n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                mode = USE_SPLICE;
+                continue;
+            }
+        } else if (mode == USE_SPLICE) {
+            n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                mode = USE_READ;
+                continue;
+            }
+        } else {
+            n = read(in_fd, buf, sizeof(buf));
+            for (ssize_t done = 0; n > 0 && done < n;) {
+                ssize_t w = write(out_fd, buf + done, n - done);
+                if (w < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return -1;
+                }
+                done += w;
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+    }
+}
+
+/**
+ * cat_fd - Copies one input to stdout, reporting errors under 'name'.
+ *
+ * Returns 0 on success or 1 on error.
+ */
+static int cat_fd(int fd, const char *name) {
+    if (copy_fd(fd, STDOUT_FILENO) == 0) {
+        return 0;
+    }
+    // Like the real cat when killed by SIGPIPE, stay quiet about a closed pipe
+    if (errno != EPIPE) {
+        fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+    }
+    return 1;
+}
+
+/**
+ * builtin_cat - Copies each named file, or stdin for "-" or no files at all,
+ * to stdout.
+ */
+static int builtin_cat(strvec_t *args, job_list_t *jobs) {
+    fflush(stdout);    // Output is written directly to the descriptor
+    if (args->length == 1) {
+        return cat_fd(STDIN_FILENO, "-");
+    }
+    int status = 0;
+    for (unsigned i = 1; i < args->length; i++) {
+        const char *name = args->data[i];
+        int ret;
+        if (strcmp(name, "-") == 0) {
+            ret = cat_fd(STDIN_FILENO, name);
+        } else {
+            int fd = open(name, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+                ret = 1;
+            } else {
+                ret = cat_fd(fd, name);
+                close(fd);
+            }
+        }
+        status |= ret;
+    }
+    return status;
+}
+
+void utilities_register(void) {
+    builtin_register("echo", builtin_echo, BUILTIN_UTILITY);
+    builtin_register("printf", builtin_printf, BUILTIN_UTILITY);
+    builtin_register("true", builtin_true, BUILTIN_UTILITY);
+    builtin_register("false", builtin_false, BUILTIN_UTILITY);
+    builtin_register("cat", builtin_cat, BUILTIN_UTILITY | BUILTIN_READS_INPUT);
+}
@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+/*
+ * In-process versions of small utilities that scripts run in tight loops:
+ * echo, printf, true, false and cat. They run without a fork() or exec()
+ * and behave like the programs they replace for the common options:
+ *   echo [-n] [args...]
+ *   printf format [args...]    (with %s %b %c %d %i %o %u %x %X %%, flags,
+ *                               width and precision, and backslash escapes)
+ *   true, false
+ *   cat [file...]              ('-' or no file reads stdin)
+ * cat copies with sendfile() or splice() so the data never passes through
+ * user space when the kernel supports it for the descriptors involved.
+ */
+
+/*
+ * Add the utilities to the builtin table
+ */
+void utilities_register(void);
+
+#endif    // UTILITIES_H
@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include "wildcard.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_SLOTS 8
+#define DENTS_SIZE (64 * 1024)    // Bytes of directory entries asked for per getdents64()
+
+// What getdents64() fills its buffer with
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// The names in one directory, except "." and ".."
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char *names;    // Each entry is its d_type, then its name and a '\0'
+    size_t size;
+    size_t capacity;
+    uint64_t last_used;    // 0 while the slot holds nothing
+    unsigned busy;         // Expansions still iterating over it; it is not replaced until 0
+    int cached;            // 0 for a listing that is freed once it has been used
+} listing_t;
+
+// A path being built, always '\0'-terminated
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t capacity;
+} path_t;
+
+static listing_t cache[CACHE_SLOTS];
+static uint64_t use_clock;
+static union {
+    struct linux_dirent64 first;    // For its alignment
+    char bytes[DENTS_SIZE];
+} dents;
+
+int wildcard_is_pattern(const char *pattern) {
+    for (const char *p = pattern; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '*' || *p == '?') {
+            return 1;
+        } else if (*p == '[' && p[1] != '\0' && strchr(p + 2, ']') != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int path_append(path_t *path, const char *s, size_t n) {
+    if (path->len + n + 1 > path->capacity) {
+        size_t new_capacity = path->capacity == 0 ? 256 : path->capacity;
+        while (new_capacity < path->len + n + 1) {
+            new_capacity *= 2;
+        }
+        char *new_buf = realloc(path->buf, new_capacity);
+        if (new_buf == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        path->buf = new_buf;
+        path->capacity = new_capacity;
+    }
+    memcpy(path->buf + path->len, s, n);
+    path->len += n;
+    path->buf[path->len] = '\0';
+    return 0;
+}
+
+static void path_truncate(path_t *path, size_t len) {
+    path->len = len;
+    path->buf[len] = '\0';
+}
+
+/*
+ * Append a part of a pattern without metacharacters, dropping its backslashes
+ */
+static int path_append_literal(path_t *path, const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\\' && i + 1 < n) {
+            i++;
+        }
+        if (path_append(path, s + i, 1) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Read every name in a directory into a listing
+ * Returns 0 on success or -1 on error
+ */
+static int read_listing(int fd, listing_t *l) {
+    long n;
+    l->size = 0;
+    while ((n = syscall(SYS_getdents64, fd, dents.bytes, sizeof(dents.bytes))) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *) (dents.bytes + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            size_t len = strlen(d->d_name);
+            if (l->size + len + 2 > l->capacity) {
+                size_t new_capacity = l->capacity == 0 ? 4096 : l->capacity;
+                while (new_capacity < l->size + len + 2) {
+                    new_capacity *= 2;
+                }
+                char *new_names = realloc(l->names, new_capacity);
+                if (new_names == NULL) {
+                    perror("realloc");
+                    return -1;
+                }
+                l->names = new_names;
+                l->capacity = new_capacity;
+            }
+            l->names[l->size++] = (char) d->d_type;
+            memcpy(l->names + l->size, d->d_name, len + 1);
+            l->size += len + 1;
+        }
+    }
+    if (n == -1) {
+        perror("getdents64");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Find the slot to read a directory into: the one holding an older listing
+ * of the same directory, an empty one, or the least recently used one
+ * Returns the slot, or NULL if every slot is in use
+ */
+static listing_t *pick_slot(const struct stat *st) {
+    listing_t *victim = NULL;
+    for (unsigned i = 0; i < CACHE_SLOTS; i++) {
+        listing_t *l = &cache[i];
+        if (l->busy > 0) {
+            continue;
+        }
+        if (l->last_used != 0 && l->dev == st->st_dev && l->ino == st->st_ino) {
+            return l;
+        }
+        if (victim == NULL || l->last_used < victim->last_used) {
+            victim = l;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Get the listing of a directory, from the cache if it has not changed since
+ * it was read
+ * dir: Path of the directory
+ * Returns the listing, to be given back with put_listing(), or NULL if the
+ * directory cannot be read
+ */
+static listing_t *get_listing(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;    // Nothing in it can match
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    for (unsigned i = 0; i < CACHE_SLOTS; i++) {
+        listing_t *l = &cache[i];
+        if (l->last_used != 0 && l->dev == st.st_dev && l->ino == st.st_ino &&
+            l->mtime.tv_sec == st.st_mtim.tv_sec && l->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            close(fd);
+            l->last_used = ++use_clock;
+            l->busy++;
+            return l;
+        }
+    }
+
+    // A directory changed within the current clock tick may change again
+    // without its mtime moving on, so such a listing is used only once
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    int racy = st.st_mtim.tv_sec > now.tv_sec ||
+               (st.st_mtim.tv_sec == now.tv_sec && st.st_mtim.tv_nsec >= now.tv_nsec);
+    listing_t *l = racy ? NULL : pick_slot(&st);
+    if (l == NULL && (l = calloc(1, sizeof(listing_t))) == NULL) {
+        perror("calloc");
+        close(fd);
+        return NULL;
+    }
+    l->cached = l >= cache && l < cache + CACHE_SLOTS;
+    l->last_used = 0;
+    int ret = read_listing(fd, l);
+    close(fd);
+    if (ret == -1) {
+        if (!l->cached) {
+            free(l->names);
+            free(l);
+        }
+        return NULL;
+    }
+    l->dev = st.st_dev;
+    l->ino = st.st_ino;
+    l->mtime = st.st_mtim;
+    l->last_used = l->cached ? ++use_clock : 0;
+    l->busy++;
+    return l;
+}
+
+static void put_listing(listing_t *l) {
+    l->busy--;
+    if (!l->cached) {
+        free(l->names);
+        free(l);
+    }
+}
+
+/*
+ * Check whether a name in a listing is a directory, following symbolic links
+ */
+static int is_dir(path_t *path, const char *name, unsigned char type) {
+    if (type == DT_DIR) {
+        return 1;
+    } else if (type != DT_UNKNOWN && type != DT_LNK) {
+        return 0;
+    }
+    size_t mark = path->len;
+    struct stat st;
+    int dir = path_append(path, name, strlen(name)) == 0 && stat(path->buf, &st) == 0 &&
+              S_ISDIR(st.st_mode);
+    path_truncate(path, mark);
+    return dir;
+}
+
+/*
+ * Expand the rest of a pattern in the directory that 'path' leads to
+ * Returns the number of paths added, or -1 on error
+ */
+static int expand_from(path_t *path, const char *pattern, strvec_t *out) {
+    const char *end = strchrnul(pattern, '/');
+    const char *rest = end;
+    int slash = *rest == '/';
+    while (*rest == '/') {
+        rest++;
+    }
+    size_t mark = path->len;
+    size_t len = end - pattern;
+    char component[len + 1];
+    memcpy(component, pattern, len);
+    component[len] = '\0';
+
+    if (!wildcard_is_pattern(component)) {
+        int ret = 0;
+        struct stat st;
+        if (path_append_literal(path, pattern, len) == -1 ||
+            (slash && path_append(path, "/", 1) == -1)) {
+            ret = -1;
+        } else if (*rest != '\0') {
+            ret = expand_from(path, rest, out);
+        } else if ((slash ? stat(path->buf, &st) : lstat(path->buf, &st)) == 0) {
+            ret = strvec_add(out, path->buf) == -1 ? -1 : 1;
+        }
+        path_truncate(path, mark);
+        return ret;
+    }
+
+    listing_t *l = get_listing(path->len == 0 ? "." : path->buf);
+    if (l == NULL) {
+        return 0;
+    }
+    int count = 0;
+    for (const char *e = l->names; e < l->names + l->size && count != -1;) {
+        unsigned char type = (unsigned char) e[0];
+        const char *name = e + 1;
+        size_t name_len = strlen(name);
+        e = name + name_len + 1;
+        if (fnmatch(component, name, FNM_PERIOD) != 0 || (slash && !is_dir(path, name, type))) {
+            continue;
+        }
+        int n;
+        if (path_append(path, name, name_len) == -1 ||
+            (slash && path_append(path, "/", 1) == -1)) {
+            n = -1;
+        } else if (*rest != '\0') {
+            n = expand_from(path, rest, out);
+        } else {
+            n = strvec_add(out, path->buf) == -1 ? -1 : 1;
+        }
+        count = n == -1 ? -1 : count + n;
+        path_truncate(path, mark);
+    }
+    put_listing(l);
+    return count;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+int wildcard_expand(const char *pattern, strvec_t *out) {
+    path_t path = {.buf = NULL, .len = 0, .capacity = 0};
+    unsigned first = out->length;
+    if (path_append(&path, "", 0) == -1) {
+        return -1;
+    }
+    if (*pattern == '/') {
+        while (*pattern == '/') {
+            pattern++;
+        }
+        if (path_append(&path, "/", 1) == -1) {
+            free(path.buf);
+            return -1;
+        }
+    }
+    int count = expand_from(&path, pattern, out);
+    free(path.buf);
+    if (count > 0) {
+        qsort(out->data + first, out->length - first, sizeof(char *), compare_paths);
+    }
+    return count;
+}
+
+void wildcard_free(void) {
+    for (unsigned i = 0; i < CACHE_SLOTS; i++) {
+        free(cache[i].names);
+    }
+    memset(cache, 0, sizeof(cache));
+}
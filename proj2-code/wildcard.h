@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include "string_vector.h"
+
+/*
+ * Pathname expansion of the patterns *, ? and [...], as in the shell. Each
+ * '/'-separated part of a pattern that contains one of them is matched
+ * against the names in its directory, and a name starting with '.' is only
+ * matched by a pattern that starts with '.' too. A backslash in a pattern
+ * makes the character after it literal.
+ *
+ * Directories are read with getdents64() in large batches, and the listings
+ * of the last few directories read are kept, keyed by their device, inode
+ * and modification time, so that a script that globs the same directory
+ * over and over reads it only once for as long as it does not change.
+ */
+
+/*
+ * Check whether a word contains anything to expand
+ * pattern: The word, with backslashes before its literal characters
+ * Returns nonzero if it has an unescaped * or ?, or a [ with a ] after it
+ */
+int wildcard_is_pattern(const char *pattern);
+
+/*
+ * Expand a pattern into the paths that it matches
+ * pattern: The pattern, with backslashes before its literal characters
+ * out: Vector the matching paths are added to, sorted
+ * Returns the number of paths added, which is 0 if none matched, or -1 on error
+ */
+int wildcard_expand(const char *pattern, strvec_t *out);
+
+/*
+ * Release the cached directory listings
+ */
+void wildcard_free(void);
+
+#endif    // WILDCARD_H